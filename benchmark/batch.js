@@ -0,0 +1,74 @@
+/*
+ * batch.js - Compare set throughput across batch sizes
+ *
+ * Writes the same number of nodes with db.batch() using batches
+ * of 1, 10, 100 and 1000 operations, with and without a transaction,
+ * then checks that a batch increment by a fraction, a tiny and a huge
+ * amount adds just that, and that one by NaN is refused:
+ *
+ *   node benchmark/batch.js [nodes]
+ */
+
+
+var gtm = require('../lib/nodem');
+var db = new gtm.Gtm();
+
+var nodes = parseInt(process.argv[2], 10) || 100000;
+var global = 'v4wBench';
+
+function bench(size, options) {
+  var start = process.hrtime(),
+      elapsed,
+      ops,
+      i,
+      j;
+
+  for (i = 0; i < nodes; i += size) {
+    ops = [];
+
+    for (j = i; j < i + size && j < nodes; j++) {
+      ops.push({op: 'set', global: global, subscripts: ['batch', j], data: 'value ' + j});
+    }
+
+    db.batch(ops, options);
+  }
+
+  elapsed = process.hrtime(start);
+  elapsed = elapsed[0] + elapsed[1] / 1e9;
+
+  console.log('batch size ' + size + (options.transaction ? ' (transaction)' : '') +
+              ': ' + Math.round(nodes / elapsed) + ' sets/sec');
+}
+
+db.open();
+
+[1, 10, 100, 1000].forEach(function (size) {
+  db.kill({global: global});
+  bench(size, {transaction: false});
+  db.kill({global: global});
+  bench(size, {transaction: true});
+});
+
+db.kill({global: global});
+
+[0.5, 1e-7, 1e21].forEach(function (amount, i) {
+  var node = {global: global, subscripts: ['increment', i]};
+
+  db.batch([{op: 'increment', global: global, subscripts: node.subscripts, increment: amount}]);
+
+  if (Number(db.get(node).data) !== amount) {
+    console.error('batch increment by ' + amount + ' gave ' + db.get(node).data);
+    process.exit(1);
+  }
+});
+
+try {
+  db.batch([{op: 'increment', global: global, subscripts: ['increment'], increment: NaN}]);
+  console.error('batch increment by NaN was not refused');
+  process.exit(1);
+} catch (error) {
+  /* refused before any call-in */
+}
+
+db.kill({global: global});
+db.close();
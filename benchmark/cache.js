@@ -0,0 +1,60 @@
+/*
+ * cache.js - Compare repeated reads with and without the read cache
+ *
+ * Reads the same few configuration nodes over and over, first going
+ * into GT.M every time and then with db.cache() turned on:
+ *
+ *   node benchmark/cache.js [iterations]
+ */
+
+
+var gtm = require('../lib/nodem');
+var db = new gtm.Gtm();
+
+var iterations = parseInt(process.argv[2], 10) || 100000;
+var global = 'v4wBench';
+
+function bench(name, fn) {
+  var start = process.hrtime(),
+      elapsed,
+      i;
+
+  for (i = 0; i < iterations; i++) {
+    fn(i);
+  }
+
+  elapsed = process.hrtime(start);
+  elapsed = elapsed[0] + elapsed[1] / 1e9;
+
+  console.log(name + ': ' + Math.round(iterations / elapsed) + ' ops/sec');
+}
+
+function read(i) {
+  db.get({global: global, subscripts: ['config', i % 10]});
+}
+
+db.open();
+db.kill({global: global});
+
+for (var i = 0; i < 10; i++) {
+  db.set({global: global, subscripts: ['config', i], data: 'setting ' + i});
+}
+
+bench('get', read);
+
+db.cache({entries: 100, ttl: 1000});
+bench('get, cached', read);
+
+bench('get, cached, a set every 100 reads', function (i) {
+  if (i % 100 === 0) {
+    db.set({global: global, subscripts: ['config', i % 10], data: 'setting ' + i});
+  }
+
+  read(i);
+});
+
+console.log('cache: ' + JSON.stringify(db.cache()));
+
+db.cache({entries: 0});
+db.kill({global: global});
+db.close();
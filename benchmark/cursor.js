@@ -0,0 +1,84 @@
+/*
+ * cursor.js - Compare walking a level with order() and with a cursor
+ *
+ * Fills a test global with keys, then walks them with order(), one
+ * call-in per key, and with cursors of a few prefetch sizes:
+ *
+ *   node benchmark/cursor.js [keys]
+ */
+
+
+var gtm = require('../lib/nodem');
+var db = new gtm.Gtm();
+
+var keys = parseInt(process.argv[2], 10) || 100000;
+var global = 'v4wBench';
+
+function bench(name, fn) {
+  var start = process.hrtime(),
+      elapsed,
+      count;
+
+  count = fn();
+
+  elapsed = process.hrtime(start);
+  elapsed = elapsed[0] + elapsed[1] / 1e9;
+
+  console.log(name + ': ' + count + ' keys, ' + Math.round(count / elapsed) + ' keys/sec');
+}
+
+db.open();
+db.kill({global: global});
+
+var nodes = [], i;
+
+for (i = 0; i < keys; i++) {
+  nodes.push({op: 'set', global: global, subscripts: ['cursor', i], data: 'value ' + i});
+
+  if (nodes.length === 1000) {
+    db.batch(nodes);
+    nodes = [];
+  }
+}
+
+if (nodes.length > 0) {
+  db.batch(nodes);
+}
+
+bench('order', function () {
+  var node = {global: global, subscripts: ['cursor', '']},
+      count = 0;
+
+  while (db.order(node).result !== '') {
+    count++;
+  }
+
+  return count;
+});
+
+[1, 10, 100, 1000].forEach(function (prefetch) {
+  bench('cursor prefetch ' + prefetch, function () {
+    var cursor = db.cursor({global: global, subscripts: ['cursor'], prefetch: prefetch}),
+        count = 0;
+
+    while (!cursor.next().done) {
+      count++;
+    }
+
+    return count;
+  });
+});
+
+bench('cursor with values', function () {
+  var cursor = db.cursor({global: global, subscripts: ['cursor'], values: true}),
+      count = 0;
+
+  while (!cursor.next().done) {
+    count++;
+  }
+
+  return count;
+});
+
+db.kill({global: global});
+db.close();
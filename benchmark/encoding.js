@@ -0,0 +1,53 @@
+/*
+ * encoding.js - Measure set/get with a non utf8 database encoding
+ *
+ * Run with XNODEM_ENCODING set (e.g. cp1251) to time the conversion
+ * of Cyrillic and of plain ASCII values:
+ *
+ *   XNODEM_ENCODING=cp1251 node benchmark/encoding.js [iterations]
+ */
+
+
+var gtm = require('../lib/nodem');
+var db = new gtm.Gtm();
+
+var iterations = parseInt(process.argv[2], 10) || 100000;
+var global = 'v4wBench';
+
+function bench(name, fn) {
+  var start = process.hrtime(),
+      elapsed,
+      i;
+
+  for (i = 0; i < iterations; i++) {
+    fn(i);
+  }
+
+  elapsed = process.hrtime(start);
+  elapsed = elapsed[0] + elapsed[1] / 1e9;
+
+  console.log(name + ': ' + Math.round(iterations / elapsed) + ' ops/sec, ' +
+              (elapsed * 1e6 / iterations).toFixed(2) + ' us/op');
+}
+
+db.open();
+db.kill({global: global});
+
+bench('set cyrillic', function (i) {
+  db.set({global: global, subscripts: ['cyrillic', i % 1000], data: 'какой-то тест ' + i});
+});
+
+bench('get cyrillic', function (i) {
+  db.get({global: global, subscripts: ['cyrillic', i % 1000]});
+});
+
+bench('set ascii', function (i) {
+  db.set({global: global, subscripts: ['ascii', i % 1000], data: 'some test ' + i});
+});
+
+bench('get ascii', function (i) {
+  db.get({global: global, subscripts: ['ascii', i % 1000]});
+});
+
+db.kill({global: global});
+db.close();
@@ -0,0 +1,72 @@
+/*
+ * index.js - Find nodes by value with a scan or with a secondary index
+ *
+ * Fills `records' records of a name and an age, then looks
+ * `lookups' names up once by walking the records with db.order() and
+ * db.get(), and once with db.lookup() on an index of the names, and
+ * prints the lookups/sec of each, and the records/sec set with the index
+ * on and off:
+ *
+ *   node benchmark/index.js [records] [lookups]
+ */
+
+
+var gtm = require('../lib/nodem');
+var db = new gtm.Gtm();
+
+var records = parseInt(process.argv[2], 10) || 10000;
+var lookups = parseInt(process.argv[3], 10) || 100;
+var global = 'v4wBench';
+var indexGlobal = 'v4wBenchIdx';
+
+function bench(name, count, unit, fn) {
+  var start = process.hrtime(),
+      elapsed,
+      i;
+
+  for (i = 0; i < count; i++) {
+    fn(i);
+  }
+
+  elapsed = process.hrtime(start);
+  elapsed = elapsed[0] + elapsed[1] / 1e9;
+
+  console.log(name + ': ' + Math.round(count / elapsed) + ' ' + unit + '/sec');
+}
+
+function fill(i) {
+  db.set({global: global, subscripts: [i, 'name'], data: 'name ' + i % 1000});
+  db.set({global: global, subscripts: [i, 'age'], data: i % 90});
+}
+
+db.open();
+db.kill({global: global});
+db.kill({global: indexGlobal});
+
+bench('set without index', records, 'records', fill);
+
+bench('scan with order and get', lookups, 'lookups', function (i) {
+  var node = {global: global, subscripts: ['']},
+      name = 'name ' + i,
+      found = [];
+
+  while ((node.subscripts[0] = db.order(node).result) !== '') {
+    if (db.get({global: global, subscripts: [node.subscripts[0], 'name']}).data === name) {
+      found.push(node.subscripts[0]);
+    }
+  }
+});
+
+db.index({name: 'v4wBenchName', global: global, subscripts: [null, 'name'],
+          into: {global: indexGlobal}});
+db.rebuildIndex({index: 'v4wBenchName'});
+
+bench('set with index', records, 'records', fill);
+
+bench('lookup', lookups, 'lookups', function (i) {
+  db.lookup({index: 'v4wBenchName', value: 'name ' + i});
+});
+
+db.kill({global: global});
+db.kill({global: indexGlobal});
+db.close();
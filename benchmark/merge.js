@@ -0,0 +1,76 @@
+/*
+ * merge.js - Load and read documents with a set per leaf or one merge
+ *
+ * Builds documents of `leaves' nodes and stores each one with a
+ * db.set() per leaf, then with db.merge() from the object, and reads
+ * it back with a db.get() per leaf, then with db.merge() to 'js':
+ *
+ *   node benchmark/merge.js [documents] [leaves]
+ */
+
+
+var gtm = require('../lib/nodem');
+var db = new gtm.Gtm();
+
+var documents = parseInt(process.argv[2], 10) || 100;
+var leaves = parseInt(process.argv[3], 10) || 1000;
+var global = 'v4wBench';
+
+function bench(name, fn) {
+  var start = process.hrtime(),
+      elapsed,
+      i;
+
+  for (i = 0; i < documents; i++) {
+    fn(i);
+  }
+
+  elapsed = process.hrtime(start);
+  elapsed = elapsed[0] + elapsed[1] / 1e9;
+
+  console.log(name + ': ' + Math.round(documents * leaves / elapsed) + ' leaves/sec');
+}
+
+/* ten sections of leaves/10 fields each */
+var doc = {};
+
+for (var n = 0; n < leaves; n++) {
+  var section = 'section' + n % 10;
+
+  doc[section] = doc[section] || {};
+  doc[section]['field' + n] = 'value ' + n;
+}
+
+function each(fn) {
+  Object.keys(doc).forEach(function (section) {
+    Object.keys(doc[section]).forEach(function (field) {
+      fn(section, field, doc[section][field]);
+    });
+  });
+}
+
+db.open();
+db.kill({global: global});
+
+bench('set per leaf', function (i) {
+  each(function (section, field, value) {
+    db.set({global: global, subscripts: ['doc', i, section, field], data: value});
+  });
+});
+
+bench('merge from object', function (i) {
+  db.merge({to: {global: global, subscripts: ['doc', i]}, from: doc});
+});
+
+bench('get per leaf', function (i) {
+  each(function (section, field) {
+    db.get({global: global, subscripts: ['doc', i, section, field]});
+  });
+});
+
+bench('merge to js', function (i) {
+  db.merge({to: 'js', from: {global: global, subscripts: ['doc', i]}});
+});
+
+db.kill({global: global});
+db.close();
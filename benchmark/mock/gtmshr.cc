@@ -0,0 +1,1265 @@
+/*
+ * gtmshr.cc - A stand-in for libgtmshr that runs the v4wNode call-ins
+ * against an in-memory store
+ *
+ * It lets the addon be built and benchmarked where GT.M is not
+ * installed, see `make bench'. The routines follow resources/nodem.ci
+ * and return what src/v4wNode.m returns, in the same result protocol,
+ * so the time spent in src/mumps.cc is what gets measured. This is not
+ * GT.M: nothing is shared between processes, locks always succeed,
+ * function() answers with its first argument and indexes only follow
+ * set and kill.
+ */
+
+extern "C" {
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gtmxc_types.h"
+}
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+/* a node is its global name followed by its subscripts */
+typedef std::vector<std::string> mkey;
+
+/* tell if `s' is a number in the canonic form of M, of 18 digits at most */
+static bool canonic(const std::string &s)
+{
+	size_t i = 0, start, n = s.size();
+	bool dot = false;
+
+	if (n == 0 || n > 18 + (s[0] == '-') + (s.find('.') != std::string::npos))
+		return false;
+	if (s[0] == '-')
+		i++;
+	start = i;
+	if (start == n)
+		return false;
+	for (; i < n; i++) {
+		if (s[i] == '.') {
+			if (dot)
+				return false;
+			dot = true;
+		} else if (s[i] < '0' || s[i] > '9') {
+			return false;
+		}
+	}
+	if (s == "0")
+		return true;
+	/* no leading zeros, no -0 and no 0.5 */
+	if (s[start] == '0')
+		return false;
+	if (dot && (s[n - 1] == '0' || s[n - 1] == '.'))
+		return false;
+	return true;
+}
+
+/* M collation: the empty string, then numbers in order, then strings */
+static int mcollate(const std::string &a, const std::string &b)
+{
+	bool na, nb;
+
+	if (a.empty() || b.empty())
+		return (int)b.empty() - (int)a.empty();
+	na = canonic(a);
+	nb = canonic(b);
+	if (na && nb) {
+		double x = strtod(a.c_str(), NULL), y = strtod(b.c_str(), NULL);
+		return x < y ? -1 : x > y;
+	}
+	if (na != nb)
+		return na ? -1 : 1;
+	return a.compare(b);
+}
+
+struct mless {
+	bool operator()(const mkey &a, const mkey &b) const
+	{
+		for (size_t i = 0; i < a.size() && i < b.size(); i++) {
+			int c = mcollate(a[i], b[i]);
+			if (c != 0)
+				return c < 0;
+		}
+		return a.size() < b.size();
+	}
+};
+
+typedef std::map<mkey, std::string, mless> mstore;
+
+static mstore store;
+static std::set<mkey, mless> locks;
+static std::string zstatus;
+/* what is left of a result longer than the caller takes at once */
+static std::string rest;
+static size_t result_size = 65535;
+
+static bool is_prefix(const mkey &prefix, const mkey &key)
+{
+	if (key.size() < prefix.size())
+		return false;
+	for (size_t i = 0; i < prefix.size(); i++) {
+		if (key[i] != prefix[i])
+			return false;
+	}
+	return true;
+}
+
+/* format a number the way M would show it */
+static std::string mnumber(double d)
+{
+	char buf[64];
+	std::string s;
+
+	snprintf(buf, sizeof(buf), "%.15g", d);
+	s = buf;
+	if (s == "-0")
+		return "0";
+	if (s.compare(0, 2, "0.") == 0)
+		s.erase(0, 1);
+	else if (s.compare(0, 3, "-0.") == 0)
+		s.erase(1, 1);
+	return s;
+}
+
+/* one `len:"value"' or `len:number' item as the addon sends it,
+ * a value is an M literal, "a""b"_$c(0)_"c" for a"b, a NUL and c
+ */
+static std::string mvalue(const char *p, size_t len)
+{
+	std::string s;
+
+	if (len >= 2 && p[0] == '"' && p[len - 1] == '"') {
+		size_t i = 1;
+
+		while (i < len - 1) {
+			if (p[i] == '"' && p[i + 1] == '"') {
+				s += '"';
+				i += 2;
+			} else if (p[i] == '"' && p[i + 1] == '_') {
+				/* "_$c(n,...)_" */
+				char *end;
+
+				i += 4;
+				do {
+					s += (char)strtoul(p + i + 1, &end, 10);
+					i = end - p;
+				} while (p[i] == ',');
+				i += 3;
+			} else {
+				s += p[i++];
+			}
+		}
+		return s;
+	}
+	s.assign(p, len);
+	return canonic(s) ? s : mnumber(strtod(s.c_str(), NULL));
+}
+
+static bool parse_list(const char *list, size_t size, std::vector<std::string> &out)
+{
+	size_t pos = 0;
+
+	out.clear();
+	while (pos < size) {
+		size_t len = 0;
+
+		if (list[pos] < '0' || list[pos] > '9')
+			return false;
+		while (pos < size && list[pos] >= '0' && list[pos] <= '9')
+			len = len * 10 + (list[pos++] - '0');
+		if (pos >= size || list[pos] != ':' || len > size - pos - 1)
+			return false;
+		pos++;
+		out.push_back(mvalue(list + pos, len));
+		pos += len;
+		if (pos < size && list[pos] == ',')
+			pos++;
+	}
+	return true;
+}
+
+static std::string global_name(const char *glvn)
+{
+	return std::string(glvn[0] == '^' ? glvn + 1 : glvn);
+}
+
+/* a name as lockList^v4wNode takes it, ?.1"^".1"%"1A.AN */
+static bool is_name(const std::string &glvn)
+{
+	size_t i = 0;
+
+	if (i < glvn.size() && glvn[i] == '^')
+		i++;
+	if (i < glvn.size() && glvn[i] == '%')
+		i++;
+	if (i == glvn.size() || !isalpha((unsigned char)glvn[i]))
+		return false;
+	for (; i < glvn.size(); i++) {
+		if (!isalnum((unsigned char)glvn[i]))
+			return false;
+	}
+	return true;
+}
+
+static bool make_key(const char *glvn, const std::string &subs, mkey &key)
+{
+	std::vector<std::string> list;
+
+	if (!parse_list(subs.data(), subs.size(), list))
+		return false;
+	key.assign(1, global_name(glvn));
+	key.insert(key.end(), list.begin(), list.end());
+	return true;
+}
+
+/* result fields, as encode/fs/fn/fv in v4wNode.m */
+static void fs(std::string &out, char tag, const std::string &value)
+{
+	char num[32];
+
+	snprintf(num, sizeof(num), "%c%c%zu:", tag, 's', value.size());
+	out += num;
+	out += value;
+}
+
+static void fn(std::string &out, char tag, const std::string &value)
+{
+	char num[32];
+
+	snprintf(num, sizeof(num), "%c%c%zu:", tag, 'n', value.size());
+	out += num;
+	out += value;
+}
+
+static void fv(std::string &out, char tag, const std::string &value, gtm_uint_t mode)
+{
+	if (!mode && value.size() < 19 && canonic(value))
+		fn(out, tag, value);
+	else
+		fs(out, tag, value);
+}
+
+static std::string encode(const std::string &fields)
+{
+	char num[32];
+
+	snprintf(num, sizeof(num), "%zu:", fields.size());
+	return num + fields;
+}
+
+static int mdata(const mkey &key)
+{
+	mstore::iterator it = store.lower_bound(key);
+	int defined = 0;
+
+	if (it != store.end() && it->first == key) {
+		defined = 1;
+		++it;
+	}
+	if (it != store.end() && is_prefix(key, it->first))
+		defined += 10;
+	return defined;
+}
+
+static std::string mget(const mkey &key)
+{
+	mstore::iterator it = store.find(key);
+
+	return it == store.end() ? std::string() : it->second;
+}
+
+static void mkill(const mkey &key)
+{
+	mstore::iterator it = store.lower_bound(key), end = it;
+
+	while (end != store.end() && is_prefix(key, end->first))
+		++end;
+	store.erase(it, end);
+}
+
+/* $order on the last subscript of `key' */
+static std::string morder(const mkey &key, int dir)
+{
+	size_t level = key.size() - 1;
+	mkey prefix(key.begin(), key.end() - 1);
+	const std::string &sub = key.back();
+	mstore::iterator it;
+
+	if (dir >= 0) {
+		it = store.lower_bound(key);
+		/* skip the node itself and its descendants */
+		while (it != store.end() && it->first.size() > level && it->first[level] == sub &&
+		       is_prefix(prefix, it->first))
+			++it;
+		if (it != store.end() && it->first.size() > level && is_prefix(prefix, it->first))
+			return it->first[level];
+		return std::string();
+	}
+	if (sub.empty()) {
+		it = store.lower_bound(prefix);
+		while (it != store.end() && is_prefix(prefix, it->first))
+			++it;
+	} else {
+		it = store.lower_bound(key);
+	}
+	if (it == store.begin())
+		return std::string();
+	--it;
+	if (it->first.size() > level && is_prefix(prefix, it->first))
+		return it->first[level];
+	return std::string();
+}
+
+/* index^v4wNode: the subscripts of the nodes an index covers, with
+ * any for those it takes any of, and the node its entries go under
+ */
+struct mindex {
+	std::string glvn;
+	std::vector<std::string> at;
+	std::vector<bool> any;
+	mkey into;
+};
+
+static std::map<std::string, mindex> indexes;
+
+/* the entry of an index for `key' holding `data', false if it has none */
+static bool ix_entry(const mindex &ix, const mkey &key, const std::string &data, mkey &entry)
+{
+	if (key[0] != ix.glvn || key.size() != ix.at.size() + 1 || data.empty())
+		return false;
+	entry = ix.into;
+	entry.push_back(data);
+	for (size_t i = 0; i < ix.at.size(); i++) {
+		if (ix.any[i])
+			entry.push_back(key[i + 1]);
+		else if (key[i + 1] != ix.at[i])
+			return false;
+	}
+	return true;
+}
+
+/* make or drop the index entries for `key' and the nodes below it */
+static void ix_update(const mkey &key, bool kill)
+{
+	std::map<std::string, mindex>::iterator ix;
+	mstore::iterator it;
+	mkey entry;
+
+	for (ix = indexes.begin(); ix != indexes.end(); ++ix) {
+		if (ix->second.glvn != key[0])
+			continue;
+		for (it = store.lower_bound(key); it != store.end() && is_prefix(key, it->first); ++it) {
+			if (!ix_entry(ix->second, it->first, it->second, entry))
+				continue;
+			if (kill)
+				store.erase(entry);
+			else
+				store[entry] = "";
+		}
+	}
+}
+
+/* cont^v4wNode: the subscripts of `key' from `from' on, in hex split
+ * by commas, for a next chunk to carry on after
+ */
+static std::string cont_of(const mkey &key, size_t from)
+{
+	static const char hex[] = "0123456789ABCDEF";
+	std::string cont;
+
+	for (size_t i = from; i < key.size(); i++) {
+		if (i > from)
+			cont += ',';
+		for (size_t j = 0; j < key[i].size(); j++) {
+			unsigned char byte = key[i][j];
+			cont += hex[byte >> 4];
+			cont += hex[byte & 15];
+		}
+	}
+	return cont;
+}
+
+static int hex_digit(char c)
+{
+	return c >= '0' && c <= '9' ? c - '0' : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+}
+
+/* contNode^v4wNode: `root' and the subscripts of a continuation made
+ * by cont_of, false if `cont' is not one
+ */
+static bool cont_key(const mkey &root, const std::string &cont, mkey &key)
+{
+	size_t pos = 0;
+
+	key = root;
+	if (cont.empty())
+		return false;
+	while (pos <= cont.size()) {
+		size_t end = cont.find(',', pos);
+		std::string sub;
+
+		if (end == std::string::npos)
+			end = cont.size();
+		if (end == pos || (end - pos) % 2)
+			return false;
+		for (; pos < end; pos += 2) {
+			int hi = hex_digit(cont[pos]), lo = hex_digit(cont[pos + 1]);
+			if (hi < 0 || lo < 0)
+				return false;
+			sub += (char)(hi * 16 + lo);
+		}
+		key.push_back(sub);
+		pos = end + 1;
+	}
+	return true;
+}
+
+/* the error contNode^v4wNode gives a start that is not a continuation */
+static bool bad_start(std::string &out)
+{
+	fn(out, 'o', "0");
+	fs(out, 'e', "Invalid start of a chunk");
+	return true;
+}
+
+/* the routines, each returns the fields of its result message */
+
+static bool r_data(const char *glvn, const std::string &subs, gtm_uint_t mode, std::string &out)
+{
+	mkey key;
+	char num[8];
+
+	if (!make_key(glvn, subs, key))
+		return false;
+	snprintf(num, sizeof(num), "%d", mdata(key));
+	fn(out, 'o', "1");
+	fs(out, 'g', key[0]);
+	fn(out, 'D', num);
+	return true;
+}
+
+static bool r_get(const char *glvn, const std::string &subs, gtm_uint_t mode, std::string &out)
+{
+	mkey key;
+	mstore::iterator it;
+
+	if (!make_key(glvn, subs, key))
+		return false;
+	it = store.find(key);
+	fn(out, 'o', "1");
+	fs(out, 'g', key[0]);
+	fs(out, 'd', it == store.end() ? std::string() : it->second);
+	fn(out, 'D', it == store.end() ? "0" : "1");
+	return true;
+}
+
+static bool r_set(const char *glvn, const std::string &subs, const std::string &data,
+		  gtm_uint_t mode, std::string &out)
+{
+	mkey key;
+	std::string value = data;
+
+	if (!make_key(glvn, subs, key))
+		return false;
+	/* set^v4wNode drops the quotes around strings */
+	if (!value.empty() && value[0] == '"')
+		value.erase(0, 1);
+	if (!value.empty() && value[value.size() - 1] == '"')
+		value.erase(value.size() - 1);
+	if (!indexes.empty())
+		ix_update(key, true);
+	store[key] = value;
+	if (!indexes.empty())
+		ix_update(key, false);
+	fn(out, 'o', "1");
+	fs(out, 'g', key[0]);
+	fs(out, 'd', value);
+	fs(out, 'r', "0");
+	return true;
+}
+
+static bool r_kill(const char *glvn, const std::string &subs, gtm_uint_t mode, std::string &out)
+{
+	mkey key;
+
+	if (!make_key(glvn, subs, key))
+		return false;
+	if (!indexes.empty())
+		ix_update(key, true);
+	mkill(key);
+	fn(out, 'o', "1");
+	fs(out, 'g', key[0]);
+	fs(out, 'r', "0");
+	return true;
+}
+
+static bool r_increment(const char *glvn, const std::string &subs, double incr,
+			gtm_uint_t mode, std::string &out)
+{
+	mkey key;
+	std::string value;
+
+	if (!make_key(glvn, subs, key))
+		return false;
+	value = mnumber(strtod(mget(key).c_str(), NULL) + incr);
+	store[key] = value;
+	fn(out, 'o', "1");
+	fs(out, 'g', key[0]);
+	fs(out, 'd', value);
+	return true;
+}
+
+/* read the four `len:bytes' fields of an operation at pos, raw */
+static bool read_op(const std::string &ops, size_t &pos, std::string op[4])
+{
+	for (int i = 0; i < 4; i++) {
+		char *end;
+		size_t len = strtoul(ops.c_str() + pos, &end, 10);
+		pos = end - ops.c_str();
+		if (pos >= ops.size() || ops[pos] != ':' || len > ops.size() - pos - 1)
+			return false;
+		op[i].assign(ops, pos + 1, len);
+		pos += len + 1;
+	}
+	return true;
+}
+
+static bool r_batch(const std::string &ops, gtm_uint_t mode, std::string &out)
+{
+	size_t pos = 0;
+
+	fn(out, 'o', "1");
+	while (pos < ops.size()) {
+		std::string op[4], ret;
+		bool ok = true;
+
+		if (!read_op(ops, pos, op))
+			return false;
+		if (op[0] == "data")
+			ok = r_data(op[1].c_str(), op[2], mode, ret);
+		else if (op[0] == "get")
+			ok = r_get(op[1].c_str(), op[2], mode, ret);
+		else if (op[0] == "increment")
+			ok = r_increment(op[1].c_str(), op[2], strtod(op[3].c_str(), NULL), mode, ret);
+		else if (op[0] == "kill")
+			ok = r_kill(op[1].c_str(), op[2], mode, ret);
+		else if (op[0] == "set")
+			ok = r_set(op[1].c_str(), op[2], op[3], mode, ret);
+		else {
+			fn(ret, 'o', "0");
+			fs(ret, 'e', "Unknown operation: " + op[0]);
+		}
+		if (!ok)
+			return false;
+		/* as "lm"_$$get(...), the nested message makes up the field */
+		out += "lm";
+		out += encode(ret);
+	}
+	return true;
+}
+
+/* set the nodes given as pairs of relative subscripts and data */
+static bool r_update(const char *glvn, const std::string &subs, const std::string &nodes,
+		     gtm_uint_t mode, std::string &out)
+{
+	std::vector<std::string> rel;
+	std::string pair[2];
+	size_t pos = 0;
+	mkey root, key;
+
+	if (!make_key(glvn, subs, root))
+		return false;
+	while (pos < nodes.size()) {
+		for (int i = 0; i < 2; i++) {
+			char *end;
+			size_t len = strtoul(nodes.c_str() + pos, &end, 10);
+			pos = end - nodes.c_str();
+			if (pos >= nodes.size() || nodes[pos] != ':' || len > nodes.size() - pos - 1)
+				return false;
+			pair[i].assign(nodes, pos + 1, len);
+			pos += len + 1;
+		}
+		if (!parse_list(pair[0].data(), pair[0].size(), rel))
+			return false;
+		key = root;
+		key.insert(key.end(), rel.begin(), rel.end());
+		/* data is not a literal, update^v4wNode drops its quotes */
+		if (pair[1].size() >= 2 && pair[1][0] == '"')
+			store[key] = pair[1].substr(1, pair[1].size() - 2);
+		else
+			store[key] = mvalue(pair[1].data(), pair[1].size());
+	}
+	fn(out, 'o', "1");
+	fs(out, 'g', root[0]);
+	fs(out, 'r', "0");
+	return true;
+}
+
+/* the subtree about `max' bytes at a time, each node a nested message
+ * that is never cut, only the whole result is handed out in pieces
+ */
+static bool r_retrieve(const char *glvn, const std::string &subs, const std::string &start,
+		       size_t max, gtm_uint_t mode, std::string &out)
+{
+	mkey root, last;
+	mstore::iterator it;
+
+	if (!make_key(glvn, subs, root))
+		return false;
+	/* start names the last node of the chunk before, as `c' gave it */
+	if (start.empty())
+		it = store.lower_bound(root);
+	else if (cont_key(root, start, last))
+		it = store.upper_bound(last);
+	else
+		return bad_start(out);
+	fn(out, 'o', "1");
+	for (; it != store.end() && is_prefix(root, it->first); ++it) {
+		std::string fields;
+		for (size_t i = root.size(); i < it->first.size(); i++)
+			fv(fields, 's', it->first[i], mode);
+		fs(fields, 'd', it->second);
+		out += "lm";
+		out += encode(fields);
+		if (out.size() > max) {
+			mstore::iterator next = it;
+			if (++next == store.end() || !is_prefix(root, next->first))
+				break;
+			fs(out, 'c', cont_of(it->first, root.size()));
+			break;
+		}
+	}
+	fs(out, 'g', root[0]);
+	return true;
+}
+
+static bool r_index(const std::string &name, const char *glvn, const std::string &pattern,
+		    const char *iglvn, const std::string &isubs, std::string &out)
+{
+	mindex ix;
+	size_t pos = 0;
+
+	if (!make_key(iglvn, isubs, ix.into))
+		return false;
+	ix.glvn = global_name(glvn);
+	while (pos < pattern.size()) {
+		char *end;
+		size_t len = strtoul(pattern.c_str() + pos, &end, 10);
+		pos = end - pattern.c_str() + 1;
+		if (pos > pattern.size() || pattern[pos - 1] != ':' || len > pattern.size() - pos)
+			return false;
+		ix.any.push_back(len == 0);
+		ix.at.push_back(len == 0 ? std::string() : pattern.substr(pos + 1, len - 1));
+		pos += len;
+	}
+	indexes[name] = ix;
+	fn(out, 'o', "1");
+	fs(out, 'g', ix.glvn);
+	fs(out, 'r', name);
+	return true;
+}
+
+static bool r_lookup(const std::string &name, const std::string &lo, const std::string &hi,
+		     const std::string &start, size_t max, size_t limit, gtm_uint_t mode, std::string &out)
+{
+	std::map<std::string, mindex>::iterator ix = indexes.find(name);
+	mstore::iterator it;
+	mkey from;
+	size_t count = 0, level;
+
+	if (ix == indexes.end()) {
+		fn(out, 'o', "0");
+		fs(out, 'e', "No such index: " + name);
+		return true;
+	}
+	const mkey &into = ix->second.into;
+	level = into.size();
+	if (!start.empty()) {
+		if (!cont_key(into, start, from))
+			return bad_start(out);
+		it = store.upper_bound(from);
+	} else {
+		from = into;
+		if (!lo.empty())
+			from.push_back(lo);
+		it = store.lower_bound(from);
+	}
+	fn(out, 'o', "1");
+	for (; it != store.end() && is_prefix(into, it->first) && it->first.size() > level; ++it) {
+		const mkey &entry = it->first;
+		std::string fields;
+		size_t key = level + 1;
+
+		if (!hi.empty() && mcollate(entry[level], hi) > 0)
+			break;
+		for (size_t i = 0; i < ix->second.at.size(); i++)
+			fv(fields, 's', ix->second.any[i] ? entry[key++] : ix->second.at[i], mode);
+		fv(fields, 'd', entry[level], mode);
+		out += "lm";
+		out += encode(fields);
+		if (out.size() > max || (limit && ++count >= limit)) {
+			fs(out, 'c', cont_of(entry, into.size()));
+			break;
+		}
+	}
+	fs(out, 'g', ix->second.glvn);
+	return true;
+}
+
+static bool r_rebuild_index(const std::string &name, const std::string &start, size_t max,
+			    std::string &out)
+{
+	std::map<std::string, mindex>::iterator ix = indexes.find(name);
+	mstore::iterator it;
+	mkey key, entry;
+	size_t count = 0, made = 0;
+	char num[32];
+
+	if (ix == indexes.end()) {
+		fn(out, 'o', "0");
+		fs(out, 'e', "No such index: " + name);
+		return true;
+	}
+	key.assign(1, ix->second.glvn);
+	if (start.empty()) {
+		mkill(ix->second.into);
+		it = store.lower_bound(key);
+	} else if (cont_key(mkey(1, ix->second.glvn), start, key)) {
+		it = store.upper_bound(key);
+	} else {
+		return bad_start(out);
+	}
+	fn(out, 'o', "1");
+	fs(out, 'g', ix->second.glvn);
+	for (; it != store.end() && it->first[0] == ix->second.glvn; ++it) {
+		if (ix_entry(ix->second, it->first, it->second, entry)) {
+			store[entry] = "";
+			made++;
+		}
+		if (++count >= max) {
+			fs(out, 'c', cont_of(it->first, 1));
+			break;
+		}
+	}
+	snprintf(num, sizeof(num), "%zu", made);
+	fn(out, 'r', num);
+	return true;
+}
+
+/* query^v4wNode without M patterns, m holds its six tests */
+static bool r_query(const char *glvn, const std::string &subs, const std::string &start, size_t max,
+		    const std::string &match, size_t limit, gtm_uint_t mode, std::string &out)
+{
+	std::string m[8];
+	mkey root, last;
+	mstore::iterator it;
+	size_t pos = 0, count = 0;
+
+	for (int i = 0; i < 8; i++) {
+		char *end;
+		size_t len = strtoul(match.c_str() + pos, &end, 10);
+		pos = end - match.c_str() + 1;
+		if (pos > match.size() || match[pos - 1] != ':' || len > match.size() - pos)
+			return false;
+		m[i].assign(match, pos, len);
+		pos += len;
+	}
+	/* the key bounds are n(umber) or s(tring) and the text */
+	for (int i = 6; i < 8; i++) {
+		if (!m[i].empty())
+			m[i] = m[i][0] == 'n' ? mnumber(strtod(m[i].c_str() + 1, NULL)) : m[i].substr(1);
+	}
+	if (!m[1].empty() || !m[3].empty() || !make_key(glvn, subs, root))
+		return false;
+	if (!start.empty() && !cont_key(root, start, last))
+		return bad_start(out);
+	if (!start.empty()) {
+		it = store.upper_bound(last);
+	} else if (!m[6].empty()) {
+		last = root;
+		last.push_back(m[6]);
+		it = store.lower_bound(last);
+	} else {
+		it = store.lower_bound(root);
+	}
+	fn(out, 'o', "1");
+	for (; it != store.end() && is_prefix(root, it->first); ++it) {
+		const std::string &sub = it->first.back(), &data = it->second;
+		double d = strtod(data.c_str(), NULL);
+
+		if (!m[7].empty() && it->first.size() > root.size() &&
+		    mcollate(it->first[root.size()], m[7]) >= 0)
+			break;
+		if (it->first.size() == root.size() ||
+		    sub.compare(0, m[0].size(), m[0]) != 0 ||
+		    data.compare(0, m[2].size(), m[2]) != 0 ||
+		    (!m[4].empty() && (!canonic(data) || d < strtod(m[4].c_str(), NULL))) ||
+		    (!m[5].empty() && (!canonic(data) || d > strtod(m[5].c_str(), NULL))))
+			goto next;
+		{
+			std::string fields;
+			for (size_t i = root.size(); i < it->first.size(); i++)
+				fv(fields, 's', it->first[i], mode);
+			fs(fields, 'd', data);
+			out += "lm";
+			out += encode(fields);
+			count++;
+		}
+next:
+		if (out.size() > max || (limit && count >= limit)) {
+			mstore::iterator following = it;
+			if (++following == store.end() || !is_prefix(root, following->first) ||
+			    (!m[7].empty() && mcollate(following->first[root.size()], m[7]) >= 0))
+				break;
+			fs(out, 'c', cont_of(it->first, root.size()));
+			break;
+		}
+	}
+	fs(out, 'g', root[0]);
+	return true;
+}
+
+/* nothing else runs here, so the reads are checked before any write */
+static bool r_tcommit(const std::string &ops, gtm_uint_t mode, std::string &out)
+{
+	std::string op[4], ret;
+	size_t pos = 0;
+	mkey key;
+
+	while (pos < ops.size()) {
+		if (!read_op(ops, pos, op) || !make_key(op[1].c_str(), op[2], key))
+			return false;
+		if (op[0] != "check" && op[0] != "absent")
+			continue;
+		mstore::iterator it = store.find(key);
+		/* the expected value comes quoted, as for a set */
+		if (op[0] == "absent" ? it != store.end() :
+		    it == store.end() || '"' + it->second + '"' != op[3]) {
+			fn(out, 'o', "0");
+			fs(out, 'e', "Transaction restart: a node it read has changed");
+			return true;
+		}
+	}
+	for (pos = 0; pos < ops.size();) {
+		read_op(ops, pos, op);
+		if (op[0] == "kill")
+			r_kill(op[1].c_str(), op[2], mode, ret);
+		else if (op[0] == "set")
+			r_set(op[1].c_str(), op[2], op[3], mode, ret);
+	}
+	fn(out, 'o', "1");
+	fn(out, 'r', "0");
+	return true;
+}
+
+static gtm_status_t fail(const std::string &message)
+{
+	zstatus = "150373850,mock libgtmshr: " + message;
+	return 1;
+}
+
+/* getNumber, setNumber and incrementNumber, with the numbers in place of a result */
+static gtm_status_t r_number(const std::string &name, va_list ap)
+{
+	const char *glvn = va_arg(ap, const char *);
+	std::string subs = va_arg(ap, const char *);
+	mkey key;
+
+	if (!make_key(glvn, subs, key))
+		return fail("bad subscripts");
+	if (name == "get_number") {
+		gtm_double_t *number = va_arg(ap, gtm_double_t *);
+		gtm_int_t *defined = va_arg(ap, gtm_int_t *);
+		mstore::iterator it = store.find(key);
+		*defined = it != store.end();
+		*number = *defined ? strtod(it->second.c_str(), NULL) : 0;
+	} else if (name == "set_number") {
+		store[key] = mnumber(va_arg(ap, gtm_double_t));
+	} else {
+		gtm_double_t incr = va_arg(ap, gtm_double_t);
+		gtm_double_t *number = va_arg(ap, gtm_double_t *);
+		std::string value = mnumber(strtod(mget(key).c_str(), NULL) + incr);
+		store[key] = value;
+		*number = strtod(value.c_str(), NULL);
+	}
+	return 0;
+}
+
+/* hand out a message a piece at a time, like encode^v4wNode */
+static void put(gtm_char_t *ret, const std::string &msg)
+{
+	size_t len = msg.size() < result_size ? msg.size() : result_size;
+
+	memcpy(ret, msg.data(), len);
+	ret[len] = '\0';
+	rest.assign(msg, len, std::string::npos);
+}
+
+gtm_status_t gtm_init(void)
+{
+	return 0;
+}
+
+gtm_status_t gtm_exit(void)
+{
+	locks.clear();
+	return 0;
+}
+
+void gtm_zstatus(gtm_char_t *msg, gtm_int_t len)
+{
+	snprintf(msg, len, "%s", zstatus.c_str());
+}
+
+gtm_status_t gtm_cip(ci_name_descriptor *ci, ...)
+{
+	std::string name(ci->rtn_name.address, ci->rtn_name.length), out;
+	gtm_char_t *ret;
+	gtm_status_t status = 0;
+	va_list ap;
+
+	va_start(ap, ci);
+	/* the call-ins without a result */
+	if (name == "result_size") {
+		result_size = va_arg(ap, gtm_uint_t);
+		rest.clear();
+		va_end(ap);
+		return 0;
+	}
+	if (name == "get_number" || name == "set_number" || name == "increment_number") {
+		status = r_number(name, ap);
+		va_end(ap);
+		return status;
+	}
+	ret = va_arg(ap, gtm_char_t *);
+
+	if (name == "more") {
+		put(ret, std::string(rest));
+		va_end(ap);
+		return 0;
+	}
+	if (name == "version") {
+		strcpy(ret, "Node.js Adaptor for GT.M: Version: 0.9.2 (FWSLC); GT.M version: mock");
+		va_end(ap);
+		return 0;
+	}
+	if (name == "data" || name == "get" || name == "kill") {
+		const char *glvn = va_arg(ap, const char *);
+		std::string subs = va_arg(ap, const char *);
+		gtm_uint_t mode = va_arg(ap, gtm_uint_t);
+		bool ok = name == "data" ? r_data(glvn, subs, mode, out) :
+			  name == "get" ? r_get(glvn, subs, mode, out) : r_kill(glvn, subs, mode, out);
+		if (!ok)
+			status = fail("bad subscripts");
+	} else if (name == "set") {
+		const char *glvn = va_arg(ap, const char *);
+		std::string subs = va_arg(ap, const char *);
+		gtm_string_t *value = va_arg(ap, gtm_string_t *);
+		std::string data(value->address, value->length);
+		gtm_uint_t mode = va_arg(ap, gtm_uint_t);
+		if (!r_set(glvn, subs, data, mode, out))
+			status = fail("bad subscripts");
+	} else if (name == "increment") {
+		const char *glvn = va_arg(ap, const char *);
+		std::string subs = va_arg(ap, const char *);
+		gtm_double_t incr = va_arg(ap, gtm_double_t);
+		gtm_uint_t mode = va_arg(ap, gtm_uint_t);
+		if (!r_increment(glvn, subs, incr, mode, out))
+			status = fail("bad subscripts");
+	} else if (name == "order" || name == "previous") {
+		const char *glvn = va_arg(ap, const char *);
+		std::string subs = va_arg(ap, const char *);
+		gtm_uint_t mode = va_arg(ap, gtm_uint_t);
+		mkey key;
+		if (!make_key(glvn, subs, key) || key.size() < 2) {
+			status = fail("bad subscripts");
+		} else {
+			fn(out, 'o', "1");
+			fs(out, 'g', key[0]);
+			fv(out, 'r', morder(key, name == "order" ? 1 : -1), mode);
+		}
+	} else if (name == "order_page") {
+		const char *glvn = va_arg(ap, const char *);
+		std::string subs = va_arg(ap, const char *);
+		gtm_uint_t max = va_arg(ap, gtm_uint_t);
+		gtm_uint_t size = va_arg(ap, gtm_uint_t);
+		gtm_int_t dir = va_arg(ap, gtm_int_t);
+		gtm_uint_t values = va_arg(ap, gtm_uint_t);
+		gtm_uint_t mode = va_arg(ap, gtm_uint_t);
+		mkey key;
+		if (!make_key(glvn, subs, key) || key.size() < 2) {
+			status = fail("bad subscripts");
+		} else {
+			std::string keys;
+			gtm_uint_t i;
+			for (i = 0; i < max && keys.size() <= size; i++) {
+				key.back() = morder(key, dir);
+				if (key.back().empty())
+					break;
+				fv(keys, 'l', key.back(), mode);
+				if (values)
+					fs(keys, 'd', mget(key));
+			}
+			fn(out, 'o', "1");
+			out += keys;
+			if (!key.back().empty())
+				fn(out, 'c', "1");
+		}
+	} else if (name == "partition") {
+		const char *glvn = va_arg(ap, const char *);
+		std::string subs = va_arg(ap, const char *);
+		gtm_uint_t parts = va_arg(ap, gtm_uint_t);
+		gtm_uint_t mode = va_arg(ap, gtm_uint_t);
+		mkey key;
+		if (!make_key(glvn, subs, key)) {
+			status = fail("bad subscripts");
+		} else {
+			std::vector<std::string> keys;
+			char num[32];
+			key.push_back(std::string());
+			while (!(key.back() = morder(key, 1)).empty())
+				keys.push_back(key.back());
+			snprintf(num, sizeof(num), "%zu", keys.size());
+			fn(out, 'o', "1");
+			fn(out, 'r', num);
+			if (parts > keys.size())
+				parts = keys.size();
+			for (gtm_uint_t i = 1; i < parts; i++)
+				fv(out, 'l', keys[i * keys.size() / parts], mode);
+			fs(out, 'g', key[0]);
+		}
+	} else if (name == "lock" || name == "unlock") {
+		const char *glvn = va_arg(ap, const char *);
+		std::string subs = va_arg(ap, const char *);
+		mkey key;
+		if (name == "lock")
+			(void)va_arg(ap, gtm_double_t);
+		if (name == "unlock" && glvn[0] == '\0' && subs.empty()) {
+			locks.clear();
+			fn(out, 'o', "1");
+			fs(out, 'r', "0");
+		} else if (!make_key(glvn, subs, key)) {
+			status = fail("bad subscripts");
+		} else {
+			if (name == "lock")
+				locks.insert(key);
+			else
+				locks.erase(key);
+			fn(out, 'o', "1");
+			fs(out, 'g', key[0]);
+			fs(out, 'r', name == "lock" ? "1" : "0");
+		}
+	} else if (name == "lock_list") {
+		std::string nodes = va_arg(ap, const char *);
+		std::string op[4];
+		std::vector<mkey> keys;
+		size_t pos = 0;
+		bool ok = true;
+		std::string bad;
+		mkey key;
+		while (ok && bad.empty() && pos < nodes.size()) {
+			ok = read_op(nodes, pos, op) && make_key(op[1].c_str(), op[2], key);
+			if (!is_name(op[1]))
+				bad = op[1];
+			keys.push_back(key);
+		}
+		if (!ok) {
+			status = fail("bad lock list");
+		} else if (!bad.empty()) {
+			fn(out, 'o', "0");
+			fs(out, 'e', "Invalid global name: " + bad);
+		} else {
+			locks.insert(keys.begin(), keys.end());
+			fn(out, 'o', "1");
+			fs(out, 'r', "1");
+		}
+	} else if (name == "merge") {
+		const char *fglvn = va_arg(ap, const char *);
+		std::string fsubs = va_arg(ap, const char *);
+		const char *tglvn = va_arg(ap, const char *);
+		std::string tsubs = va_arg(ap, const char *);
+		gtm_uint_t mode = va_arg(ap, gtm_uint_t);
+		mkey from, to;
+		if (!make_key(fglvn, fsubs, from) || !make_key(tglvn, tsubs, to)) {
+			status = fail("bad subscripts");
+		} else {
+			std::vector<std::pair<mkey, std::string> > nodes;
+			for (mstore::iterator it = store.lower_bound(from);
+			     it != store.end() && is_prefix(from, it->first); ++it) {
+				mkey node(to);
+				node.insert(node.end(), it->first.begin() + from.size(), it->first.end());
+				nodes.push_back(std::make_pair(node, it->second));
+			}
+			for (size_t i = 0; i < nodes.size(); i++)
+				store[nodes[i].first] = nodes[i].second;
+			fn(out, 'o', "1");
+			fs(out, 'g', from[0]);
+			if (from.size() > 1 || to.size() > 1) {
+				for (size_t i = 1; i < from.size(); i++)
+					fv(out, 's', from[i], mode);
+				fs(out, 's', to[0]);
+				for (size_t i = 1; i < to.size(); i++)
+					fv(out, 's', to[i], mode);
+			}
+			fs(out, 'r', "1");
+		}
+	} else if (name == "function") {
+		std::string func = va_arg(ap, const char *);
+		std::string args = va_arg(ap, const char *);
+		(void)va_arg(ap, gtm_uint_t);
+		gtm_uint_t mode = va_arg(ap, gtm_uint_t);
+		std::vector<std::string> list;
+		if (!parse_list(args.data(), args.size(), list)) {
+			status = fail("bad arguments");
+		} else {
+			fn(out, 'o', "1");
+			fs(out, 'f', func);
+			fv(out, 'r', list.empty() ? std::string() : list[0], mode);
+		}
+	} else if (name == "call") {
+		/* a prepared function that gives back its first argument */
+		std::string func = va_arg(ap, const char *);
+		std::string types = va_arg(ap, const char *);
+		gtm_string_t *first = va_arg(ap, gtm_string_t *);
+		for (int i = 1; i < 8; i++)
+			(void)va_arg(ap, gtm_string_t *);
+		gtm_uint_t mode = va_arg(ap, gtm_uint_t);
+		std::string value;
+		if (!types.empty())
+			value.assign(first->address, first->length);
+		fn(out, 'o', "1");
+		fs(out, 'f', func);
+		fv(out, 'r', value, mode);
+	} else if (name == "get_buffer") {
+		const char *glvn = va_arg(ap, const char *);
+		std::string subs = va_arg(ap, const char *);
+		gtm_string_t *data = va_arg(ap, gtm_string_t *);
+		mkey key;
+		if (!make_key(glvn, subs, key)) {
+			status = fail("bad subscripts");
+		} else {
+			mstore::iterator it = store.find(key);
+			std::string value = it == store.end() ? std::string() : it->second;
+			char num[32];
+			/* gtm truncates an output string to the room it was given */
+			if ((size_t)data->length > value.size())
+				data->length = value.size();
+			memcpy(data->address, value.data(), data->length);
+			snprintf(num, sizeof(num), "%zu", value.size());
+			fn(out, 'o', "1");
+			fs(out, 'g', key[0]);
+			fn(out, 'D', it == store.end() ? "0" : "1");
+			fn(out, 'z', num);
+		}
+	} else if (name == "set_buffer") {
+		const char *glvn = va_arg(ap, const char *);
+		std::string subs = va_arg(ap, const char *);
+		gtm_string_t *data = va_arg(ap, gtm_string_t *);
+		mkey key;
+		if (!make_key(glvn, subs, key)) {
+			status = fail("bad subscripts");
+		} else {
+			store[key].assign(data->address, data->length);
+			fn(out, 'o', "1");
+			fs(out, 'g', key[0]);
+			fs(out, 'r', "0");
+		}
+	} else if (name == "batch") {
+		gtm_string_t *value = va_arg(ap, gtm_string_t *);
+		std::string ops(value->address, value->length);
+		(void)va_arg(ap, gtm_uint_t);
+		gtm_uint_t mode = va_arg(ap, gtm_uint_t);
+		if (!r_batch(ops, mode, out))
+			status = fail("bad batch");
+	} else if (name == "update") {
+		const char *glvn = va_arg(ap, const char *);
+		std::string subs = va_arg(ap, const char *);
+		gtm_string_t *value = va_arg(ap, gtm_string_t *);
+		std::string nodes(value->address, value->length);
+		gtm_uint_t mode = va_arg(ap, gtm_uint_t);
+		if (!r_update(glvn, subs, nodes, mode, out))
+			status = fail("bad nodes");
+	} else if (name == "retrieve") {
+		const char *glvn = va_arg(ap, const char *);
+		std::string subs = va_arg(ap, const char *);
+		std::string start = va_arg(ap, const char *);
+		gtm_uint_t max = va_arg(ap, gtm_uint_t);
+		gtm_uint_t mode = va_arg(ap, gtm_uint_t);
+		if (!r_retrieve(glvn, subs, start, max, mode, out))
+			status = fail("bad subscripts");
+	} else if (name == "index") {
+		std::string iname = va_arg(ap, const char *);
+		const char *glvn = va_arg(ap, const char *);
+		std::string pattern = va_arg(ap, const char *);
+		const char *iglvn = va_arg(ap, const char *);
+		std::string isubs = va_arg(ap, const char *);
+		if (!r_index(iname, glvn, pattern, iglvn, isubs, out))
+			status = fail("bad index");
+	} else if (name == "lookup") {
+		std::string iname = va_arg(ap, const char *);
+		std::string lo = va_arg(ap, const char *);
+		std::string hi = va_arg(ap, const char *);
+		std::string start = va_arg(ap, const char *);
+		gtm_uint_t max = va_arg(ap, gtm_uint_t);
+		gtm_uint_t limit = va_arg(ap, gtm_uint_t);
+		gtm_uint_t mode = va_arg(ap, gtm_uint_t);
+		if (!r_lookup(iname, lo, hi, start, max, limit, mode, out))
+			status = fail("bad subscripts");
+	} else if (name == "rebuild_index") {
+		std::string iname = va_arg(ap, const char *);
+		std::string start = va_arg(ap, const char *);
+		gtm_uint_t max = va_arg(ap, gtm_uint_t);
+		if (!r_rebuild_index(iname, start, max, out))
+			status = fail("bad subscripts");
+	} else if (name == "query") {
+		const char *glvn = va_arg(ap, const char *);
+		std::string subs = va_arg(ap, const char *);
+		std::string start = va_arg(ap, const char *);
+		gtm_uint_t max = va_arg(ap, gtm_uint_t);
+		std::string match = va_arg(ap, const char *);
+		gtm_uint_t limit = va_arg(ap, gtm_uint_t);
+		gtm_uint_t mode = va_arg(ap, gtm_uint_t);
+		if (!r_query(glvn, subs, start, max, match, limit, mode, out))
+			status = fail("bad query, the mock has no M patterns");
+	} else if (name == "tcommit") {
+		gtm_string_t *value = va_arg(ap, gtm_string_t *);
+		std::string ops(value->address, value->length);
+		gtm_uint_t mode = va_arg(ap, gtm_uint_t);
+		if (!r_tcommit(ops, mode, out))
+			status = fail("bad transaction");
+	} else if (name == "global_directory") {
+		gtm_uint_t max = va_arg(ap, gtm_uint_t);
+		std::string lo = va_arg(ap, const char *);
+		std::string hi = va_arg(ap, const char *);
+		gtm_uint_t n = 0;
+		std::string last;
+		fn(out, 'o', "1");
+		for (mstore::iterator it = store.begin(); it != store.end(); ++it) {
+			const std::string &glb = it->first[0];
+			if (glb == last || (!lo.empty() && glb < lo) || (!hi.empty() && glb > hi))
+				continue;
+			if (max > 0 && n++ == max)
+				break;
+			fs(out, 'l', glb);
+			last = glb;
+		}
+	} else {
+		status = fail(name + " is not emulated");
+	}
+	va_end(ap);
+	if (status == 0)
+		put(ret, encode(out));
+	return status;
+}
+
+gtm_status_t gtm_ci(const gtm_char_t *c_rtn_name, ...)
+{
+	return fail(std::string(c_rtn_name) + " is only emulated through gtm_cip");
+}
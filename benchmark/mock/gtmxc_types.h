@@ -0,0 +1,34 @@
+/*
+ * gtmxc_types.h - The part of the GT.M call-in interface used by the addon,
+ * for building it against the mock library in gtmshr.cc
+ */
+
+#ifndef GTMXC_TYPES_H
+#define GTMXC_TYPES_H
+
+typedef int gtm_status_t;
+typedef int gtm_int_t;
+typedef unsigned int gtm_uint_t;
+typedef long gtm_long_t;
+typedef unsigned long gtm_ulong_t;
+typedef float gtm_float_t;
+typedef double gtm_double_t;
+typedef char gtm_char_t;
+
+typedef struct {
+	gtm_long_t length;
+	gtm_char_t *address;
+} gtm_string_t;
+
+typedef struct {
+	gtm_string_t rtn_name;
+	void *handle;
+} ci_name_descriptor;
+
+gtm_status_t gtm_init(void);
+gtm_status_t gtm_exit(void);
+gtm_status_t gtm_ci(const gtm_char_t *c_rtn_name, ...);
+gtm_status_t gtm_cip(ci_name_descriptor *ci, ...);
+void gtm_zstatus(gtm_char_t *msg, gtm_int_t len);
+
+#endif /* GTMXC_TYPES_H */
@@ -0,0 +1,85 @@
+/*
+ * pool.js - How a Pool scales with its number of child processes
+ *
+ * Runs the same mix of sets and gets with pools of 1, 2, 4, ... up to
+ * the number of cores, keeping a fixed number of calls in flight per
+ * child, and prints the ops/sec of each:
+ *
+ *   node benchmark/pool.js [operations] [max children]
+ */
+
+
+var os = require('os');
+var gtm = require('../lib/nodem');
+
+var operations = parseInt(process.argv[2], 10) || 100000;
+var maxSize = parseInt(process.argv[3], 10) || os.cpus().length;
+var global = 'v4wBench';
+var inFlight = 32;
+var sizes = [];
+
+for (var size = 1; size < maxSize; size *= 2) {
+  sizes.push(size);
+}
+
+sizes.push(maxSize);
+
+function run(size, done) {
+  var pool = new gtm.Pool({size: size}),
+      sent = 0,
+      finished = 0,
+      start;
+
+  function next() {
+    var i = sent++,
+        node = {global: global, subscripts: ['pool', i % 1000, i % 10]};
+
+    if (i % 2 === 0) {
+      node.data = 'value ' + i;
+      pool.set(node, finish);
+    } else {
+      pool.get(node, finish);
+    }
+  }
+
+  function finish(error) {
+    if (error) {
+      console.error('pool call failed: ' + JSON.stringify(error));
+      process.exit(1);
+    }
+
+    if (++finished === operations) {
+      var elapsed = process.hrtime(start);
+
+      elapsed = elapsed[0] + elapsed[1] / 1e9;
+      console.log(size + ' children: ' + Math.round(operations / elapsed) + ' ops/sec');
+
+      pool.close(function () {
+        done();
+      });
+    } else if (sent < operations) {
+      next();
+    }
+  }
+
+  pool.open(function (error) {
+    if (error) {
+      console.error('pool.open() failed: ' + JSON.stringify(error));
+      process.exit(1);
+    }
+
+    start = process.hrtime();
+
+    while (sent < Math.min(operations, inFlight * size)) {
+      next();
+    }
+  });
+}
+
+(function loop() {
+  var size = sizes.shift();
+
+  if (size !== undefined) {
+    run(size, loop);
+  }
+})();
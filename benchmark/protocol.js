@@ -0,0 +1,49 @@
+/*
+ * protocol.js - Measure the cost of decoding call-in results
+ *
+ * Runs tight get/order/set loops against a test global and prints
+ * ops/sec for each, run it on builds before and after a change to
+ * the result protocol to compare them:
+ *
+ *   node benchmark/protocol.js [iterations]
+ */
+
+
+var gtm = require('../lib/nodem');
+var db = new gtm.Gtm();
+
+var iterations = parseInt(process.argv[2], 10) || 100000;
+var global = 'v4wBench';
+
+function bench(name, fn) {
+  var start = process.hrtime(),
+      elapsed,
+      i;
+
+  for (i = 0; i < iterations; i++) {
+    fn(i);
+  }
+
+  elapsed = process.hrtime(start);
+  elapsed = elapsed[0] + elapsed[1] / 1e9;
+
+  console.log(name + ': ' + Math.round(iterations / elapsed) + ' ops/sec');
+}
+
+db.open();
+db.kill({global: global});
+
+bench('set', function (i) {
+  db.set({global: global, subscripts: ['protocol', i % 1000], data: 'value ' + i});
+});
+
+bench('get', function (i) {
+  db.get({global: global, subscripts: ['protocol', i % 1000]});
+});
+
+bench('order', function (i) {
+  db.order({global: global, subscripts: ['protocol', i % 1000]});
+});
+
+db.kill({global: global});
+db.close();
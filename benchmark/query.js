@@ -0,0 +1,64 @@
+/*
+ * query.js - Filter a subtree in M or node by node from JavaScript
+ *
+ * Fills a subtree of `nodes' nodes with numbers, then finds those from
+ * 100 to 199 once with db.order() and db.get() per node and once with
+ * db.query(), and prints the nodes/sec scanned by each:
+ *
+ *   node benchmark/query.js [nodes] [runs]
+ */
+
+
+var gtm = require('../lib/nodem');
+var db = new gtm.Gtm();
+
+var nodes = parseInt(process.argv[2], 10) || 100000;
+var runs = parseInt(process.argv[3], 10) || 10;
+var global = 'v4wBench';
+
+function bench(name, fn) {
+  var start = process.hrtime(),
+      found,
+      elapsed,
+      i;
+
+  for (i = 0; i < runs; i++) {
+    found = fn();
+  }
+
+  elapsed = process.hrtime(start);
+  elapsed = elapsed[0] + elapsed[1] / 1e9;
+
+  console.log(name + ': ' + Math.round(runs * nodes / elapsed) + ' nodes/sec, ' + found + ' found');
+}
+
+db.open();
+db.kill({global: global});
+
+for (var i = 0; i < nodes; i++) {
+  db.set({global: global, subscripts: ['query', i], data: i % 1000});
+}
+
+bench('order and get', function () {
+  var found = 0,
+      node = {global: global, subscripts: ['query', '']},
+      value;
+
+  while ((node.subscripts[1] = db.order(node).result) !== '') {
+    value = db.get(node).data;
+
+    if (value >= 100 && value <= 199) {
+      found++;
+    }
+  }
+
+  return found;
+});
+
+bench('query', function () {
+  return db.query({global: global, subscripts: ['query'],
+                   match: {valueRange: {min: 100, max: 199}}}).results.length;
+});
+
+db.kill({global: global});
+db.close();
@@ -0,0 +1,80 @@
+/*
+ * quoting.js - Measure set/get with subscripts and data that need escapes
+ *
+ * Subscripts go to M as string literals, a quote in one is doubled and
+ * a control character goes as $c(). Times plain subscripts, which go
+ * as they are, against ones with quotes and control characters, long
+ * and short, and checks that data with a NUL comes back whole when
+ * written by set, batch and update:
+ *
+ *   node benchmark/quoting.js [iterations]
+ */
+
+
+var gtm = require('../lib/nodem');
+var db = new gtm.Gtm();
+
+var iterations = parseInt(process.argv[2], 10) || 100000;
+var global = 'v4wBench';
+var long = new Array(201).join('x');
+
+function bench(name, fn) {
+  var start = process.hrtime(),
+      elapsed,
+      i;
+
+  for (i = 0; i < iterations; i++) {
+    fn(i);
+  }
+
+  elapsed = process.hrtime(start);
+  elapsed = elapsed[0] + elapsed[1] / 1e9;
+
+  console.log(name + ': ' + Math.round(iterations / elapsed) + ' ops/sec, ' +
+              (elapsed * 1e6 / iterations).toFixed(2) + ' us/op');
+}
+
+db.open();
+db.kill({global: global});
+
+bench('set plain', function (i) {
+  db.set({global: global, subscripts: ['plain', long + i % 1000], data: 'value ' + i});
+});
+
+bench('get plain', function (i) {
+  db.get({global: global, subscripts: ['plain', long + i % 1000]});
+});
+
+bench('set quoted', function (i) {
+  db.set({global: global, subscripts: ['quoted', long + '"' + i % 1000 + '"'], data: 'value ' + i});
+});
+
+bench('get quoted', function (i) {
+  db.get({global: global, subscripts: ['quoted', long + '"' + i % 1000 + '"']});
+});
+
+bench('set control', function (i) {
+  db.set({global: global, subscripts: ['control', long + '\t' + i % 1000 + '\n'], data: 'value ' + i});
+});
+
+bench('get control', function (i) {
+  db.get({global: global, subscripts: ['control', long + '\t' + i % 1000 + '\n']});
+});
+
+var data = 'a "b"\u0000c\r\n';
+
+db.set({global: global, subscripts: ['a "b"\u0000c'], data: data});
+
+db.batch([{op: 'set', global: global, subscripts: ['batch'], data: data}]);
+db.update({global: global, subscripts: ['update'], object: {a: data}});
+
+[['a "b"\u0000c'], ['batch'], ['update', 'a']].forEach(function (subscripts) {
+  if (db.get({global: global, subscripts: subscripts}).data !== data) {
+    console.error('value with a quote, a NUL and control characters did not come back whole from ' +
+                  JSON.stringify(subscripts));
+    process.exit(1);
+  }
+});
+
+db.kill({global: global});
+db.close();
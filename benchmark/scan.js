@@ -0,0 +1,90 @@
+/*
+ * scan.js - Read a whole subtree in one process and with parallelScan
+ *
+ * Fills a subtree with `nodes' nodes under 1000 first level keys,
+ * reads it back with db.query() a chunk at a time, then with
+ * db.parallelScan() over 1, 2, 4, ... up to `partitions' child
+ * processes, in key order and not, and prints the nodes/sec of each:
+ *
+ *   node benchmark/scan.js [nodes] [partitions]
+ */
+
+
+var os = require('os');
+var gtm = require('../lib/nodem');
+var db = new gtm.Gtm();
+
+var nodes = parseInt(process.argv[2], 10) || 1000000;
+var maxPartitions = parseInt(process.argv[3], 10) || os.cpus().length;
+var global = 'v4wBench';
+var runs = [];
+
+for (var size = 1; size < maxPartitions; size *= 2) {
+  runs.push({partitions: size, ordered: true});
+}
+
+runs.push({partitions: maxPartitions, ordered: true});
+runs.push({partitions: maxPartitions, ordered: false});
+
+function report(name, start, count) {
+  var elapsed = process.hrtime(start);
+
+  elapsed = elapsed[0] + elapsed[1] / 1e9;
+
+  if (count !== nodes) {
+    console.error(name + ' read ' + count + ' of ' + nodes + ' nodes');
+    process.exit(1);
+  }
+
+  console.log(name + ': ' + Math.round(nodes / elapsed) + ' nodes/sec');
+}
+
+db.open();
+db.kill({global: global});
+
+for (var i = 0; i < nodes; i++) {
+  db.set({global: global, subscripts: ['scan', i % 1000, i], data: 'value ' + i});
+}
+
+var start = process.hrtime(),
+    count = 0,
+    result = {};
+
+do {
+  result = db.query({global: global, subscripts: ['scan'], limit: 10000, start: result.next});
+  count += result.results.length;
+} while (result.next !== undefined);
+
+report('query, one process', start, count);
+
+(function loop() {
+  var run = runs.shift(),
+      count = 0,
+      start;
+
+  if (run === undefined) {
+    db.kill({global: global});
+    db.close();
+    return;
+  }
+
+  start = process.hrtime();
+
+  db.parallelScan({
+    global: global,
+    subscripts: ['scan'],
+    partitions: run.partitions,
+    ordered: run.ordered
+  }, function () {
+    count++;
+  }, function (error) {
+    if (error) {
+      console.error('parallelScan failed: ' + (error.message || JSON.stringify(error)));
+      process.exit(1);
+    }
+
+    report('parallelScan, ' + run.partitions + ' partitions' + (run.ordered ? '' : ', unordered'),
+           start, count);
+    loop();
+  });
+})();
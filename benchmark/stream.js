@@ -0,0 +1,66 @@
+/*
+ * stream.js - Throughput of exportStream and importStream
+ *
+ * Fills a subtree with `nodes' nodes of `size' bytes, exports it to a
+ * file, imports the file into another subtree and prints the MB/sec of
+ * each, along with the resident memory at the end:
+ *
+ *   node benchmark/stream.js [nodes] [size]
+ */
+
+
+var fs = require('fs');
+var os = require('os');
+var path = require('path');
+var gtm = require('../lib/nodem');
+var db = new gtm.Gtm();
+
+var nodes = parseInt(process.argv[2], 10) || 100000;
+var size = parseInt(process.argv[3], 10) || 100;
+var global = 'v4wBench';
+var file = path.join(os.tmpdir(), 'v4wBench.' + process.pid + '.v4w');
+var value = new Array(size + 1).join('x');
+
+function report(name, start) {
+  var elapsed = process.hrtime(start),
+      bytes = fs.statSync(file).size;
+
+  elapsed = elapsed[0] + elapsed[1] / 1e9;
+  console.log(name + ': ' + (bytes / 1048576 / elapsed).toFixed(1) + ' MB/sec, ' +
+              Math.round(nodes / elapsed) + ' nodes/sec');
+}
+
+function exit(error) {
+  console.error('stream failed: ' + (error.message || JSON.stringify(error)));
+  process.exit(1);
+}
+
+db.open();
+db.kill({global: global});
+
+for (var i = 0; i < nodes; i++) {
+  db.set({global: global, subscripts: ['export', i % 1000, i], data: value});
+}
+
+var start = process.hrtime();
+
+db.exportStream({global: global, subscripts: ['export']})
+  .on('error', exit)
+  .pipe(fs.createWriteStream(file))
+  .on('finish', function () {
+    report('export', start);
+
+    start = process.hrtime();
+
+    fs.createReadStream(file)
+      .pipe(db.importStream({global: global, subscripts: ['import']}))
+      .on('error', exit)
+      .on('finish', function () {
+        report('import', start);
+        console.log('rss: ' + Math.round(process.memoryUsage().rss / 1048576) + ' MB');
+
+        fs.unlinkSync(file);
+        db.kill({global: global});
+        db.close();
+      });
+  });
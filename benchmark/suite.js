@@ -0,0 +1,241 @@
+/*
+ * suite.js - Throughput and latency of every Gtm method
+ *
+ * Times get, set, order, data, kill, increment, their number variants,
+ * merge, function, a prepared function, lock and unlock across value
+ * sizes and subscript depths, and prints the ops/sec and the p50/p99
+ * latency of each. `make bench' runs it against the in-memory stand-in
+ * for libgtmshr in benchmark/mock, so only the cost of the addon itself
+ * is measured; it runs against GT.M as well. A 128KB value read by
+ * batch and query checks that a nested result longer than one call-in
+ * returns comes back whole.
+ *
+ *   node benchmark/suite.js [iterations] [--json results.json]
+ *                           [--compare baseline.json] [--threshold percent]
+ *
+ * With --compare it exits with 1 when any case got slower than the
+ * baseline by more than the threshold (10% by default).
+ */
+
+
+var fs = require('fs');
+var gtm = require('../lib/nodem');
+var db = new gtm.Gtm();
+
+var global = 'v4wBench';
+var iterations = 20000;
+var json, compare, threshold = 10;
+var results = [];
+
+(function (argv) {
+  for (var i = 0; i < argv.length; i++) {
+    if (argv[i] === '--json') {
+      json = argv[++i];
+    } else if (argv[i] === '--compare') {
+      compare = argv[++i];
+    } else if (argv[i] === '--threshold') {
+      threshold = parseFloat(argv[++i]);
+    } else if (parseInt(argv[i], 10) > 0) {
+      iterations = parseInt(argv[i], 10);
+    }
+  }
+})(process.argv.slice(2));
+
+function subscripts(depth, i) {
+  var subs = ['suite'];
+
+  while (subs.length < depth - 1) {
+    subs.push('level' + subs.length);
+  }
+
+  if (depth > 1) {
+    subs.push(i % 1000);
+  }
+
+  return subs;
+}
+
+function value(size) {
+  return new Array(size + 1).join('x');
+}
+
+function micros(ns) {
+  return (ns / 1000).toFixed(2);
+}
+
+function bench(name, fn) {
+  var samples = new Array(iterations),
+      warmup = Math.min(1000, iterations),
+      start,
+      elapsed,
+      t,
+      i;
+
+  for (i = 0; i < warmup; i++) {
+    fn(i);
+  }
+
+  start = process.hrtime();
+
+  for (i = 0; i < iterations; i++) {
+    t = process.hrtime();
+    fn(i);
+    t = process.hrtime(t);
+    samples[i] = t[0] * 1e9 + t[1];
+  }
+
+  elapsed = process.hrtime(start);
+  elapsed = elapsed[0] + elapsed[1] / 1e9;
+
+  samples.sort(function (a, b) {
+    return a - b;
+  });
+
+  var result = {
+    name: name,
+    ops: Math.round(iterations / elapsed),
+    p50: samples[Math.floor(iterations * 0.5)],
+    p99: samples[Math.min(iterations - 1, Math.floor(iterations * 0.99))]
+  };
+
+  results.push(result);
+
+  console.log(name + new Array(Math.max(1, 32 - name.length)).join(' ') +
+              result.ops + ' ops/sec, p50 ' + micros(result.p50) + ' us, p99 ' + micros(result.p99) + ' us');
+}
+
+db.open();
+db.kill({global: global});
+
+[16, 1024, 65536].forEach(function (size) {
+  var data = value(size);
+
+  bench('set ' + size + 'B', function (i) {
+    db.set({global: global, subscripts: subscripts(2, i), data: data});
+  });
+
+  bench('get ' + size + 'B', function (i) {
+    db.get({global: global, subscripts: subscripts(2, i)});
+  });
+});
+
+/* a value longer than one call-in returns, nested in a batch and a query result */
+var big = value(131072);
+
+db.set({global: global, subscripts: ['big', 1], data: big});
+
+bench('batch get 128KB', function () {
+  if (db.batch([{op: 'get', global: global, subscripts: ['big', 1]}])[0].data !== big) {
+    throw new Error('batch cut a value longer than 64KB');
+  }
+});
+
+bench('query 128KB', function () {
+  if (db.query({global: global, subscripts: ['big']}).results[0].data !== big) {
+    throw new Error('query cut a value longer than 64KB');
+  }
+});
+
+db.kill({global: global, subscripts: ['big']});
+
+[1, 4, 16].forEach(function (depth) {
+  var data = value(16);
+
+  bench('set depth ' + depth, function (i) {
+    db.set({global: global, subscripts: subscripts(depth, i), data: data});
+  });
+
+  bench('get depth ' + depth, function (i) {
+    db.get({global: global, subscripts: subscripts(depth, i)});
+  });
+
+  bench('data depth ' + depth, function (i) {
+    db.data({global: global, subscripts: subscripts(depth, i)});
+  });
+
+  if (depth > 1) {
+    bench('order depth ' + depth, function (i) {
+      db.order({global: global, subscripts: subscripts(depth, i)});
+    });
+  }
+});
+
+bench('increment', function (i) {
+  db.increment({global: global, subscripts: ['counter', i % 100]});
+});
+
+bench('incrementNumber', function (i) {
+  db.incrementNumber({global: global, subscripts: ['counter', i % 100]});
+});
+
+bench('setNumber', function (i) {
+  db.setNumber({global: global, subscripts: ['number', i % 100], data: i});
+});
+
+bench('getNumber', function (i) {
+  db.getNumber({global: global, subscripts: ['number', i % 100]});
+});
+
+bench('merge', function (i) {
+  db.merge({from: {global: global, subscripts: subscripts(2, i)},
+            to: {global: global, subscripts: ['merged', i % 1000]}});
+});
+
+bench('function', function (i) {
+  db.function({function: 'FUNC^%DH', arguments: [i]});
+});
+
+var dh = db.prepare('FUNC^%DH');
+
+bench('prepared function', function (i) {
+  dh(i);
+});
+
+bench('lock', function (i) {
+  db.lock({global: global, subscripts: ['lock', i]});
+});
+
+bench('unlock', function (i) {
+  db.unlock({global: global, subscripts: ['lock', i]});
+});
+
+bench('kill', function (i) {
+  db.kill({global: global, subscripts: subscripts(2, i)});
+});
+
+db.kill({global: global});
+db.close();
+
+if (json) {
+  fs.writeFileSync(json, JSON.stringify(results, null, 2) + '\n');
+}
+
+if (compare) {
+  var baseline = {},
+      slower = 0;
+
+  JSON.parse(fs.readFileSync(compare, 'utf8')).forEach(function (result) {
+    baseline[result.name] = result;
+  });
+
+  results.forEach(function (result) {
+    var base = baseline[result.name],
+        change;
+
+    if (!base) {
+      return;
+    }
+
+    change = (result.ops - base.ops) / base.ops * 100;
+
+    if (change < -threshold) {
+      console.log('slower: ' + result.name + ' ' + change.toFixed(1) + '% (' +
+                  base.ops + ' -> ' + result.ops + ' ops/sec)');
+      slower++;
+    }
+  });
+
+  if (slower > 0) {
+    process.exit(1);
+  }
+}
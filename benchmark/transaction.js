@@ -0,0 +1,74 @@
+/*
+ * transaction.js - Compare single sets with the same sets in transactions
+ *
+ * Writes records of ten nodes each, first one set at a time and then
+ * one db.transaction() per record, where the ten writes go to GT.M in
+ * a single call-in and a single commit. Then checks that a read inside
+ * a transaction gives 18 digits as a number and 19 as a string, as
+ * GT.M keeps 18 digits of a number:
+ *
+ *   node benchmark/transaction.js [records]
+ */
+
+
+var gtm = require('../lib/nodem');
+var db = new gtm.Gtm();
+
+var records = parseInt(process.argv[2], 10) || 10000;
+var global = 'v4wBench';
+
+function bench(name, fn) {
+  var start = process.hrtime(),
+      elapsed,
+      i;
+
+  for (i = 0; i < records; i++) {
+    fn(i);
+  }
+
+  elapsed = process.hrtime(start);
+  elapsed = elapsed[0] + elapsed[1] / 1e9;
+
+  console.log(name + ': ' + Math.round(records / elapsed) + ' records/sec');
+}
+
+function write(i) {
+  for (var field = 0; field < 10; field++) {
+    db.set({global: global, subscripts: ['record', i, field], data: 'value ' + field});
+  }
+}
+
+db.open();
+db.kill({global: global});
+
+bench('set', write);
+
+bench('set, a transaction per record', function (i) {
+  db.transaction(function () {
+    write(i);
+  });
+});
+
+bench('increment, a transaction per record', function (i) {
+  db.transaction(function () {
+    db.increment({global: global, subscripts: ['count']});
+    write(i);
+  });
+});
+
+db.set({global: global, subscripts: ['digits', 18], data: '123456789012345678'});
+db.set({global: global, subscripts: ['digits', 19], data: '1234567890123456789'});
+
+db.transaction(function () {
+  var digits18 = db.get({global: global, subscripts: ['digits', 18]}).data,
+      digits19 = db.get({global: global, subscripts: ['digits', 19]}).data;
+
+  if (typeof digits18 !== 'number' || digits19 !== '1234567890123456789') {
+    console.error('a read in a transaction gave ' + digits18 + ' for 18 digits and ' +
+                  digits19 + ' for 19');
+    process.exit(1);
+  }
+});
+
+db.kill({global: global});
+db.close();
@@ -0,0 +1,62 @@
+/*
+ * writebehind.js - Telemetry writes with and without write-behind
+ *
+ * Counts events into `counters' counter nodes and sets a last-seen
+ * node per counter, first with a call-in per write and then with
+ * db.writeBehind() turned on, which folds the writes to a node into
+ * one and makes them in batches:
+ *
+ *   node benchmark/writebehind.js [events] [counters]
+ */
+
+
+var gtm = require('../lib/nodem');
+var db = new gtm.Gtm();
+
+var events = parseInt(process.argv[2], 10) || 100000;
+var counters = parseInt(process.argv[3], 10) || 100;
+var global = 'v4wBench';
+
+function bench(name, fn) {
+  var start = process.hrtime(),
+      elapsed,
+      i;
+
+  for (i = 0; i < events; i++) {
+    fn(i);
+  }
+
+  db.flush();
+
+  elapsed = process.hrtime(start);
+  elapsed = elapsed[0] + elapsed[1] / 1e9;
+
+  console.log(name + ': ' + Math.round(events / elapsed) + ' events/sec');
+}
+
+function record(i) {
+  db.increment({global: global, subscripts: ['count', i % counters]});
+  db.set({global: global, subscripts: ['seen', i % counters], data: i});
+}
+
+db.open();
+db.kill({global: global});
+
+bench('call-in per write', record);
+
+db.kill({global: global});
+db.writeBehind({entries: 1000, interval: 100});
+bench('write-behind', record);
+
+var total = 0;
+
+for (var n = 0; n < counters; n++) {
+  total += db.getNumber({global: global, subscripts: ['count', n]});
+}
+
+console.log('counted ' + total + ' of ' + events + ' events');
+console.log('writeBehind: ' + JSON.stringify(db.writeBehind()));
+
+db.writeBehind({entries: 0});
+db.kill({global: global});
+db.close();
@@ -1,11 +1,19 @@
 {
+  'variables': {
+    # 1 links against the in-memory stand-in in benchmark/mock, see `make bench'
+    'gtm_mock%': 0
+  },
   'targets': [
     {
       'target_name': 'mumps',
       'type': 'loadable_module',
       'sources': [
         'src/mumps.cc',
-	'src/iconvm.cc'
+	'src/cache.cc',
+	'src/iconvm.cc',
+	'src/protocol.cc',
+	'src/stats.cc',
+	'src/worker.cc'
       ],
       'cflags': [
 	'-Wall',
@@ -23,21 +31,53 @@
           'variables': {
             'gtm_dist%': '/usr/gtm'
           }
+        }],
+        ['gtm_mock == 1', {
+          'dependencies': [
+            'gtmshr_mock'
+          ]
+        }, {
+          'include_dirs': [
+            '<(gtm_dist)'
+          ],
+          'libraries': [
+            '-L<(gtm_dist)',
+            '-lgtmshr'
+          ],
+          'ldflags': [
+            '-Wl,-rpath,<(gtm_dist),--enable-new-dtags',
+          ]
         }]
       ],
-      'include_dirs': [
-        '<(gtm_dist)'
-      ],
-      'libraries': [
-        '-L<(gtm_dist)',
-        '-lgtmshr'
-      ],
       'defines': [
         'GTM_VERSION=61'
-      ],
-      'ldflags': [
-        '-Wl,-rpath,<(gtm_dist),--enable-new-dtags',
       ]
     }
+  ],
+  'conditions': [
+    ['gtm_mock == 1', {
+      'targets': [
+        {
+          'target_name': 'gtmshr_mock',
+          'type': 'static_library',
+          'sources': [
+            'benchmark/mock/gtmshr.cc'
+          ],
+          'include_dirs': [
+            'benchmark/mock'
+          ],
+          'cflags': [
+            '-Wall',
+            '-std=c++11',
+            '-fPIC'
+          ],
+          'direct_dependent_settings': {
+            'include_dirs': [
+              'benchmark/mock'
+            ]
+          }
+        }
+      ]
+    }]
   ]
 }
@@ -0,0 +1,43 @@
+/*
+ * async.js - Test the asynchronous API
+ *
+ * Every method takes an optional callback as its last argument,
+ * the call-in is then made on the GT.M worker thread and the
+ * event loop stays free until the result is delivered.
+ */
+
+
+var gtm = require('../lib/nodem');
+var db = new gtm.Gtm();
+
+db.open();
+
+var node = {global: 'dlw', subscripts: ['async', 1], data: 'record 1'};
+
+db.set(node, function (error, result) {
+  if (error) {
+    console.error('db.set() failed: ' + JSON.stringify(error));
+    return;
+  }
+
+  console.log('db.set(): ' + JSON.stringify(result));
+
+  db.get({global: 'dlw', subscripts: ['async', 1]}, function (error, result) {
+    console.log('db.get(): ' + JSON.stringify(error || result));
+
+    if (typeof Promise !== 'function') {
+      db.close();
+      return;
+    }
+
+    db.orderAsync({global: 'dlw', subscripts: ['async', '']}).then(function (result) {
+      console.log('db.orderAsync(): ' + JSON.stringify(result));
+    }, function (error) {
+      console.error('db.orderAsync() failed: ' + JSON.stringify(error));
+    }).then(function () {
+      db.close();
+    });
+  });
+});
+
+console.log('event loop is not blocked');
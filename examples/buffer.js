@@ -0,0 +1,29 @@
+/*
+ * buffer.js - Test storing binary data with getBuffer/setBuffer
+ *
+ * The bytes of a Buffer go to GT.M as they are, with no quoting
+ * or re-encoding, so any value up to the maximum string length
+ * can be stored, NUL bytes included.
+ */
+
+
+var gtm = require('../lib/nodem');
+var db = new gtm.Gtm();
+
+db.open();
+
+var blob = new Buffer(256);
+
+for (var i = 0; i < blob.length; i++) {
+  blob[i] = i;
+}
+
+var ret = db.setBuffer({global: 'dlw', subscripts: ['blob', 1], data: blob});
+console.log('db.setBuffer(): ' + JSON.stringify(ret));
+
+ret = db.getBuffer({global: 'dlw', subscripts: ['blob', 1], size: blob.length});
+console.log('db.getBuffer(): ' + ret.data.length + ' bytes, ' +
+            (ret.data.toString('hex') === blob.toString('hex') ? 'same' : 'different'));
+
+db.kill({global: 'dlw', subscripts: ['blob']});
+db.close();
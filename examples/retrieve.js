@@ -26,71 +26,18 @@ db.open();
 
 var node = {global: 'zewd', subscripts: ['config']};
 
-var retrieve = function (node) {
-  "use strict";
-
-  var global = node.global,
-      subscripts = JSON.stringify(node.subscripts),
-      obj,
-      retrieveData;
-
-  retrieveData = function (node) {
-    console.log('in retrieveData: node = ' + JSON.stringify(node));
-
-    var subs = '',
-        data,
-        value,
-        newNode,
-        subObj,
-        obj = {};
-
-    node.subscripts.push(subs);
-
-    do {
-      console.log('calling order: node = ' + JSON.stringify(node));
-
-      subs = db.order(node).result;
-
-      console.log('subs = ' + subs);
-
-      if (subs !== '') {
-        node.subscripts.pop();
-        node.subscripts.push(subs);
-
-        data = db.data(node).defined;
-
-        if (data === 10) {
-          newNode = {global: node.global, subscripts: node.subscripts};
-          subObj = retrieveData(newNode);
-
-          obj[subs] = subObj;
-
-          node.subscripts.pop();
-        } else if (data === 1) {
-          value = db.get(node).data;
-
-          obj[subs] = value;
-        }
-      }
-    } while (subs !== '');
-
-    return obj;
-  };
-
-  obj = retrieveData(node);
-
-  return {
-    node: {
-      global: global,
-      subscripts: JSON.parse(subscripts)
-    },
+/*
+ * retrieve walks the whole subtree inside GT.M, a chunk at a time,
+ * and returns it as one object. A node that has both data and
+ * children keeps its data under the '' key.
+ */
+var obj = db.retrieve(node);
 
-    object: obj
-  };
-};
+console.log('results = ' + JSON.stringify(obj));
 
-var obj = retrieve(node);
+/* update writes an object tree back, the reverse of retrieve */
+var ret = db.update({global: 'zewd', subscripts: ['copy'], object: obj.object});
 
-console.log('results = ' + JSON.stringify(obj));
+console.log('update = ' + JSON.stringify(ret));
 
 db.close();
@@ -0,0 +1,31 @@
+/*
+ * writebehind.js - Count events with write-behind on
+ *
+ * With db.writeBehind() on, set, kill and increment are held and made
+ * later in batches, the writes to the same node folded into one. A
+ * held increment can not tell the new value: it answers with
+ * held: true and no data. db.flush() makes the held writes now.
+ */
+
+
+var gtm = require('../lib/nodem');
+var db = new gtm.Gtm();
+
+db.open();
+db.writeBehind({entries: 1000, interval: 100});
+
+var ret;
+
+for (var i = 0; i < 10; i++) {
+  ret = db.increment({global: 'dlw', subscripts: ['events']});
+}
+
+console.log('db.increment(): ' + JSON.stringify(ret));
+
+db.flush();
+
+console.log('db.get() after db.flush(): ' + db.get({global: 'dlw', subscripts: ['events']}).data);
+
+db.writeBehind({entries: 0});
+db.kill({global: 'dlw', subscripts: ['events']});
+db.close();
@@ -0,0 +1,258 @@
+/*
+ * ipc.js - The binary protocol between a Pool and its child processes
+ *
+ * Every message is a frame:
+ *
+ *   length (uint32) id (uint32) code (uint8) value
+ *
+ * where `length' counts the bytes after itself, `id' pairs a reply
+ * with its request and `code' is the method index in a request, or
+ * one of REPLY_* in a reply. The value is the argument object of the
+ * request, or the result of the reply, as a tagged tree:
+ *
+ *   undefined, null, false, true   the tag alone
+ *   number                         the tag and a float64
+ *   string, Buffer                 the tag, a uint32 byte length and the bytes
+ *   array                          the tag, a uint32 count and the items
+ *   object                         the tag, a uint32 count and key, value pairs
+ *
+ * All numbers are little endian.
+ */
+
+
+var TAG_UNDEFINED = 0,
+    TAG_NULL = 1,
+    TAG_FALSE = 2,
+    TAG_TRUE = 3,
+    TAG_NUMBER = 4,
+    TAG_STRING = 5,
+    TAG_BUFFER = 6,
+    TAG_ARRAY = 7,
+    TAG_OBJECT = 8;
+
+var HEADER_LEN = 9;
+
+exports.REPLY_OK = 0;
+exports.REPLY_THROWN = 1;
+
+/*
+ * The methods a child answers, a request carries the index. Keep the
+ * order, only add to the end.
+ */
+exports.methods = [
+    'open', 'close', 'batch', 'cache', 'data', 'function', 'get', 'getBuffer',
+    'global_directory', 'increment', 'kill', 'lock', 'merge', 'next', 'next_node',
+    'order', 'previous', 'previous_node', 'retrieve', 'set', 'setBuffer', 'stats',
+    'unlock', 'update', 'version', 'getNumber', 'incrementNumber', 'setNumber',
+    'exportChunk', 'importChunk', 'query', 'index', 'lookup', 'rebuildIndex',
+    'writeBehind', 'flush', 'partition'
+];
+
+function size(value) {
+    var n, keys, i;
+
+    if (value === undefined || value === null || typeof value === 'boolean') {
+        return 1;
+    }
+
+    if (typeof value === 'number') {
+        return 9;
+    }
+
+    if (typeof value === 'string') {
+        return 5 + Buffer.byteLength(value, 'utf8');
+    }
+
+    if (Buffer.isBuffer(value)) {
+        return 5 + value.length;
+    }
+
+    n = 5;
+
+    if (Array.isArray(value)) {
+        for (i = 0; i < value.length; i++) {
+            n += size(value[i]);
+        }
+
+        return n;
+    }
+
+    keys = Object.keys(value);
+
+    for (i = 0; i < keys.length; i++) {
+        n += size(keys[i]) + size(value[keys[i]]);
+    }
+
+    return n;
+}
+
+function write(buf, pos, value) {
+    var keys, len, i;
+
+    if (value === undefined || typeof value === 'function') {
+        buf[pos] = TAG_UNDEFINED;
+        return pos + 1;
+    }
+
+    if (value === null) {
+        buf[pos] = TAG_NULL;
+        return pos + 1;
+    }
+
+    if (typeof value === 'boolean') {
+        buf[pos] = value ? TAG_TRUE : TAG_FALSE;
+        return pos + 1;
+    }
+
+    if (typeof value === 'number') {
+        buf[pos] = TAG_NUMBER;
+        buf.writeDoubleLE(value, pos + 1);
+        return pos + 9;
+    }
+
+    if (typeof value === 'string') {
+        buf[pos] = TAG_STRING;
+        len = buf.write(value, pos + 5, 'utf8');
+        buf.writeUInt32LE(len, pos + 1);
+        return pos + 5 + len;
+    }
+
+    if (Buffer.isBuffer(value)) {
+        buf[pos] = TAG_BUFFER;
+        buf.writeUInt32LE(value.length, pos + 1);
+        value.copy(buf, pos + 5);
+        return pos + 5 + value.length;
+    }
+
+    if (Array.isArray(value)) {
+        buf[pos] = TAG_ARRAY;
+        buf.writeUInt32LE(value.length, pos + 1);
+        pos += 5;
+
+        for (i = 0; i < value.length; i++) {
+            pos = write(buf, pos, value[i]);
+        }
+
+        return pos;
+    }
+
+    keys = Object.keys(value);
+    buf[pos] = TAG_OBJECT;
+    buf.writeUInt32LE(keys.length, pos + 1);
+    pos += 5;
+
+    for (i = 0; i < keys.length; i++) {
+        pos = write(buf, pos, keys[i]);
+        pos = write(buf, pos, value[keys[i]]);
+    }
+
+    return pos;
+}
+
+/* read the value at state.pos and move past it */
+function read(buf, state) {
+    var tag = buf[state.pos],
+        value,
+        key,
+        len,
+        i;
+
+    state.pos++;
+
+    switch (tag) {
+    case TAG_UNDEFINED:
+        return undefined;
+    case TAG_NULL:
+        return null;
+    case TAG_FALSE:
+        return false;
+    case TAG_TRUE:
+        return true;
+    case TAG_NUMBER:
+        value = buf.readDoubleLE(state.pos);
+        state.pos += 8;
+        return value;
+    case TAG_STRING:
+    case TAG_BUFFER:
+        len = buf.readUInt32LE(state.pos);
+        state.pos += 4;
+
+        if (tag === TAG_STRING) {
+            value = buf.toString('utf8', state.pos, state.pos + len);
+        } else {
+            value = new Buffer(len);
+            buf.copy(value, 0, state.pos, state.pos + len);
+        }
+
+        state.pos += len;
+        return value;
+    case TAG_ARRAY:
+        len = buf.readUInt32LE(state.pos);
+        state.pos += 4;
+        value = new Array(len);
+
+        for (i = 0; i < len; i++) {
+            value[i] = read(buf, state);
+        }
+
+        return value;
+    case TAG_OBJECT:
+        len = buf.readUInt32LE(state.pos);
+        state.pos += 4;
+        value = {};
+
+        for (i = 0; i < len; i++) {
+            key = read(buf, state);
+            value[key] = read(buf, state);
+        }
+
+        return value;
+    default:
+        throw new Error('Invalid value tag in a pool message: ' + tag);
+    }
+}
+
+/* make the frame of a message */
+exports.encode = function (id, code, value) {
+    var len = HEADER_LEN + size(value),
+        buf = new Buffer(len);
+
+    buf.writeUInt32LE(len - 4, 0);
+    buf.writeUInt32LE(id, 4);
+    buf[8] = code;
+    write(buf, HEADER_LEN, value);
+
+    return buf;
+};
+
+/*
+ * Split a byte stream into messages, onMessage(id, code, value) is
+ * called for each one that is complete.
+ */
+function Reader(onMessage) {
+    this.onMessage = onMessage;
+    this.pending = null;
+}
+
+Reader.prototype.push = function (chunk) {
+    var buf = this.pending ? Buffer.concat([this.pending, chunk]) : chunk,
+        pos = 0,
+        len,
+        state;
+
+    while (buf.length - pos >= 4) {
+        len = buf.readUInt32LE(pos);
+
+        if (buf.length - pos - 4 < len) {
+            break;
+        }
+
+        state = {pos: pos + HEADER_LEN};
+        this.onMessage(buf.readUInt32LE(pos + 4), buf[pos + 8], read(buf, state));
+        pos += 4 + len;
+    }
+
+    this.pending = pos < buf.length ? buf.slice(pos) : null;
+};
+
+exports.Reader = Reader;
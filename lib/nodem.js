@@ -11,3 +11,82 @@ try {
         }
     }
 }
+
+/*
+ * Every Gtm method runs on the GT.M worker thread when it is passed
+ * a callback as the last argument. The <method>Async variants wrap
+ * that in a Promise, where the runtime has one.
+ */
+if (module.exports && module.exports.Gtm && typeof Promise === 'function') {
+    [
+        'batch', 'data', 'flush', 'function', 'get', 'getBuffer', 'getNumber',
+        'global_directory', 'increment', 'incrementNumber', 'index', 'kill', 'lock', 'lookup',
+        'merge', 'next', 'next_node', 'order', 'partition', 'previous', 'previous_node', 'query',
+        'rebuildIndex', 'retrieve', 'set', 'setBuffer', 'setNumber', 'unlock', 'update', 'version'
+    ].forEach(function (method) {
+        module.exports.Gtm.prototype[method + 'Async'] = function () {
+            var self = this,
+                args = Array.prototype.slice.call(arguments);
+
+            return new Promise(function (resolve, reject) {
+                args.push(function (error, result) {
+                    if (error) {
+                        reject(error);
+                    } else {
+                        resolve(result);
+                    }
+                });
+
+                self[method].apply(self, args);
+            });
+        };
+    });
+}
+
+/*
+ * A Cursor is its own iterator, so it can be walked with for...of
+ * where the runtime has one.
+ */
+if (module.exports && module.exports.Cursor && typeof Symbol === 'function' && Symbol.iterator) {
+    module.exports.Cursor.prototype[Symbol.iterator] = function () {
+        return this;
+    };
+}
+
+/*
+ * A Pool runs the Gtm methods in child processes, see pool.js.
+ */
+if (module.exports && module.exports.Gtm) {
+    module.exports.Pool = require('./pool');
+}
+
+/*
+ * A subtree goes to a stream of records and back, a chunk at a time,
+ * see stream.js. A Pool can do it as well.
+ */
+if (module.exports && module.exports.Gtm) {
+    var stream = require('./stream');
+
+    [module.exports.Gtm, module.exports.Pool].forEach(function (Class) {
+        Class.prototype.exportStream = function (node, options) {
+            return new stream.ExportStream(this, node, options);
+        };
+
+        Class.prototype.importStream = function (node, options) {
+            return new stream.ImportStream(this, node, options);
+        };
+    });
+}
+
+/*
+ * A subtree is read a range of keys per child process, see scan.js.
+ */
+if (module.exports && module.exports.Gtm) {
+    var scan = require('./scan');
+
+    [module.exports.Gtm, module.exports.Pool].forEach(function (Class) {
+        Class.prototype.parallelScan = function (options, visitor, callback) {
+            scan.parallelScan(this, options, visitor, callback);
+        };
+    });
+}
@@ -0,0 +1,41 @@
+/*
+ * pool-child.js - A child process of a Pool
+ *
+ * Holds one Gtm session and answers the requests that come on fd 3,
+ * one at a time and in order, with the synchronous API. Stdout is left
+ * to GT.M.
+ */
+
+
+var net = require('net');
+var ipc = require('./ipc');
+var gtm = require('./nodem');
+
+var db = new gtm.Gtm();
+var channel = new net.Socket({fd: 3, readable: true, writable: true});
+
+/* the arguments of a call come in an array */
+var reader = new ipc.Reader(function (id, code, args) {
+    var method = ipc.methods[code],
+        result,
+        reply;
+
+    try {
+        result = db[method].apply(db, args);
+        reply = ipc.encode(id, ipc.REPLY_OK, result);
+    } catch (error) {
+        reply = ipc.encode(id, ipc.REPLY_THROWN, {message: error.message});
+    }
+
+    channel.write(reply);
+});
+
+channel.on('data', function (chunk) {
+    reader.push(chunk);
+});
+
+/* the pool went away, so should the session */
+channel.on('end', function () {
+    db.close();
+    process.exit(0);
+});
@@ -0,0 +1,258 @@
+/*
+ * pool.js - Spread GT.M work over several processes
+ *
+ * A GT.M process makes one call-in at a time, so one Node process gets
+ * one core of database work at most. A Pool starts `size' child
+ * processes, each with its own Gtm session, and talks to them over the
+ * binary protocol in ipc.js on a pipe of their own.
+ *
+ *   var pool = new gtm.Pool({size: 4});
+ *
+ *   pool.open(function (error, result) {
+ *       pool.set({global: 'dlw', subscripts: [1], data: 'a'}, function (error, result) {
+ *           ...
+ *       });
+ *   });
+ *
+ * Every Gtm method is there, always with a callback(error, result) as
+ * its last argument, and a <method>Async variant returning a Promise.
+ * A call on a global goes to the child picked by a hash of the global
+ * and its first subscript, so the same part of a global stays with the
+ * same process and its locks are released where they were taken, a
+ * list of nodes to lock goes with its first one. The others go round
+ * the children. open, close, cache, stats, index, writeBehind and flush go
+ * to every child and give an array of the results, as does unlock without
+ * a node.
+ * Transactions and cursors stay with Gtm, they need a single process.
+ * pool.callChild(n, method, args, callback) sends a call to a child of
+ * its choice, as parallelScan does with a range of keys per child.
+ */
+
+
+var childProcess = require('child_process');
+var os = require('os');
+var path = require('path');
+var ipc = require('./ipc');
+
+var codes = {};
+
+ipc.methods.forEach(function (method, code) {
+    codes[method] = code;
+});
+
+/* the calls made to every child */
+var broadcast = {
+    open: true, close: true, cache: true, stats: true, index: true, writeBehind: true, flush: true
+};
+
+/* FNV-1a of a string */
+function hash(h, s) {
+    for (var i = 0; i < s.length; i++) {
+        h ^= s.charCodeAt(i);
+        h = (h + (h << 1) + (h << 4) + (h << 7) + (h << 8) + (h << 24)) >>> 0;
+    }
+
+    return h;
+}
+
+/* the node a call is about, if any */
+function target(method, args) {
+    var node = args[0];
+
+    if (node && method === 'merge') {
+        return node.to;
+    }
+
+    if (node && (method === 'batch' || (method === 'lock' && Array.isArray(node)))) {
+        return node[0];
+    }
+
+    return node;
+}
+
+function Child(pool) {
+    var self = this;
+
+    this.pending = {};
+    this.process = childProcess.spawn(process.execPath, [path.join(__dirname, 'pool-child.js')], {
+        stdio: ['ignore', 'inherit', 'inherit', 'pipe']
+    });
+    this.channel = this.process.stdio[3];
+
+    var reader = new ipc.Reader(function (id, code, value) {
+        var callback = self.pending[id];
+
+        delete self.pending[id];
+
+        if (code === ipc.REPLY_THROWN) {
+            callback(new Error(value.message));
+        } else if (value && typeof value === 'object' && value.ok === 0) {
+            callback(value);
+        } else {
+            callback(null, value);
+        }
+    });
+
+    this.channel.on('data', function (chunk) {
+        reader.push(chunk);
+    });
+
+    this.process.on('exit', function (code, signal) {
+        var pending = self.pending,
+            error = new Error('Pool child process exited with ' + (signal || code));
+
+        self.pending = {};
+        pool.children.splice(pool.children.indexOf(self), 1);
+
+        Object.keys(pending).forEach(function (id) {
+            pending[id](error);
+        });
+    });
+}
+
+Child.prototype.send = function (id, method, args, callback) {
+    this.pending[id] = callback;
+    this.channel.write(ipc.encode(id, codes[method], args));
+};
+
+function Pool(options) {
+    options = options || {};
+
+    this.size = options.size || os.cpus().length;
+    this.children = [];
+    this.id = 0;
+    this.turn = 0;
+}
+
+/* send a call with its arguments in an array to one child, or to all of them */
+Pool.prototype.call = function (method, args, callback) {
+    var children = this.children,
+        node = target(method, args),
+        results = [],
+        left,
+        failed = null,
+        i;
+
+    if (typeof callback !== 'function') {
+        throw new Error('Need to supply a callback');
+    }
+
+    if (children.length === 0) {
+        callback(new Error('Pool is closed'));
+        return;
+    }
+
+    this.id = (this.id + 1) >>> 0;
+
+    if (broadcast[method] || (method === 'unlock' && (!node || node.global === undefined))) {
+        left = children.length;
+
+        children.slice().forEach(function (child, n) {
+            child.send(this.id, method, args, function (error, result) {
+                failed = failed || error;
+                results[n] = error || result;
+
+                if (--left === 0) {
+                    callback(failed, failed ? undefined : results);
+                }
+            });
+        }, this);
+
+        return;
+    }
+
+    if (node && node.global !== undefined) {
+        i = hash(2166136261, String(node.global).replace(/^\^/, ''));
+
+        if (node.subscripts && node.subscripts.length > 0) {
+            i = hash(i, '\u0000' + node.subscripts[0]);
+        }
+
+        i %= children.length;
+    } else {
+        i = this.turn = (this.turn + 1) % children.length;
+    }
+
+    children[i].send(this.id, method, args, callback);
+};
+
+/* send a call to the child `n' of the pool, counted round the children */
+Pool.prototype.callChild = function (n, method, args, callback) {
+    var children = this.children;
+
+    if (children.length === 0) {
+        callback(new Error('Pool is closed'));
+        return;
+    }
+
+    this.id = (this.id + 1) >>> 0;
+    children[n % children.length].send(this.id, method, args, callback);
+};
+
+Pool.prototype.open = function (options, callback) {
+    if (typeof options === 'function') {
+        callback = options;
+        options = undefined;
+    }
+
+    if (this.children.length > 0) {
+        callback(new Error('Pool is opened already'));
+        return;
+    }
+
+    for (var i = 0; i < this.size; i++) {
+        this.children.push(new Child(this));
+    }
+
+    this.call('open', options === undefined ? [] : [options], callback);
+};
+
+Pool.prototype.close = function (callback) {
+    var self = this;
+
+    this.call('close', [], function (error, result) {
+        self.children.slice().forEach(function (child) {
+            child.channel.end();
+        });
+
+        if (callback) {
+            callback(error, result);
+        }
+    });
+};
+
+ipc.methods.forEach(function (method) {
+    if (method === 'open' || method === 'close') {
+        return;
+    }
+
+    Pool.prototype[method] = function () {
+        var args = Array.prototype.slice.call(arguments),
+            callback = args.pop();
+
+        this.call(method, args, callback);
+    };
+});
+
+if (typeof Promise === 'function') {
+    ipc.methods.forEach(function (method) {
+        Pool.prototype[method + 'Async'] = function () {
+            var self = this,
+                args = Array.prototype.slice.call(arguments);
+
+            return new Promise(function (resolve, reject) {
+                args.push(function (error, result) {
+                    if (error) {
+                        reject(error);
+                    } else {
+                        resolve(result);
+                    }
+                });
+
+                self[method].apply(self, args);
+            });
+        };
+    });
+}
+
+module.exports = Pool;
@@ -0,0 +1,184 @@
+/*
+ * scan.js - Read a subtree with a range of keys per child process
+ *
+ *   db.parallelScan({global: 'dlw', partitions: 4}, function (node) {
+ *       ...
+ *   }, function (error, result) {
+ *       ...
+ *   });
+ *
+ * db.partition() splits the keys one level below the node into
+ * `partitions' ranges of as many keys, walking them with $order in M
+ * without reading any data. Every range is then read with db.query()
+ * and its keyRange, `limit' nodes at a time, by a child process of a
+ * Pool of its own. A Gtm starts a Pool of `partitions' children for
+ * the scan, with `open' as their open() options, and closes it after.
+ * A Pool uses its own children.
+ *
+ * visitor(node) is called with every {subscripts, data} under the node,
+ * the subscripts below it. The nodes come in key order, a range after
+ * the other while the next ranges read ahead up to `ahead' chunks each.
+ * With `ordered: false' they come as the chunks do, from any range.
+ * callback(error, {ok, partitions, keys, nodes}) is called at the end.
+ */
+
+
+var os = require('os');
+var Pool = require('./pool');
+
+var LIMIT = 10000;
+var AHEAD = 2;
+
+function scan(db, pool, options, visitor, callback) {
+    var ordered = options.ordered !== false,
+        limit = options.limit || LIMIT,
+        ahead = ordered ? options.ahead || AHEAD : 1,
+        ranges = [],
+        current = 0,
+        nodes = 0,
+        keys = 0,
+        finished = false;
+
+    function finish(error) {
+        if (finished) {
+            return;
+        }
+
+        finished = true;
+        callback(error, error ? undefined : {
+            ok: 1, partitions: ranges.length, keys: keys, nodes: nodes
+        });
+    }
+
+    function visit(range) {
+        var chunk = range.chunks.shift();
+
+        for (var i = 0; i < chunk.length; i++) {
+            nodes++;
+            visitor(chunk[i]);
+        }
+    }
+
+    function read(range) {
+        var args = {
+            global: options.global,
+            subscripts: options.subscripts,
+            match: {keyRange: range.keys},
+            limit: limit
+        };
+
+        if (range.next !== undefined) {
+            args.start = range.next;
+        }
+
+        range.busy = true;
+
+        pool.callChild(range.child, 'query', [args], function (error, result) {
+            range.busy = false;
+
+            if (error) {
+                finish(error);
+                return;
+            }
+
+            range.next = result.next;
+            range.done = result.next === undefined;
+            range.chunks.push(result.results);
+            step();
+        });
+    }
+
+    /* visit what can be, in order if asked, and keep every range reading */
+    function step() {
+        if (finished) {
+            return;
+        }
+
+        try {
+            ranges.forEach(function (range, n) {
+                while (range.chunks.length > 0 && (!ordered || n === current)) {
+                    visit(range);
+                }
+
+                if (n === current && range.done && range.chunks.length === 0) {
+                    current++;
+                }
+            });
+        } catch (error) {
+            finish(error);
+            return;
+        }
+
+        if (current === ranges.length) {
+            finish(null);
+            return;
+        }
+
+        ranges.forEach(function (range) {
+            if (!range.busy && !range.done && range.chunks.length < ahead) {
+                read(range);
+            }
+        });
+    }
+
+    db.partition({
+        global: options.global,
+        subscripts: options.subscripts,
+        partitions: options.partitions || pool.size
+    }, function (error, result) {
+        var bounds;
+
+        if (error) {
+            finish(error);
+            return;
+        }
+
+        keys = result.keys;
+        bounds = [null].concat(result.result, [null]);
+
+        for (var i = 0; i < bounds.length - 1; i++) {
+            ranges.push({
+                child: i,
+                keys: {from: bounds[i], to: bounds[i + 1]},
+                next: undefined,
+                chunks: [],
+                busy: false,
+                done: false
+            });
+        }
+
+        step();
+    });
+}
+
+function parallelScan(db, options, visitor, callback) {
+    var pool;
+
+    if (typeof visitor !== 'function' || typeof callback !== 'function') {
+        throw new Error('Need to supply a visitor and a callback');
+    }
+
+    if (db instanceof Pool) {
+        scan(db, db, options, visitor, callback);
+        return;
+    }
+
+    pool = new Pool({size: options.partitions || os.cpus().length});
+
+    pool.open(options.open, function (error) {
+        if (error) {
+            pool.close(function () {
+                callback(error);
+            });
+            return;
+        }
+
+        scan(db, pool, options, visitor, function (error, result) {
+            pool.close(function () {
+                callback(error, result);
+            });
+        });
+    });
+}
+
+exports.parallelScan = parallelScan;
@@ -0,0 +1,186 @@
+/*
+ * stream.js - Export a subtree to a stream and import it back
+ *
+ *   db.exportStream({global: 'dlw'}).pipe(fs.createWriteStream('dlw.v4w'));
+ *   fs.createReadStream('dlw.v4w').pipe(db.importStream({global: 'copy'}));
+ *
+ * The export walks the subtree a chunk of about 512 KB at a time on the
+ * GT.M worker thread, and only asks for the next one when the reader
+ * has taken the last, so memory stays the same however big the global
+ * is. The stream is a header and then a record per node with data:
+ *
+ *   header   "V4WX" and a version byte, 1
+ *   record   count (uint8), count subscripts and the data
+ *
+ * with each subscript and the data as a uint32 length and the bytes,
+ * little endian. The subscripts are those under the exported node and
+ * the bytes are as GT.M holds them, with no encoding applied, so an
+ * import into another node writes back exactly what was read.
+ *
+ * The import writes the complete records of every chunk written to it
+ * in batches of about `batchSize' bytes, 256 KB unless given, before it
+ * takes the next chunk.
+ */
+
+
+var stream = require('stream');
+var util = require('util');
+
+var MAGIC = new Buffer([0x56, 0x34, 0x57, 0x58, 1]);
+
+function failure(result) {
+    var error = new Error(result.errorMessage || 'GT.M call failed');
+
+    error.result = result;
+    return error;
+}
+
+function ExportStream(db, node, options) {
+    stream.Readable.call(this, options);
+
+    this.db = db;
+    this.node = {global: node.global, subscripts: node.subscripts};
+    this.next = undefined;
+    this.started = false;
+    this.busy = false;
+}
+
+util.inherits(ExportStream, stream.Readable);
+
+ExportStream.prototype._read = function () {
+    var self = this;
+
+    if (this.busy) {
+        return;
+    }
+
+    this.busy = true;
+
+    if (!this.started) {
+        this.started = true;
+        this.push(MAGIC);
+    }
+
+    this.db.exportChunk(this.node, this.next, function (error, result) {
+        self.busy = false;
+
+        if (error) {
+            self.emit('error', error instanceof Error ? error : failure(error));
+            return;
+        }
+
+        self.next = result.next;
+
+        if (result.data.length > 0) {
+            self.push(result.data);
+        }
+
+        if (self.next === undefined) {
+            self.push(null);
+        } else if (result.data.length === 0) {
+            self._read();
+        }
+    });
+};
+
+function ImportStream(db, node, options) {
+    options = options || {};
+    stream.Writable.call(this, options);
+
+    this.db = db;
+    this.node = {global: node.global, subscripts: node.subscripts};
+    this.batchSize = options.batchSize || 256 * 1024;
+    this.pending = null;
+    this.header = false;
+
+    this.on('finish', function () {
+        if (!this.header || (this.pending && this.pending.length > 0)) {
+            this.emit('error', new Error('Import stream ended inside a record'));
+        }
+    });
+}
+
+util.inherits(ImportStream, stream.Writable);
+
+/* the length of the record at pos, or -1 if it is not all there */
+function recordLength(buf, pos) {
+    var start = pos,
+        count,
+        i;
+
+    if (pos >= buf.length) {
+        return -1;
+    }
+
+    count = buf[pos++];
+
+    for (i = 0; i <= count; i++) {
+        if (buf.length - pos < 4) {
+            return -1;
+        }
+
+        pos += 4 + buf.readUInt32LE(pos);
+
+        if (pos > buf.length) {
+            return -1;
+        }
+    }
+
+    return pos - start;
+}
+
+ImportStream.prototype._write = function (chunk, encoding, callback) {
+    var self = this,
+        buf = this.pending ? Buffer.concat([this.pending, chunk]) : chunk,
+        pos = 0;
+
+    if (!this.header) {
+        if (buf.length < MAGIC.length) {
+            this.pending = buf;
+            callback();
+            return;
+        }
+
+        for (var i = 0; i < MAGIC.length; i++) {
+            if (buf[i] !== MAGIC[i]) {
+                callback(new Error('Not an export stream'));
+                return;
+            }
+        }
+
+        this.header = true;
+        pos = MAGIC.length;
+    }
+
+    /* one importChunk per batch of complete records, one after the other */
+    (function next() {
+        var start = pos,
+            len;
+
+        while ((len = recordLength(buf, pos)) >= 0) {
+            pos += len;
+
+            if (pos - start >= self.batchSize) {
+                break;
+            }
+        }
+
+        if (pos === start) {
+            self.pending = pos < buf.length ? buf.slice(pos) : null;
+            callback();
+            return;
+        }
+
+        self.db.importChunk(self.node, buf.slice(start, pos), function (error) {
+            if (error) {
+                callback(error instanceof Error ? error : failure(error));
+                return;
+            }
+
+            next();
+        });
+    })();
+};
+
+exports.ExportStream = ExportStream;
+exports.ImportStream = ImportStream;
@@ -0,0 +1,200 @@
+extern "C" {
+#include <stdlib.h>
+#include <string.h>
+}
+
+#include <uv.h>
+
+#include <list>
+#include <map>
+
+#include "common.h"
+#include "cache.h"
+#include "protocol.h"
+
+struct centry {
+	std::string ret;
+	std::vector<mfield> fields;
+	uint64_t stored;			/* uv_hrtime() when put */
+	std::list<std::string>::iterator lru;
+};
+
+typedef std::map<std::string, centry> cmap;
+
+/* everything below is protected by cache_mutex */
+static uv_mutex_t cache_mutex;
+static cmap cache;
+/* keys, the most recently used first */
+static std::list<std::string> lru;
+static uint64_t ttl_ns;
+static struct mcache_stats stats;
+/* also read without the lock, as a cheap check for a disabled cache */
+static size_t max_entries;
+
+/* a node may come with its numeric subscripts quoted or not,
+ * `5' and `"5"' are the same node to M so they get the same key
+ */
+static void make_key(const std::string &glb, const std::string &subs, std::string &key)
+{
+	size_t pos = 0;
+	char num[32];
+
+	key.assign(glb, !glb.empty() && glb[0] == '^' ? 1 : 0, std::string::npos);
+	key += '\0';
+	while (pos < subs.size()) {
+		char *end;
+		size_t len = strtoul(subs.c_str() + pos, &end, 10);
+		size_t item = end - subs.c_str() + 1;
+
+		if (*end != ':' || len > subs.size() - item) {
+			key.append(subs, pos, std::string::npos);
+			return;
+		}
+		if (len >= 2 && subs[item] == '"' && subs[item + len - 1] == '"' &&
+		    mproto_canonic(subs.data() + item + 1, len - 2)) {
+			snprintf(num, sizeof(num), "%zu:", len - 2);
+			key += num;
+			key.append(subs, item + 1, len - 2);
+		} else {
+			key.append(subs, pos, item + len - pos);
+		}
+		pos = item + len;
+		if (pos < subs.size() && subs[pos] == ',') {
+			key += ',';
+			pos++;
+		}
+	}
+}
+
+static void drop(cmap::iterator it)
+{
+	lru.erase(it->second.lru);
+	cache.erase(it);
+}
+
+static void shrink(void)
+{
+	while (cache.size() > max_entries) {
+		drop(cache.find(lru.back()));
+		stats.evictions++;
+	}
+}
+
+void mcache_init(void)
+{
+	uv_mutex_init(&cache_mutex);
+}
+
+void mcache_configure(size_t entries, uint64_t ttl)
+{
+	uv_mutex_lock(&cache_mutex);
+	max_entries = entries;
+	ttl_ns = ttl * 1000000;
+	shrink();
+	uv_mutex_unlock(&cache_mutex);
+}
+
+int mcache_enabled(void)
+{
+	return max_entries > 0;
+}
+
+int mcache_get(const std::string &glb, const std::string &subs,
+	       std::string &ret, std::vector<mfield> &fields)
+{
+	std::string key;
+	cmap::iterator it;
+	int found = FALSE;
+
+	make_key(glb, subs, key);
+	uv_mutex_lock(&cache_mutex);
+	it = cache.find(key);
+	if (it != cache.end() && ttl_ns > 0 && uv_hrtime() - it->second.stored > ttl_ns) {
+		drop(it);
+		stats.evictions++;
+		it = cache.end();
+	}
+	if (it != cache.end()) {
+		ret = it->second.ret;
+		fields = it->second.fields;
+		lru.splice(lru.begin(), lru, it->second.lru);
+		stats.hits++;
+		found = TRUE;
+	} else {
+		stats.misses++;
+	}
+	uv_mutex_unlock(&cache_mutex);
+	return found;
+}
+
+void mcache_put(const std::string &glb, const std::string &subs,
+		const std::string &ret, const std::vector<mfield> &fields)
+{
+	std::string key;
+	cmap::iterator it;
+
+	make_key(glb, subs, key);
+	uv_mutex_lock(&cache_mutex);
+	if (max_entries == 0) {
+		uv_mutex_unlock(&cache_mutex);
+		return;
+	}
+	it = cache.find(key);
+	if (it == cache.end()) {
+		lru.push_front(key);
+		it = cache.insert(std::make_pair(key, centry())).first;
+		it->second.lru = lru.begin();
+	} else {
+		lru.splice(lru.begin(), lru, it->second.lru);
+	}
+	it->second.ret = ret;
+	it->second.fields = fields;
+	it->second.stored = uv_hrtime();
+	shrink();
+	uv_mutex_unlock(&cache_mutex);
+}
+
+void mcache_invalidate(const std::string &glb, const std::string &subs, int subtree)
+{
+	std::string key;
+	cmap::iterator it;
+
+	make_key(glb, subs, key);
+	uv_mutex_lock(&cache_mutex);
+	it = cache.find(key);
+	if (it != cache.end()) {
+		drop(it);
+		stats.invalidations++;
+	}
+	if (subtree) {
+		/* descendants sort right after the node, their keys go on with
+		 * a comma, or anything at all below a whole global
+		 */
+		if (!subs.empty())
+			key += ',';
+		it = cache.lower_bound(key);
+		while (it != cache.end() && it->first.compare(0, key.size(), key) == 0) {
+			drop(it++);
+			stats.invalidations++;
+		}
+	}
+	uv_mutex_unlock(&cache_mutex);
+}
+
+void mcache_clear(void)
+{
+	uv_mutex_lock(&cache_mutex);
+	cache.clear();
+	lru.clear();
+	uv_mutex_unlock(&cache_mutex);
+}
+
+void mcache_get_stats(struct mcache_stats *st, int reset)
+{
+	uv_mutex_lock(&cache_mutex);
+	stats.entries = cache.size();
+	*st = stats;
+	if (reset)
+		memset(&stats, 0, sizeof(stats));
+	uv_mutex_unlock(&cache_mutex);
+}
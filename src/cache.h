@@ -0,0 +1,38 @@
+#ifndef CACHE_H_
+#define CACHE_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "protocol.h"
+
+/* a read-through cache of get results, keyed by global and encoded
+ * subscripts, kept for the whole process since every Gtm object shares
+ * the one gtm runtime. writes made through this process drop the nodes
+ * they touch, writes by other processes are only bounded by the ttl.
+ * all functions are safe to call from any thread
+ */
+
+struct mcache_stats {
+	double hits;
+	double misses;
+	double invalidations;	/* entries dropped by writes */
+	double evictions;	/* entries dropped for room or age */
+	double entries;
+};
+
+void mcache_init(void);
+/* entries == 0 turns the cache off, ttl is in milliseconds, 0 never expires */
+void mcache_configure(size_t entries, uint64_t ttl);
+int mcache_enabled(void);
+int mcache_get(const std::string &glb, const std::string &subs,
+	       std::string &ret, std::vector<mfield> &fields);
+void mcache_put(const std::string &glb, const std::string &subs,
+		const std::string &ret, const std::vector<mfield> &fields);
+/* drop the node, and all of its descendants if `subtree' */
+void mcache_invalidate(const std::string &glb, const std::string &subs, int subtree);
+void mcache_clear(void);
+void mcache_get_stats(struct mcache_stats *stats, int reset);
+
+#endif /* CACHE_H_ */
@@ -8,8 +8,13 @@
 #define TRUE (!FALSE)
 #endif
 #define BUF_LEN (4*1024) 
+/* room for the result of one call-in, bigger results come in pieces */
+#define RET_LEN (64*1024)
 /* gtm related limits */
 #define BUF_LEN_MAX (1*1024*1024)
 #define SUBSCRIPT_LEN_MAX (32767)
+#define SUBSCRIPTS_MAX (31)
+/* about how much of a subtree is moved by one call-in */
+#define CHUNK_LEN (BUF_LEN_MAX/2)
 
 #endif
@@ -3,9 +3,13 @@ extern "C" {
 #endif
 
 #include <string.h>
+#include <stdint.h>
 #include <assert.h>
 #include <iconv.h>
 #include <errno.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #ifdef __cplusplus
 }
@@ -63,3 +67,36 @@ int iconvm_close(iconv_t cd)
 {
 	return iconv_close(cd);
 }
+
+/* bring a cached descriptor back to its initial shift state */
+void iconvm_reset(iconv_t cd)
+{
+	(void)iconv(cd, NULL, NULL, NULL, NULL);
+}
+
+/* tell if all bytes are 7 bit, 16 bytes a step with sse2
+ * and a word at a time without it
+ */
+int iconvm_is_ascii(const char *in, size_t len)
+{
+	size_t i = 0;
+
+#ifdef __SSE2__
+	for (; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+		if (_mm_movemask_epi8(v))
+			return 0;
+	}
+#endif
+	for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+		uint64_t w;
+		memcpy(&w, in + i, sizeof(w));
+		if (w & 0x8080808080808080ULL)
+			return 0;
+	}
+	for (; i < len; i++) {
+		if ((unsigned char)in[i] & 0x80)
+			return 0;
+	}
+	return 1;
+}
@@ -10,6 +10,8 @@ extern "C" {
 iconv_t iconvm_open(char *to, char *from);
 size_t iconvm(iconv_t cd, char *in, size_t inlen, char *out, size_t outlen);
 int iconvm_close(iconv_t cd);
+void iconvm_reset(iconv_t cd);
+int iconvm_is_ascii(const char *in, size_t len);
 
 #ifdef __cplusplus
 }
@@ -1,7 +1,8 @@
-extern "C" {	
+extern "C" {
 #include <sys/types.h>
-	
-#include <stdlib.h>	
+
+#include <math.h>
+#include <stdlib.h>
 #include <string.h>
 #include <termios.h>
 #include <unistd.h>
@@ -9,22 +10,33 @@ extern "C" {
 #include <signal.h>
 #include <assert.h>
 
-#include <iconv.h>        
+#include <iconv.h>
 #include <gtmxc_types.h>
 }
 
+#include <map>
+#include <string>
+#include <vector>
+
+#include <node_buffer.h>
+
 #include "common.h"
 #include "mumps.h"
+#include "cache.h"
 #include "iconvm.h"
+#include "protocol.h"
+#include "stats.h"
+#include "worker.h"
 
 using namespace v8;
 using namespace node;
 
 int gtm_is_open;
 
-static gtm_char_t retbuf[BUF_LEN_MAX];
-static gtm_char_t databuf[BUF_LEN_MAX];
-static gtm_char_t retconv[4*BUF_LEN_MAX];
+/* the buffers below are shared by every call-in,
+ * use them only while holding gtm_lock()
+ */
+static gtm_char_t retbuf[RET_LEN];
 static gtm_char_t errbuf[BUF_LEN];
 
 static struct termios tp;
@@ -35,6 +47,24 @@ static struct termios tp;
 static gtm_int_t mode = MODE_CANONICAL;
 static gtm_int_t auto_relink = 0;
 
+/* the arguments a prepared routine takes, as in call^v4wNode */
+#define CALL_ARGS_MAX	8
+
+/* size of the read cache when turned on without one */
+#define CACHE_ENTRIES	1000
+
+/* global nodes rebuildIndex walks per call-in */
+#define REBUILD_NODES	10000
+
+/* conversion to and from XNODEM_ENCODING, set up once by open(),
+ * use them only while holding gtm_lock()
+ */
+static iconv_t utf8_to_mumps = (iconv_t)(-1);
+static iconv_t mumps_to_utf8 = (iconv_t)(-1);
+static bool encoding_ascii;	/* ascii text is the same bytes in the encoding */
+
+#define encoding_is_set() (utf8_to_mumps != (iconv_t)(-1))
+
 #define setOk(obj, flag) \
 	(obj)->Set(String::New("ok"), Number::New(flag))
 
@@ -43,28 +73,128 @@ static gtm_int_t auto_relink = 0;
 
 #define setErrorMessage(obj, errmsg) \
 	(obj)->Set(String::New("errorMessage"), String::New(errmsg))
-	
+
 #define setResult(obj, result) \
 	(obj)->Set(String::New("result"), result)
 
 enum class M {
+	M_BATCH,
+	M_CALL,
 	M_DATA,
+	M_EXPORT,
 	M_FUNCTION,
 	M_GET,
+	M_GET_BUFFER,
+	M_GET_NUMBER,
 	M_GLOBAL_DIRECTORY,
+	M_IMPORT,
 	M_INCREMENT,
+	M_INCREMENT_NUMBER,
+	M_INDEX,
 	M_KILL,
 	M_LOCK,
+	M_LOCK_LIST,
+	M_LOOKUP,
 	M_MERGE,
 	M_NEXT_NODE,
 	M_ORDER,
+	M_ORDER_PAGE,
+	M_PARTITION,
 	M_PREVIOUS,
 	M_PREVIOUS_NODE,
+	M_QUERY,
+	M_REBUILD_INDEX,
 	M_RETRIEVE,
 	M_SET,
+	M_SET_BUFFER,
+	M_SET_NUMBER,
+	M_TCOMMIT,
 	M_UNLOCK,
 	M_UPDATE,
-	M_VERSION
+	M_VERSION,
+	/* used by the addon itself */
+	M_MORE,
+	M_RESULT_SIZE,
+	M_COUNT		/* keep last */
+};
+
+/* state of a request after gtm_exec() */
+enum req_state {
+	REQ_OK,
+	REQ_CLOSED,	/* gtm is not opened */
+	REQ_GTM_ERROR,	/* call-in failed, err_code and err_msg are set */
+	REQ_ERROR,	/* local failure, err_msg is set */
+	REQ_RESTART,	/* a transaction read a node that changed, err_msg is set */
+	REQ_EXCEPTION	/* bad arguments, err_msg is thrown */
+};
+
+/* one operation of a batch */
+struct batch_op {
+	std::string op;
+	std::string glb;
+	std::vector<std::string> subs;
+	std::string m_subs;	/* a batch encodes its subscripts right away */
+	std::string data;
+	bool data_is_string;
+};
+
+/* a call into gtm: arguments are copied out of v8 on the main thread
+ * so that the call-in itself can run on the gtm worker thread
+ */
+struct gtm_req {
+	struct gtm_work work;	/* must be the first member */
+	M function;
+	/* input */
+	std::string glb;
+	std::vector<std::string> subs;	/* cursor only, others encode into m_subs */
+	std::string m_subs;
+	bool has_subs;
+	std::string from_glb;	/* merge: the source, index: the node its entries go under */
+	std::string m_from_subs;
+	std::string data;
+	bool data_is_string;
+	gtm_double_t number;	/* and the result of getNumber and incrementNumber */
+	gtm_int_t direction;	/* 1 or -1 */
+	bool values;		/* return the data along with the keys */
+	std::string func;
+	std::vector<std::string> func_args;
+	/* a prepared call: one of s(tring), n(umber) or b(uffer) per argument */
+	std::string arg_types;
+	gtm_string_t call_args[CALL_ARGS_MAX];
+	gtm_uint_t max;
+	std::string lo;
+	std::string hi;
+	std::vector<batch_op> ops;
+	bool transaction;
+	bool held;		/* answered by write-behind, not by gtm */
+	std::string start;	/* exportChunk, query and lookup: the node to carry on after */
+	/* query: subscript prefix and pattern, value prefix and pattern, lowest and highest value,
+	 * index: a subscript per entry, = and the subscript or empty for any
+	 */
+	std::vector<std::string> match;
+	std::string index;	/* index, lookup and rebuildIndex: the name of the index */
+	/* bytes of a Buffer, passed to gtm as they are */
+	char *buf;
+	size_t buf_len;
+	size_t buf_size;	/* allocated, getBuffer only */
+	/* stats, filled only when stats_enabled */
+	uint64_t t_marshal;
+	uint64_t t_call_in;
+	uint64_t t_decode;
+	size_t bytes_in;
+	/* output */
+	req_state state;
+	int err_code;
+	std::string err_msg;
+	std::string ret;
+	std::vector<mfield> fields;
+	gtm_int_t defined;	/* getNumber only */
+	/* javascript values the result refers to */
+	Persistent<Value> js_subs;
+	Persistent<Value> js_func_args;
+	Persistent<Value> js_ops;
+	Persistent<Value> js_buf;
+	Persistent<Function> callback;
 };
 
 static void gtm_error_parse(gtm_char_t *err_str, int *err_code, gtm_char_t **err_msg)
@@ -75,19 +205,306 @@ static void gtm_error_parse(gtm_char_t *err_str, int *err_code, gtm_char_t **err
 	*err_code = atoi(code);
 }
 
+/* GT.M does not let a call-in return with a transaction open, so the
+ * writes of a transaction are held here and made by one tcommit call-in,
+ * along with checks that the nodes it read are still the same.
+ * only get, set, kill, increment and their number calls are held,
+ * the calls that write some other way throw inside a transaction, and
+ * the other reads (data, order, query, retrieve and the like) go to the
+ * database as it is, without the held writes and without a check.
+ * only touched on the main thread
+ */
+#define TP_RETRIES	4
+
+static struct {
+	int level;			/* of nested tstart() */
+	std::vector<batch_op> ops;	/* writes and checks of reads, in order */
+} txn;
+
+/* per call stats, the flag is set on the main thread and
+ * op_stats is only touched there, when requests are finished
+ */
+static bool stats_enabled;
+static struct mstats_op op_stats[(int)M::M_COUNT];
+static struct mstats_lock lock_stats;
+
+static char* to_string(M type)
+{
+	switch (type) {
+	case M::M_BATCH:
+		return "batch";
+	case M::M_CALL:
+		return "call";
+	case M::M_DATA:
+		return "data";
+	case M::M_EXPORT:
+		return "export";
+	case M::M_FUNCTION:
+		return "function";
+	case M::M_GET:
+		return "get";
+	case M::M_GET_BUFFER:
+		return "get_buffer";
+	case M::M_GET_NUMBER:
+		return "get_number";
+	case M::M_GLOBAL_DIRECTORY:
+		return "global_directory";
+	case M::M_IMPORT:
+		return "import";
+	case M::M_INCREMENT:
+		return "increment";
+	case M::M_INCREMENT_NUMBER:
+		return "increment_number";
+	case M::M_INDEX:
+		return "index";
+	case M::M_KILL:
+		return "kill";
+	case M::M_LOCK:
+		return "lock";
+	case M::M_LOCK_LIST:
+		return "lock_list";
+	case M::M_LOOKUP:
+		return "lookup";
+	case M::M_MERGE:
+		return "merge";
+	case M::M_NEXT_NODE:
+		return "next_node";
+	case M::M_ORDER:
+		return "order";
+	case M::M_ORDER_PAGE:
+		return "order_page";
+	case M::M_PARTITION:
+		return "partition";
+	case M::M_PREVIOUS:
+		return "previous";
+	case M::M_PREVIOUS_NODE:
+		return "previous_node";
+	case M::M_QUERY:
+		return "query";
+	case M::M_REBUILD_INDEX:
+		return "rebuild_index";
+	case M::M_RETRIEVE:
+		return "retrieve";
+	case M::M_SET:
+		return "set";
+	case M::M_SET_BUFFER:
+		return "set_buffer";
+	case M::M_SET_NUMBER:
+		return "set_number";
+	case M::M_TCOMMIT:
+		return "tcommit";
+	case M::M_UNLOCK:
+		return "unlock";
+	case M::M_UPDATE:
+		return "update";
+	case M::M_VERSION:
+		return "version";
+	case M::M_MORE:
+		return "more";
+	case M::M_RESULT_SIZE:
+		return "result_size";
+	default:
+		assert(FALSE);
+	}
+	return NULL;
+}
+
+/* call-in descriptors, gtm resolves the routine on the first call
+ * and keeps the handle here, so later calls skip the name lookup.
+ * use them only while holding gtm_lock()
+ */
+static ci_name_descriptor calls[(int)M::M_COUNT];
+
+static ci_name_descriptor *mumps_call(M function)
+{
+	ci_name_descriptor *call = &calls[(int)function];
+
+	if (call->rtn_name.address == NULL) {
+		call->rtn_name.address = to_string(function);
+		call->rtn_name.length  = strlen(call->rtn_name.address);
+		call->handle = NULL;
+	}
+	return call;
+}
+
+/* the handles do not survive gtm_exit() */
+static void reset_mumps_calls(void)
+{
+	for (int i = 0; i < (int)M::M_COUNT; i++)
+		calls[i].handle = NULL;
+}
+
+static void encoding_close(void)
+{
+	if (utf8_to_mumps != (iconv_t)(-1))
+		iconvm_close(utf8_to_mumps);
+	if (mumps_to_utf8 != (iconv_t)(-1))
+		iconvm_close(mumps_to_utf8);
+	utf8_to_mumps = mumps_to_utf8 = (iconv_t)(-1);
+	encoding_ascii = false;
+}
+
+/* open the descriptors for `encoding', returns an error message on failure */
+static const char *encoding_open(const char *encoding)
+{
+	char ascii[128], conv[2*sizeof(ascii)];
+	size_t len;
+
+	encoding_close();
+	utf8_to_mumps = iconvm_open((char *)encoding, "utf8");
+	if (utf8_to_mumps == (iconv_t)(-1))
+		return strerror(errno);
+	mumps_to_utf8 = iconvm_open("utf8", (char *)encoding);
+	if (mumps_to_utf8 == (iconv_t)(-1)) {
+		encoding_close();
+		return strerror(errno);
+	}
+	/* most encodings keep ascii as it is, check once if this one does */
+	for (size_t i = 1; i < sizeof(ascii); i++)
+		ascii[i - 1] = (char)i;
+	len = iconvm(utf8_to_mumps, ascii, sizeof(ascii) - 1, conv, sizeof(conv));
+	encoding_ascii = len == sizeof(ascii) - 1 && memcmp(ascii, conv, len) == 0;
+	return NULL;
+}
+
+/* convert between utf8 and the encoding with a cached descriptor,
+ * ascii text is copied as it is when the encoding allows it
+ */
+static size_t encoding_convert(iconv_t cd, const char *in, size_t len, char *out, size_t outlen)
+{
+	if (encoding_ascii && iconvm_is_ascii(in, len)) {
+		if (len > outlen - 1)
+			len = outlen - 1;
+		memcpy(out, in, len);
+		out[len] = '\0';
+		return len;
+	}
+	/* drop whatever state an earlier failed conversion left */
+	iconvm_reset(cd);
+	return iconvm(cd, (char *)in, len, out, outlen);
+}
+
+/* convert and append to `out', which grows to take the result */
+static void encoding_append(iconv_t cd, const char *in, size_t len, std::string &out)
+{
+	size_t base = out.size();
+
+	/* no character takes more than four bytes in any encoding used */
+	out.resize(base + 4 * len + 1);
+	len = encoding_convert(cd, in, len, &out[base], 4 * len + 1);
+	out.resize(base + len);
+}
+
+/* convert a string argument to the encoding in place, `tmp' gives the room */
+static void encoding_to_mumps(std::string &str, std::string &tmp)
+{
+	if (!encoding_is_set() || str.empty())
+		return;
+	tmp.clear();
+	encoding_append(utf8_to_mumps, str.data(), str.size(), tmp);
+	str.swap(tmp);
+}
+
+/* {entries, ttl} turn the read cache on, entries: 0 turns it off */
+static void cache_configure(Local<Object> opts)
+{
+	Local<Value> entries = opts->Get(String::New("entries"));
+	Local<Value> ttl = opts->Get(String::New("ttl"));
+
+	mcache_configure(entries->IsUndefined() ? CACHE_ENTRIES : entries->Uint32Value(),
+			 ttl->IsUndefined() ? 0 : (uint64_t)ttl->NumberValue());
+}
+
+/* with write-behind on, set, kill and increment are held here and made
+ * later by batch call-ins, the writes to a node are folded into one and
+ * a kill drops what was held below it, see wb_hold().
+ * only touched on the main thread
+ */
+#define WB_ENTRIES	1000	/* nodes held before a flush */
+#define WB_INTERVAL	100	/* milliseconds a write is held at most */
+
+struct wb_write {
+	std::string glb;
+	std::string m_subs;
+	bool set;		/* data is set before the increment is added */
+	std::string data;
+	bool data_is_string;
+	double increment;
+};
+
+static struct {
+	size_t entries;		/* 0 when write-behind is off */
+	uint64_t interval;
+	/* by node, see wb_key() */
+	std::map<std::string, wb_write> writes;
+	std::map<std::string, wb_write> kills;
+	uv_timer_t timer;	/* flushes after interval */
+	bool timing;
+	uv_timer_t defer;	/* calls back the writes that were held */
+	bool deferring;
+	std::vector<gtm_req *> replies;
+	unsigned int inflight;	/* flushes on the worker thread */
+	/* stats */
+	uint64_t held;
+	uint64_t coalesced;	/* held writes that did not need an operation of their own */
+	uint64_t flushes;
+	uint64_t ops;
+	uint64_t errors;
+	std::string error;	/* the last failure, till flush() tells it */
+} wb;
+
+/* {entries, interval} turn write-behind on, entries: 0 turns it off */
+static void wb_configure(Local<Object> opts)
+{
+	Local<Value> entries = opts->Get(String::New("entries"));
+	Local<Value> interval = opts->Get(String::New("interval"));
+
+	wb.entries = entries->IsUndefined() ? WB_ENTRIES : entries->Uint32Value();
+	wb.interval = interval->IsUndefined() ? WB_INTERVAL : (uint64_t)interval->NumberValue();
+}
+
+/* close() makes the held writes before gtm goes, it is defined with the rest */
+static void wb_settle(bool async);
+
 Handle<Value> Gtm::open(const Arguments &args)
 {
 	HandleScope scope;
 	Local<Object> res = Object::New();
 	gtm_status_t err;
 	char *arelink;
+	std::string encoding;
+	const char *enc_err = NULL;
 
 	if (gtm_is_open) {
 		setOk(res, 0);
 		setErrorMessage(res, "gtm is opened already");
-		return scope.Close(res);	
+		return scope.Close(res);
+	}
+	mcache_clear();
+	/* open({encoding: ...}) takes over XNODEM_ENCODING */
+	if (args.Length() > 0 && args[0]->IsObject()) {
+		Local<Value> enc = args[0]->ToObject()->Get(String::New("encoding"));
+		Local<Value> cache = args[0]->ToObject()->Get(String::New("cache"));
+		Local<Value> write_behind = args[0]->ToObject()->Get(String::New("writeBehind"));
+		if (!enc->IsUndefined())
+			encoding = *String::AsciiValue(enc);
+		if (cache->IsObject())
+			cache_configure(cache->ToObject());
+		if (write_behind->IsObject())
+			wb_configure(write_behind->ToObject());
+		if (args[0]->ToObject()->Get(String::New("stats"))->BooleanValue())
+			stats_enabled = true;
+	}
+	if (encoding.empty() && getenv("XNODEM_ENCODING") != NULL)
+		encoding = getenv("XNODEM_ENCODING");
+	(void)tcgetattr(STDIN_FILENO, &tp);
+	gtm_lock();
+	if (!encoding.empty() && (enc_err = encoding_open(encoding.c_str())) != NULL) {
+		gtm_unlock();
+		setOk(res, 0);
+		setErrorMessage(res, enc_err);
+		return scope.Close(res);
 	}
-	(void)tcgetattr(STDIN_FILENO, &tp); 
 	/* init gtm runtime */
 	err = gtm_init();
 	if (err) {
@@ -95,14 +512,33 @@ Handle<Value> Gtm::open(const Arguments &args)
 		int err_code;
 		/* read error message from gtm */
   		gtm_zstatus(errbuf, sizeof(errbuf));
+		encoding_close();
+		gtm_unlock();
 		gtm_error_parse(errbuf, &err_code, &err_msg);
 		setOk(res, 0);
 		setErrorCode(res, err_code);
 		setErrorMessage(res, err_msg);
         	return scope.Close(res);
 	}
+	/* tell v4wNode.m how much of a result fits in retbuf */
+	err = gtm_cip(mumps_call(M::M_RESULT_SIZE), (gtm_uint_t)(sizeof(retbuf) - 1));
+	if (err) {
+		gtm_char_t *err_msg;
+		int err_code;
+		gtm_zstatus(errbuf, sizeof(errbuf));
+		(void)gtm_exit();
+		reset_mumps_calls();
+		encoding_close();
+		gtm_unlock();
+		gtm_error_parse(errbuf, &err_code, &err_msg);
+		setOk(res, 0);
+		setErrorCode(res, err_code);
+		setErrorMessage(res, err_msg);
+		return scope.Close(res);
+	}
+	gtm_unlock();
 	if ((arelink = getenv("XNODEM_AUTO_RELINK")) != NULL) {
-		auto_relink = atoi(arelink);	
+		auto_relink = atoi(arelink);
 	}
 	/* success */
 	gtm_is_open = TRUE;
@@ -122,18 +558,34 @@ Handle<Value> Gtm::close(const Arguments &args)
 		setErrorMessage(res, "gtm is closed already");
 		return scope.Close(res);
 	}
+	/* make the held writes and let the queued asynchronous calls finish first */
+	wb_settle(false);
+	if (wb.timing) {
+		uv_timer_stop(&wb.timer);
+		wb.timing = false;
+	}
+	gtm_worker_stop();
+	/* an open transaction is rolled back */
+	txn.level = 0;
+	txn.ops.clear();
+	gtm_lock();
  	err = gtm_exit();
-	if (err) { 
+	reset_mumps_calls();
+	if (err) {
 		gtm_char_t *err_msg;
 		int err_code;
 		/* read error message from gtm */
   		gtm_zstatus(errbuf, sizeof(errbuf));
+		gtm_unlock();
 		gtm_error_parse(errbuf, &err_code, &err_msg);
 		setOk(res, 0);
 		setErrorCode(res, err_code);
 		setErrorMessage(res, err_msg);
         	return scope.Close(res);
 	}
+	encoding_close();
+	gtm_unlock();
+	mcache_clear();
 	(void)tcsetattr(STDIN_FILENO, TCSANOW, &tp);
 	/* successfuly closed */
 	gtm_is_open = FALSE;
@@ -142,699 +594,2878 @@ Handle<Value> Gtm::close(const Arguments &args)
         return scope.Close(res);
 }
 
-Handle<Value> Gtm::version(const Arguments &args)
+/* copy javascript array items as utf8 strings */
+static void js2native_array(Local<Value> &js_value, std::vector<std::string> &native)
 {
 	HandleScope scope;
-	Local<Object> res = Object::New();
-	ci_name_descriptor call;
-	gtm_status_t err;
+	Local<Array> js_array = Local<Array>::Cast(js_value);
 
-	if (!gtm_is_open)
-        	return scope.Close(String::New("Node.js Adaptor for GT.M"));
-
-	call.rtn_name.address = "version";
-	call.rtn_name.length = strlen(call.rtn_name.address);
-	call.handle = NULL;
+	native.reserve(js_array->Length());
+	for (unsigned int i = 0; i < js_array->Length(); i++) {
+		String::Utf8Value item(js_array->Get(i));
+		native.push_back(std::string(*item, item.length()));
+	}
+}
 
-	err = gtm_cip(&call, retbuf, NULL);
-	if (err) { 
-		gtm_char_t *err_msg;
-		int err_code;
-		/* read error message from gtm */
-  		gtm_zstatus(errbuf, sizeof(errbuf));
-		gtm_error_parse(errbuf, &err_code, &err_msg);
-		setOk(res, 0);
-		setErrorCode(res, err_code);
-		setErrorMessage(res, err_msg);
-        	return scope.Close(res);
+/* append a string as a field `len:"literal"' of M code, the common
+ * string with no quote or control character goes in as it is
+ */
+static void append_literal(std::string &out, const char *s, size_t n)
+{
+	std::string literal;
+	char num[32];
+
+	if (mproto_plain(s, n) == n) {
+		/* add space for quotation marks */
+		snprintf(num, sizeof(num), "%zu:\"", n + 2);
+		out += num;
+		out.append(s, n);
+		out += '"';
+		return;
 	}
-	return scope.Close(String::New(retbuf));
+	mproto_quote(s, n, literal);
+	snprintf(num, sizeof(num), "%zu:", literal.size());
+	out += num;
+	out += literal;
 }
 
-/* parse json string to object with JSON.parse()*/
-static Handle<Value> JSON_parse(Local<Value> json)
+/* this function makes a string of form 'len1:"sub1",...,lenN:"subN"'
+ * from the subscripts, returns FALSE if a subscript is too big
+ */
+static int subs2mumps_string(const std::vector<std::string> &subs, std::string &out)
 {
-	HandleScope scope;
-	/* organize global execution sandbox */
-	Local<Context> context = Context::GetCurrent();
-	Local<Object> global = context->Global();
-	/* we will need JSON.parse() function
-	 * so firstly we get `JSON' object
-	 */
-    	Local<Object> JSON = global->Get(String::New("JSON"))->ToObject();
-	/* then we get `parse' method from the object */
-    	Local<Function> JSONparse = Local<Function>::Cast(JSON->Get(String::New("parse")));
-	/* and finally call JSON.parse with `json' */
-    	return scope.Close(JSONparse->Call(JSON, 1, &json));
+	out.clear();
+	for (size_t i = 0; i < subs.size(); i++) {
+		if (subs[i].size() > SUBSCRIPT_LEN_MAX)
+			return FALSE;
+		if (i > 0)
+			out += ',';
+		append_literal(out, subs[i].data(), subs[i].size());
+	}
+	return TRUE;
 }
 
-static void subs2mumps_array(Local<Array> &js_array, Local<Array> &mumps_array)
+/* append one javascript subscript to `out', strings are written by v8
+ * straight into it and numbers are formatted in place, so no v8 strings
+ * are made for them, returns FALSE if the subscript is too big
+ */
+static int js2mumps_sub(Local<Value> item, std::string &out)
 {
-        HandleScope scope;
-	gtm_char_t buf[1024];
-	 
-        for (unsigned int i = 0; i < js_array->Length(); i++) { 
-                Local<String> item = Local<String>::Cast(js_array->Get(i)->ToString()); 
-                size_t len = item->Length(); 
-                if (len > SUBSCRIPT_LEN_MAX) 
-                        ThrowException(Exception::Error(String::New("subscript is too big"))); 
-		/* add space for quotation marks */ 
-		sprintf(buf, "%zu:", len + 2); 
-		Local<String> s = String::Concat(String::New("\""), String::Concat(item, String::New("\""))); 
-		Local<String> tmp = String::Concat(String::New(buf), s); 
-		mumps_array->Set(i, tmp); 
-        }       
+	char num[64];
+	int len;
+
+	if (!out.empty())
+		out += ',';
+	/* canonic numbers go unquoted, so 0.5 is the same node as .5 in M */
+	if (mode != MODE_STRICT && item->IsNumber()) {
+		double n = item->NumberValue();
+		char *p = num;
+
+		if (n > -1e15 && n < 1e15 && n == (double)(int64_t)n) {
+			len = snprintf(num, sizeof(num) / 2, "%lld", (long long)n);
+		} else {
+			len = item->ToString()->WriteUtf8(num, sizeof(num) / 2 - 1, NULL, String::NO_NULL_TERMINATION);
+			num[len] = '\0';
+			/* NaN, Infinity and exponents are not numbers to M */
+			if (strspn(num, "-.0123456789") != (size_t)len)
+				goto string;
+			if (num[0] == '0' && num[1] == '.') {
+				p++;
+				len--;
+			} else if (num[0] == '-' && num[1] == '0' && num[2] == '.') {
+				num[1] = '-';
+				p++;
+				len--;
+			}
+		}
+		snprintf(num + sizeof(num) / 2, sizeof(num) / 2, "%d:", len);
+		out += num + sizeof(num) / 2;
+		out.append(p, len);
+		return TRUE;
+	}
+string:
+	Local<String> str = item->ToString();
+	len = str->Utf8Length();
+	if (len > SUBSCRIPT_LEN_MAX)
+		return FALSE;
+	/* add space for quotation marks */
+	snprintf(num, sizeof(num), "%d:\"", len + 2);
+	size_t start = out.size();
+	out += num;
+	size_t pos = out.size();
+	out.resize(pos + len);
+	if (len > 0)
+		str->WriteUtf8(&out[pos], len, NULL, String::NO_NULL_TERMINATION);
+	/* one with quotes or control characters is made again with escapes */
+	if (mproto_plain(out.data() + pos, len) != (size_t)len) {
+		std::string raw(out, pos, len);
+
+		out.resize(start);
+		append_literal(out, raw.data(), raw.size());
+		return TRUE;
+	}
+	out += '"';
+	return TRUE;
 }
 
-#define js2mumps_array(js_arr, m_arr) subs2mumps_array(js_arr, m_arr)
+/* encode a javascript array of subscripts into `out', it is
+ * cleared first but keeps its room from the last request
+ */
+static int js2mumps_subs(Local<Value> subs, std::string &out)
+{
+	HandleScope scope;
+	Local<Array> arr = Local<Array>::Cast(subs);
+
+	out.clear();
+	for (uint32_t i = 0; i < arr->Length(); i++) {
+		if (!js2mumps_sub(arr->Get(i), out))
+			return FALSE;
+	}
+	return TRUE;
+}
 
 /* this function makes a string of form 'len1:"arg1",...,"lenN:"argN"
- * from array of argumts and put the result into global buffer `databuf`
+ * from array of argumts
  */
-static Handle<Value> args2mumps_string(Local<Array> &js_array)
+static int args2mumps_string(gtm_req *req, std::string &out)
 {
-	HandleScope scope;
-	gtm_char_t num[1024];
-	size_t len = 0, n = 0, written_len = 0;
-	char *encoding;
-	Local<Object> err_obj = Object::New();
-	
-	for (unsigned int i = 0; i < js_array->Length(); i++) {
-		Local<String> str = Local<String>::Cast(js_array->Get(i)->ToString());
-		if ((encoding = getenv("XNODEM_ENCODING")) != NULL) {	
-				iconv_t cd = iconvm_open(encoding, "utf8");
-				if (cd == (iconv_t)(-1)) {
-					setOk(err_obj, 0);
-					setErrorMessage(err_obj, strerror(errno));
-					return scope.Close(err_obj);
-				}	
-                               	/* left space for quotes and null byte */
-                               	len = iconvm(cd, *String::Utf8Value(str), str->Utf8Length(), retbuf, sizeof(retbuf) - 3);
-                               	if (iconvm_close(cd) < 0) {
-                              		setOk(err_obj, 0);
-                               	        setErrorMessage(err_obj, strerror(errno));
-                               	        return scope.Close(err_obj);
-                      		}
-                              	/* make string of the form `size:"string",` */	
-				n = snprintf(num, sizeof(num), "%zu:", len + 2);
-				/* check available space in the buffer
-				 * add one byte for comma
-				 */
-				if (n + len + 1 > sizeof(databuf) - written_len)
-					ThrowException(Exception::Error(String::New("string exceed maximum length")));
-				/* wrap in quoutes and appends comma */
-				written_len += snprintf(databuf + written_len, sizeof(databuf) - written_len,
-							"%zu:\"%s\",", len + 2, retbuf);		
+	std::string arg;
+	char num[32];
+
+	out.clear();
+	for (size_t i = 0; i < req->func_args.size(); i++) {
+		const std::string &str = req->func_args[i];
+		if (encoding_is_set()) {
+			arg.clear();
+			encoding_append(utf8_to_mumps, str.data(), str.size(), arg);
 		} else {
-			/* size check */
-			len = str->Length();
-			n = snprintf(num, sizeof(num), "%zu:", len + 2);
-			if (n + len + 1 > sizeof(databuf) - written_len)
-				ThrowException(Exception::Error(String::New("string exceed maximum length")));	
-			/* wrap in quoutes */
-			written_len += snprintf(databuf + written_len, sizeof(databuf),
-						"%zu:\"%s\",", len + 2, *String::Utf8Value(str));
+			arg = str;
+		}
+		/* gtm takes no longer string */
+		if (out.size() + arg.size() + sizeof(num) + 3 > BUF_LEN_MAX) {
+			req->state = REQ_EXCEPTION;
+			req->err_msg = "string exceed maximum length";
+			return FALSE;
 		}
+		/* make string of the form `size:"string",` */
+		if (i > 0)
+			out += ',';
+		append_literal(out, arg.data(), arg.size());
 	}
-	/* delete last comma */	
-	if (databuf[written_len - 1] != '\0')
-		databuf[written_len - 1] = '\0';
-	
-	return scope.Close(True());
+	return TRUE;
 }
 
-static char* to_string(M type)
+/* make the value of a set, strings are converted to `encoding'
+ * and wrapped in quotes, numbers go as they are
+ */
+static int data2mumps_string(gtm_req *req, const std::string &data, bool is_string, std::string &out)
 {
-	switch (type) {
-	case M::M_DATA:
-		return "data";
-	case M::M_FUNCTION:
-		return "function";
-	case M::M_GET:
-		return "get";	
-	case M::M_GLOBAL_DIRECTORY:
-		return "global_directory";
-	case M::M_INCREMENT:
-		return "increment";
-	case M::M_KILL:
-		return "kill";
-	case M::M_LOCK:
-		return "lock";
-	case M::M_MERGE:
-		return "merge";
-	case M::M_NEXT_NODE:
-		return "next_node";
-	case M::M_ORDER:
-		return "order";
-	case M::M_PREVIOUS:
-		return "previous";
-	case M::M_PREVIOUS_NODE:
-		return "previous_node";
-	case M::M_RETRIEVE:
-		return "retrieve";
-	case M::M_SET:
-		return "set";
-	case M::M_UNLOCK:
-		return "unlock";
-	case M::M_UPDATE:
-		return "update";
-	case M::M_VERSION:
-		return "version";
-	default:
-		assert(FALSE);
+	if (!is_string) {
+		out = data;
+		return TRUE;
 	}
-	return NULL;
+	/* an import has the bytes gtm gave to the export */
+	if (encoding_is_set() && req->function != M::M_IMPORT &&
+	    !(encoding_ascii && iconvm_is_ascii(data.data(), data.size()))) {
+		out.assign(1, '"');
+		encoding_append(utf8_to_mumps, data.data(), data.size(), out);
+	} else {
+		out.assign(1, '"');
+		out += data;
+	}
+	/* wrap in quoutes */
+	out += '"';
+	return TRUE;
 }
 
-Handle<Value> gtm_call(M function, const Arguments &_args)
+/* a number as M reads it, without a leading zero and with E for an exponent */
+static void num2mumps(std::string &num)
 {
-	HandleScope scope;
-	Local<Object> err_obj = Object::New();
-	Local<Value> glb;
-	Local<Value> subs;
-	Local<Value> data;
-	Local<Value> func;
-	Local<Value> func_args;
-	gtm_status_t err;
-	ci_name_descriptor call;
-	gtm_char_t *err_msg;
-	int err_code;
-	char *encoding;
-
-	if (!gtm_is_open) {
-		setOk(err_obj, 0);
-		setErrorMessage(err_obj, "Gtm is closed");
-		return scope.Close(err_obj);
+	size_t e;
+
+	if (num.compare(0, 2, "0.") == 0)
+		num.erase(0, 1);
+	else if (num.compare(0, 3, "-0.") == 0)
+		num.erase(1, 1);
+	if ((e = num.find('e')) != std::string::npos) {
+		num[e] = 'E';
+		if (num[e + 1] == '+')
+			num.erase(e + 1, 1);
 	}
-	
-	Local<Object> args = Local<Object>::Cast(_args[0]);
-	if (args->IsUndefined())
-		return scope.Close(Undefined());
+}
 
-#define set_mumps_call(call, cname) \
-do { \
-	call.rtn_name.address = cname; \
-	call.rtn_name.length  = strlen(call.rtn_name.address); \
-	call.handle = NULL; \
-} while (0);
+/* a double as M reads it, with as many digits as it takes to read it
+ * back the same, so .1 stays .1 and a large counter keeps all its digits
+ */
+static void double2mumps(double n, std::string &num)
+{
+	char buf[32];
 
-#define throw_exception(message) \
-do { \
-	ThrowException(Exception::Error(String::New(message))); \
-} while (0);
+	for (int digits = 15; digits <= 17; digits++) {
+		snprintf(buf, sizeof(buf), "%.*g", digits, n);
+		if (strtod(buf, NULL) == n)
+			break;
+	}
+	num = strcmp(buf, "-0") == 0 ? "0" : buf;
+	num2mumps(num);
+}
 
-	switch (function) {
-	case M::M_DATA:
-	case M::M_KILL:
-	case M::M_LOCK:
-		{
-			glb  = args->Get(String::New("global"));
-			subs = args->Get(String::New("subscripts"));
-	
-			Local<Value> m_subs;
-			Local<Array> js_subs;
+/* append a field of the form `len:bytes' */
+static inline void append_field(std::string &out, const std::string &bytes)
+{
+	char num[32];
 
-			if (subs->IsUndefined()) {
-				m_subs = String::Empty();
-			} else {
-				js_subs = Local<Array>::Cast(subs);
-				m_subs  = Array::New();
-				Local<Array> tmp = Local<Array>::Cast(m_subs);
-				js2mumps_array(js_subs, tmp);
-			}
-			
-			set_mumps_call(call, to_string(function));
-	
-			err = gtm_cip(&call, retbuf, *String::AsciiValue(glb),
-						     *String::AsciiValue(m_subs), mode);
-	
-			if (err)
-				goto gtm_err;
-	
-			Local<String> str = String::New(retbuf);
-			if (str->Length() == 0)
-				throw_exception("No JSON string present");
-
-			Handle<Value> ret = JSON_parse(str);
-			if (ret.IsEmpty())
-				return scope.Close(Undefined());
-			
-			Handle<Object> ret_obj = Handle<Object>::Cast(ret);
-			Handle<Value> data_obj = ret_obj->Get(String::New("data"));
-			/* stringify data property */
-			ret_obj->Set(String::New("data"), String::New((char *)*String::AsciiValue(data_obj)));
-			if (subs->IsUndefined())
-				return scope.Close(ret_obj);
-			/* set subs in response */
-			if (ret_obj->Get(String::New("errorCode"))->IsUndefined())
-				ret_obj->Set(String::New("subscripts"), js_subs);
-			return scope.Close(ret_obj);	
-		}
-		break;
-	case M::M_FUNCTION:
-		{
-			func = args->Get(String::New("function"));
-			func_args = args->Get(String::New("arguments"));
+	snprintf(num, sizeof(num), "%zu:", bytes.size());
+	out += num;
+	out += bytes;
+}
 
-			if (func->IsUndefined())
-				throw_exception("Need to supply a function property");
-			
-			Local<Value> m_func_args;
+/* serialize a batch for batch^v4wNode, every operation is
+ * four `len:bytes' fields: name, global, subscripts and data
+ */
+static int ops2mumps_string(gtm_req *req, std::string &out)
+{
+	std::string m_data;
+
+	out.clear();
+	for (size_t i = 0; i < req->ops.size(); i++) {
+		const batch_op &op = req->ops[i];
+
+		if (!data2mumps_string(req, op.data, op.data_is_string, m_data))
+			return FALSE;
+		append_field(out, op.op);
+		append_field(out, op.glb);
+		append_field(out, op.m_subs);
+		append_field(out, m_data);
+	}
+	return TRUE;
+}
 
-			if (func_args->IsUndefined()) {
-				m_func_args = String::Empty();
-			} else {
-				Local<Array> js_func_args = Local<Array>::Cast(func_args);
-				/* result is in the databuf */
-                                args2mumps_string(js_func_args);
-			}
-	
-			set_mumps_call(call, "function");
+/* serialize update nodes starting at *next as pairs of relative
+ * subscripts and data fields, up to about CHUNK_LEN bytes
+ */
+static int nodes2mumps_string(gtm_req *req, size_t *next, std::string &out)
+{
+	std::string m_subs, m_data;
 
-			/* pass data to mumps function */
-			err = gtm_cip(&call, retbuf, *String::Utf8Value(func), databuf, auto_relink, mode);
-			if (err)
-				goto gtm_err;	
-	
-			Local<String> str;
-			/* convert returned data back to utf8 */
-			if ((encoding = getenv("XNODEM_ENCODING")) != NULL) {	
-				iconv_t cd = iconvm_open("utf8", encoding);
-				if (cd == (iconv_t)(-1)) {
-					setOk(err_obj, 0);
-					setErrorMessage(err_obj, strerror(errno));
-					return scope.Close(err_obj);
-				}
-				iconvm(cd, retbuf, strlen(retbuf), retconv, sizeof(retconv));
-				if (iconvm_close(cd) < 0) {
-					setOk(err_obj, 0);
-					setErrorMessage(err_obj, strerror(errno));
-					return scope.Close(err_obj);
-				}
-				str = String::New(retconv);	
-			} else {
-				str = String::New(retbuf);			
-			}
+	out.clear();
+	while (*next < req->ops.size() && out.size() < CHUNK_LEN) {
+		const batch_op &node = req->ops[*next];
 
-			if (str->Length() == 0) 
-				throw_exception("No JSON string present");
-	
-			Handle<Value> ret = JSON_parse(str);
-			if (ret.IsEmpty())
-				return scope.Close(Undefined());
-				
-			Handle<Object> ret_obj = Handle<Object>::Cast(ret);
-			Local<Array> args = Local<Array>::Cast(func_args);
-			/* stringify data property */
-			ret_obj->Set(String::New("arguments"), args);
-			return scope.Close(ret_obj);
+		if (!subs2mumps_string(node.subs, m_subs)) {
+			req->state = REQ_EXCEPTION;
+			req->err_msg = "subscript is too big";
+			return FALSE;
 		}
-		break;
-	case M::M_GET:
-		{
-			glb  = args->Get(String::New("global"));
-			subs = args->Get(String::New("subscripts"));
-			
-			Local<Value> m_subs;
-			Local<Array> js_subs;
+		if (!data2mumps_string(req, node.data, node.data_is_string, m_data))
+			return FALSE;
+		append_field(out, m_subs);
+		append_field(out, m_data);
+		(*next)++;
+	}
+	return TRUE;
+}
+
+/* read the error of the last call-in into the request */
+static void gtm_failed(gtm_req *req)
+{
+	gtm_char_t *err_msg;
+
+	gtm_zstatus(errbuf, sizeof(errbuf));
+	gtm_error_parse(errbuf, &req->err_code, &err_msg);
+	req->state = REQ_GTM_ERROR;
+	req->err_msg = err_msg;
+}
+
+/* add the result message in retbuf to req->ret, a message longer than
+ * retbuf is fetched in pieces until its length prefix is satisfied,
+ * every piece is as long as it can be, so they are taken by length
+ * and a NUL in a value does not cut it short
+ */
+static int read_message(gtm_req *req, size_t *offset, size_t *length)
+{
+	size_t base = req->ret.size(), len, piece;
+	char *end;
+
+	len = strtoul(retbuf, &end, 10);
+	if (*end != ':') {
+		req->ret += retbuf;
+	} else {
+		len += end - retbuf + 1;
+		for (;;) {
+			piece = len - (req->ret.size() - base);
+			if (piece > sizeof(retbuf) - 1)
+				piece = sizeof(retbuf) - 1;
+			req->ret.append(retbuf, piece);
+			if (req->ret.size() - base == len)
+				break;
+			if (gtm_cip(mumps_call(M::M_MORE), retbuf)) {
+				gtm_failed(req);
+				return FALSE;
+			}
+		}
+	}
+	if (!mproto_unwrap(req->ret.data() + base, req->ret.size() - base, offset, length)) {
+		req->state = REQ_EXCEPTION;
+		req->err_msg = "Invalid result from GT.M";
+		return FALSE;
+	}
+	/* keep only the fields */
+	req->ret.erase(base, *offset);
+	*offset = base;
+	return TRUE;
+}
+
+/* split the result message in retbuf while still off the main thread
+ * and add it to the request, a chunked result tells where to resume
+ */
+static int append_message(gtm_req *req, std::string *cont)
+{
+	std::vector<mfield> fields;
+	size_t base, length;
+
+	if (!read_message(req, &base, &length))
+		return FALSE;
+	if (!mproto_decode(req->ret.data() + base, length, fields))
+		goto invalid;
+
+	if (cont)
+		cont->clear();
+	for (size_t i = 0; i < fields.size(); i++) {
+		mfield &f = fields[i];
+		f.offset += base;
+		if (cont && f.tag == MF_CONTINUE)
+			cont->assign(req->ret, f.offset, f.length);
+		req->fields.push_back(f);
+	}
+	return TRUE;
+invalid:
+	req->state = REQ_EXCEPTION;
+	req->err_msg = "Invalid result from GT.M";
+	return FALSE;
+}
+
+/* convert the string fields returned by gtm back to utf8,
+ * the message is rebuilt as the field lengths change
+ */
+static void mumps2utf8(gtm_req *req)
+{
+	std::string conv;
+
+	/* nothing changes when all of it is ascii */
+	if (encoding_ascii && iconvm_is_ascii(req->ret.data(), req->ret.size()))
+		return;
+	conv.reserve(req->ret.size());
+	for (size_t i = 0; i < req->fields.size(); i++) {
+		mfield &f = req->fields[i];
+		size_t offset = conv.size();
+		if (f.type == MF_STRING) {
+			encoding_append(mumps_to_utf8, req->ret.data() + f.offset, f.length, conv);
+			f.length = conv.size() - offset;
+		} else if (f.type == MF_MESSAGE) {
+			/* nested fields follow, only `count' is used from here on */
+			f.length = 0;
+		} else {
+			conv.append(req->ret, f.offset, f.length);
+		}
+		f.offset = offset;
+	}
+	req->ret.swap(conv);
+}
+
+/* flatten an object tree into update nodes, the empty key
+ * holds the value of a node that has children too
+ */
+static const char *js2nodes(Local<Object> obj, std::vector<std::string> &path, std::vector<batch_op> &nodes)
+{
+	HandleScope scope;
+	Local<Array> keys = obj->GetPropertyNames();
+
+	for (unsigned int i = 0; i < keys->Length(); i++) {
+		Local<Value> key = keys->Get(i);
+		Local<Value> value = obj->Get(key);
+		String::Utf8Value name(key);
+
+		if (value->IsUndefined() || value->IsNull() || value->IsFunction())
+			continue;
+		if (value->IsObject()) {
+			if (name.length() == 0)
+				return "Empty key of a subtree";
+			if (path.size() == SUBSCRIPTS_MAX)
+				return "Too many subscripts";
+			path.push_back(std::string(*name, name.length()));
+			const char *err = js2nodes(Local<Object>::Cast(value), path, nodes);
+			path.pop_back();
+			if (err != NULL)
+				return err;
+			continue;
+		}
+		nodes.push_back(batch_op());
+		batch_op &node = nodes.back();
+		node.subs = path;
+		if (name.length() > 0)
+			node.subs.push_back(std::string(*name, name.length()));
+		String::Utf8Value data(value);
+		node.data_is_string = value->IsString();
+		node.data = std::string(*data, data.length());
+	}
+	return NULL;
+}
+
+/* read the {global, subscripts} of a node into the request */
+static const char *node2req(Local<Object> node, gtm_req *req)
+{
+	HandleScope scope;
+	Local<Value> glb  = node->Get(String::New("global"));
+	Local<Value> subs = node->Get(String::New("subscripts"));
+
+	if (!glb->IsUndefined())
+		req->glb = *String::AsciiValue(glb);
+	if (!subs->IsUndefined()) {
+		req->has_subs = true;
+		req->js_subs = Persistent<Value>::New(subs);
+		if (!js2mumps_subs(subs, req->m_subs))
+			return "subscript is too big";
+	}
+	return NULL;
+}
+
+/* a next as a chunked call gives it, hex subscripts split by commas,
+ * anything else never reaches gtm
+ */
+static bool is_cont(const std::string &start)
+{
+	return !start.empty() && start.find_first_not_of("0123456789ABCDEF,") == std::string::npos;
+}
+
+/* tell a {global, subscripts} node from a javascript object tree */
+static bool is_node(Local<Value> value)
+{
+	HandleScope scope;
+	Local<Object> obj;
+	Local<Array> keys;
+
+	if (!value->IsObject() || value->IsArray())
+		return false;
+	obj = value->ToObject();
+	if (!obj->Get(String::New("global"))->IsString())
+		return false;
+	keys = obj->GetOwnPropertyNames();
+	for (uint32_t i = 0; i < keys->Length(); i++) {
+		String::AsciiValue key(keys->Get(i));
+		if (strcmp(*key, "global") != 0 && strcmp(*key, "subscripts") != 0)
+			return false;
+	}
+	return true;
+}
+
+/* read the call arguments into `req', runs on the main thread,
+ * returns an error message if the arguments are not usable
+ */
+static const char *gtm_marshal(M function, Local<Object> &args, const Arguments &_args, gtm_req *req)
+{
+	HandleScope scope;
+	Local<Value> subs;
+	const char *err;
+
+	switch (function) {
+	case M::M_DATA:
+	case M::M_GET:
+	case M::M_GET_BUFFER:
+	case M::M_GET_NUMBER:
+	case M::M_INCREMENT:
+	case M::M_INCREMENT_NUMBER:
+	case M::M_KILL:
+	case M::M_NEXT_NODE:
+	case M::M_ORDER:
+	case M::M_PREVIOUS:
+	case M::M_RETRIEVE:
+	case M::M_SET:
+	case M::M_SET_BUFFER:
+	case M::M_SET_NUMBER:
+	case M::M_UNLOCK:
+	case M::M_UPDATE:
+		if ((err = node2req(args, req)) != NULL)
+			return err;
+		if (function == M::M_INCREMENT || function == M::M_INCREMENT_NUMBER) {
+			Local<Value> number = _args[1];
+			if (number->IsUndefined() || number->IsFunction())
+				number = Number::New(1);
+			req->number = number->NumberValue();
+		} else if (function == M::M_SET) {
+			Local<Value> data = args->Get(String::New("data"));
+			if (data->IsUndefined())
+				return "Need to supply a data property";
+			String::Utf8Value value(data);
+			req->data_is_string = data->IsString();
+			req->data = std::string(*value, value.length());
+		} else if (function == M::M_SET_NUMBER) {
+			Local<Value> data = args->Get(String::New("data"));
+			if (!data->IsNumber())
+				return "Need to supply a number data property";
+			req->number = data->NumberValue();
+		} else if (function == M::M_SET_BUFFER) {
+			Local<Value> data = args->Get(String::New("data"));
+			if (!Buffer::HasInstance(data))
+				return "Need to supply a Buffer data property";
+			if (Buffer::Length(data) > BUF_LEN_MAX)
+				return "Buffer exceeds maximum length";
+			/* the bytes are read in place, keep the Buffer alive till then */
+			req->js_buf = Persistent<Value>::New(data);
+			req->buf = Buffer::Data(data);
+			req->buf_len = Buffer::Length(data);
+		} else if (function == M::M_GET_BUFFER) {
+			/* a hint of the value size saves a second call-in for big values */
+			Local<Value> size = args->Get(String::New("size"));
+			req->buf_size = BUF_LEN;
+			if (size->IsNumber() && size->Uint32Value() > BUF_LEN)
+				req->buf_size = size->Uint32Value() < BUF_LEN_MAX ? size->Uint32Value() : BUF_LEN_MAX;
+		} else if (function == M::M_UPDATE) {
+			Local<Value> object = args->Get(String::New("object"));
+			std::vector<std::string> path;
+			if (!object->IsObject())
+				return "Need to supply an object property";
+			return js2nodes(Local<Object>::Cast(object), path, req->ops);
+		}
+		break;
+	case M::M_EXPORT:
+		{
+			Local<Value> start = _args[1];
+
+			if (!is_node(args))
+				return "Need to supply a global node";
+			if ((err = node2req(args, req)) != NULL)
+				return err;
+			/* where the last chunk stopped, as it gave it */
+			if (Buffer::HasInstance(start))
+				req->start.assign(Buffer::Data(start), Buffer::Length(start));
+			else if (start->IsString())
+				req->start = *String::Utf8Value(start);
+			if (!req->start.empty() && !is_cont(req->start))
+				return "Invalid start of a chunk";
+		}
+		break;
+	case M::M_QUERY:
+		{
+			Local<Value> match = args->Get(String::New("match"));
+			Local<Value> limit = args->Get(String::New("limit"));
+			Local<Value> start = args->Get(String::New("start"));
+			const char *names[] = {"subscriptPrefix", "subscriptPattern", "valuePrefix", "valuePattern"};
+
+			if ((err = node2req(args, req)) != NULL)
+				return err;
+			/* no tests at all gives every node, as retrieve */
+			req->match.resize(8);
+			if (match->IsObject()) {
+				Local<Object> tests = match->ToObject();
+				Local<Value> range = tests->Get(String::New("valueRange"));
+				Local<Value> keys = tests->Get(String::New("keyRange"));
+
+				for (int i = 0; i < 4; i++) {
+					Local<Value> test = tests->Get(String::New(names[i]));
+					if (!test->IsUndefined() && !test->IsNull())
+						req->match[i] = *String::Utf8Value(test);
+				}
+				if (range->IsObject()) {
+					Local<Value> min = range->ToObject()->Get(String::New("min"));
+					Local<Value> max = range->ToObject()->Get(String::New("max"));
+					if (min->IsNumber())
+						req->match[4] = *String::Utf8Value(min);
+					if (max->IsNumber())
+						req->match[5] = *String::Utf8Value(max);
+				}
+				/* the first subscript below the node, from inclusive, to exclusive,
+				 * a bound is n(umber) or s(tring) and its text
+				 */
+				if (keys->IsObject()) {
+					Local<Value> bounds[2] = {keys->ToObject()->Get(String::New("from")),
+								  keys->ToObject()->Get(String::New("to"))};
+					for (int i = 0; i < 2; i++) {
+						if (bounds[i]->IsUndefined() || bounds[i]->IsNull())
+							continue;
+						req->match[6 + i] = bounds[i]->IsNumber() ? "n" : "s";
+						req->match[6 + i] += *String::Utf8Value(bounds[i]);
+					}
+				}
+			}
+			req->max = limit->IsNumber() ? limit->Uint32Value() : 0;
+			if (start->IsString())
+				req->start = *String::Utf8Value(start);
+			if (!req->start.empty() && !is_cont(req->start))
+				return "Invalid start of a chunk";
+		}
+		break;
+	case M::M_PARTITION:
+		{
+			Local<Value> partitions = args->Get(String::New("partitions"));
+
+			if (!args->Get(String::New("global"))->IsString())
+				return "Need to supply a global property";
+			if ((err = node2req(args, req)) != NULL)
+				return err;
+			if (!partitions->IsNumber() || partitions->Uint32Value() < 1)
+				return "Need to supply a partitions property";
+			req->max = partitions->Uint32Value();
+		}
+		break;
+	case M::M_INDEX:
+		{
+			Local<Value> name = args->Get(String::New("name"));
+			Local<Value> glb = args->Get(String::New("global"));
+			Local<Value> into = args->Get(String::New("into"));
+			Local<Value> pattern;
+			Local<Array> arr;
+			bool any = false;
+
+			if (!name->IsString() || name->ToString()->Length() == 0)
+				return "Need to supply a name property";
+			if (!glb->IsString())
+				return "Need to supply a global property";
+			subs = args->Get(String::New("subscripts"));
+			if (!subs->IsArray())
+				return "Need to supply a subscripts property";
+			if (!is_node(into))
+				return "Need to supply an into property with a global node";
+			req->index = *String::Utf8Value(name);
+			req->glb = *String::AsciiValue(glb);
+			/* a null subscript stands for any, the entries keep those */
+			arr = Local<Array>::Cast(subs);
+			if (arr->Length() > SUBSCRIPTS_MAX)
+				return "Too many subscripts";
+			for (uint32_t i = 0; i < arr->Length(); i++) {
+				Local<Value> sub = arr->Get(i);
+				if (sub->IsNull() || sub->IsUndefined()) {
+					req->match.push_back("");
+					any = true;
+				} else {
+					req->match.push_back(std::string("=") + *String::Utf8Value(sub));
+				}
+			}
+			if (!any)
+				return "Need a null subscript to index by";
+			req->from_glb = *String::AsciiValue(into->ToObject()->Get(String::New("global")));
+			subs = into->ToObject()->Get(String::New("subscripts"));
+			if (!subs->IsUndefined() && !js2mumps_subs(subs, req->m_from_subs))
+				return "subscript is too big";
+		}
+		break;
+	case M::M_LOOKUP:
+		{
+			Local<Value> name = args->Get(String::New("index"));
+			Local<Value> value = args->Get(String::New("value"));
+			Local<Value> from = args->Get(String::New("from"));
+			Local<Value> to = args->Get(String::New("to"));
+			Local<Value> limit = args->Get(String::New("limit"));
+			Local<Value> start = args->Get(String::New("start"));
+
+			if (!name->IsString())
+				return "Need to supply an index property";
+			req->index = *String::Utf8Value(name);
+			/* a value is a range of one, an empty bound is an open one */
+			if (!value->IsUndefined()) {
+				req->lo = req->hi = *String::Utf8Value(value);
+				if (req->lo.empty())
+					return "Empty values are not indexed";
+			}
+			if (!from->IsUndefined() && !from->IsNull())
+				req->lo = *String::Utf8Value(from);
+			if (!to->IsUndefined() && !to->IsNull())
+				req->hi = *String::Utf8Value(to);
+			req->max = limit->IsNumber() ? limit->Uint32Value() : 0;
+			if (start->IsString())
+				req->start = *String::Utf8Value(start);
+			if (!req->start.empty() && !is_cont(req->start))
+				return "Invalid start of a chunk";
+		}
+		break;
+	case M::M_REBUILD_INDEX:
+		{
+			Local<Value> name = args->Get(String::New("index"));
+
+			if (!name->IsString())
+				return "Need to supply an index property";
+			req->index = *String::Utf8Value(name);
+		}
+		break;
+	case M::M_IMPORT:
+		{
+			Local<Value> data = _args[1];
+
+			if (!is_node(args))
+				return "Need to supply a global node";
+			if (!Buffer::HasInstance(data))
+				return "Need to supply a Buffer of records";
+			if ((err = node2req(args, req)) != NULL)
+				return err;
+			/* the records are read in place, keep the Buffer alive till then */
+			req->js_buf = Persistent<Value>::New(data);
+			req->buf = Buffer::Data(data);
+			req->buf_len = Buffer::Length(data);
+		}
+		break;
+	case M::M_LOCK:
+		{
+			Local<Value> timeout = _args[1];
+
+			/* in seconds, 0 only tries, without one the lock waits for as long as it takes */
+			req->number = timeout->IsNumber() && timeout->NumberValue() >= 0 ? timeout->NumberValue() : -1;
+			if (!args->IsArray())
+				return node2req(args, req);
+
+			/* a list of nodes is locked all at once or not at all */
+			Local<Array> nodes = Local<Array>::Cast(args);
+
+			if (nodes->Length() == 0)
+				return "Need to supply a list of global nodes";
+			req->function = M::M_LOCK_LIST;
+			req->js_ops = Persistent<Value>::New(nodes);
+			req->ops.resize(nodes->Length());
+			for (unsigned int i = 0; i < nodes->Length(); i++) {
+				batch_op &op = req->ops[i];
+				Local<Value> node = nodes->Get(i);
+
+				if (!is_node(node))
+					return "Need to supply a list of global nodes";
+				op.op = "lock";
+				op.glb = *String::AsciiValue(node->ToObject()->Get(String::New("global")));
+				subs = node->ToObject()->Get(String::New("subscripts"));
+				if (!subs->IsUndefined() && !js2mumps_subs(subs, op.m_subs))
+					return "subscript is too big";
+				op.data_is_string = false;
+			}
+		}
+		break;
+	case M::M_FUNCTION:
+		{
+			Local<Value> func = args->Get(String::New("function"));
+			Local<Value> func_args = args->Get(String::New("arguments"));
+
+			if (func->IsUndefined())
+				return "Need to supply a function property";
+
+			req->func = *String::Utf8Value(func);
+			req->js_func_args = Persistent<Value>::New(func_args);
+			if (!func_args->IsUndefined())
+				js2native_array(func_args, req->func_args);
+		}
+		break;
+	case M::M_BATCH:
+		{
+			if (!args->IsArray())
+				return "Need to supply an array of operations";
+
+			Local<Array> js_ops = Local<Array>::Cast(args);
+			Local<Value> options = _args[1];
+
+			if (options->IsObject() && !options->IsFunction())
+				req->transaction = options->ToObject()->Get(String::New("transaction"))->BooleanValue();
+
+			req->js_ops = Persistent<Value>::New(js_ops);
+			req->ops.resize(js_ops->Length());
+			for (unsigned int i = 0; i < js_ops->Length(); i++) {
+				batch_op &op = req->ops[i];
+				Local<Object> js_op = js_ops->Get(i)->ToObject();
+				Local<Value> name = js_op->Get(String::New("op"));
+				Local<Value> data;
+
+				op.op = *String::AsciiValue(name);
+				op.glb = *String::AsciiValue(js_op->Get(String::New("global")));
+				subs = js_op->Get(String::New("subscripts"));
+				if (!subs->IsUndefined() && !js2mumps_subs(subs, op.m_subs))
+					return "subscript is too big";
+				op.data_is_string = false;
+				if (op.op == "set") {
+					data = js_op->Get(String::New("data"));
+					if (data->IsUndefined())
+						return "Need to supply a data property";
+					String::Utf8Value value(data);
+					op.data_is_string = data->IsString();
+					op.data = std::string(*value, value.length());
+				} else if (op.op == "increment") {
+					data = js_op->Get(String::New("increment"));
+					if (data->IsUndefined())
+						data = Number::New(1);
+					/* as M reads a number, 1E-7 and not 1e-7 */
+					if (!isfinite(data->NumberValue()))
+						return "Need to supply a finite increment";
+					double2mumps(data->NumberValue(), op.data);
+				} else if (op.op != "get" && op.op != "kill" && op.op != "data") {
+					return "Unknown batch operation";
+				}
+			}
+		}
+		break;
+	case M::M_GLOBAL_DIRECTORY:
+		{
+			Local<Value> max = args->Get(String::New("max"));
+			Local<Value> lo  = args->Get(String::New("lo"));
+			Local<Value> hi  = args->Get(String::New("hi"));
+
+			req->max = max->IsUndefined() ? 0 : max->Uint32Value();
+			if (!lo->IsUndefined())
+				req->lo = *String::AsciiValue(lo);
+			if (!hi->IsUndefined())
+				req->hi = *String::AsciiValue(hi);
+		}
+		break;
+	case M::M_MERGE:
+		{
+			Local<Value> to = args->Get(String::New("to"));
+			Local<Value> from = args->Get(String::New("from"));
+
+			/* a subtree into a javascript object, made as by retrieve() */
+			if (to->IsString()) {
+				if (strcmp(*String::AsciiValue(to), "js") != 0 || !is_node(from))
+					return "Need to supply a from node to merge to 'js'";
+				req->function = M::M_RETRIEVE;
+				return node2req(from->ToObject(), req);
+			}
+			if (!is_node(to) || !from->IsObject())
+				return "Need to supply to and from properties";
+			/* a javascript object into a subtree, made as by update() */
+			if (!is_node(from)) {
+				std::vector<std::string> path;
+				req->function = M::M_UPDATE;
+				if ((err = node2req(to->ToObject(), req)) != NULL)
+					return err;
+				return js2nodes(from->ToObject(), path, req->ops);
+			}
+
+			Local<Object> to_obj = to->ToObject();
+			Local<Object> from_obj = from->ToObject();
+			/* to */
+			Local<Value> to_subs = to_obj->Get(String::New("subscripts"));
+			req->glb = *String::AsciiValue(to_obj->Get(String::New("global")));
+			if (!js2mumps_subs(to_subs, req->m_subs))
+				return "subscript is too big";
+			/* from */
+			Local<Value> from_subs = from_obj->Get(String::New("subscripts"));
+			req->from_glb = *String::AsciiValue(from_obj->Get(String::New("global")));
+			if (!js2mumps_subs(from_subs, req->m_from_subs))
+				return "subscript is too big";
+		}
+		break;
+	default:
+		break;
+	}
+	return NULL;
+}
+
+/* the indexes declared in this process, gtm keeps their entries up to date
+ * in v4wNode.m and these only tell the read cache which entries a write to
+ * an indexed global may change behind its back.
+ * use them only while holding gtm_lock()
+ */
+struct index_def {
+	std::string name;
+	std::string glb;	/* without the ^ */
+	std::string into_glb;
+	std::string m_into_subs;
+};
+
+static std::vector<index_def> indexes;
+
+static inline std::string glb_name(const std::string &glb)
+{
+	return glb.compare(0, 1, "^") == 0 ? glb.substr(1) : glb;
+}
+
+/* an index declared again replaces the one of the same name */
+static void index_declared(gtm_req *req)
+{
+	index_def def;
+
+	def.name = req->index;
+	def.glb = glb_name(req->glb);
+	def.into_glb = req->from_glb;
+	def.m_into_subs = req->m_from_subs;
+	for (size_t i = 0; i < indexes.size(); i++) {
+		if (indexes[i].name == def.name) {
+			indexes[i] = def;
+			return;
+		}
+	}
+	indexes.push_back(def);
+}
+
+/* drop the cached entries of the indexes on a global that was written to */
+static void cache_update_indexes(const std::string &glb)
+{
+	if (indexes.empty())
+		return;
+	std::string name = glb_name(glb);
+	for (size_t i = 0; i < indexes.size(); i++) {
+		if (indexes[i].glb == name)
+			mcache_invalidate(indexes[i].into_glb, indexes[i].m_into_subs, TRUE);
+	}
+}
+
+/* keep a get result, or drop what a write may have changed,
+ * a write that failed half way may still have changed something
+ */
+static void cache_update(gtm_req *req)
+{
+	switch (req->function) {
+	case M::M_GET:
+		if (req->state == REQ_OK)
+			mcache_put(req->glb, req->m_subs, req->ret, req->fields);
+		break;
+	case M::M_INCREMENT:
+	case M::M_INCREMENT_NUMBER:
+	case M::M_SET:
+	case M::M_SET_BUFFER:
+	case M::M_SET_NUMBER:
+		mcache_invalidate(req->glb, req->m_subs, FALSE);
+		cache_update_indexes(req->glb);
+		break;
+	case M::M_IMPORT:
+	case M::M_KILL:
+	case M::M_UPDATE:
+		mcache_invalidate(req->glb, req->m_subs, TRUE);
+		cache_update_indexes(req->glb);
+		break;
+	case M::M_MERGE:
+		/* whichever side is written to */
+		mcache_invalidate(req->glb, req->m_subs, TRUE);
+		mcache_invalidate(req->from_glb, req->m_from_subs, TRUE);
+		cache_update_indexes(req->glb);
+		break;
+	case M::M_BATCH:
+	case M::M_TCOMMIT:
+		for (size_t i = 0; i < req->ops.size(); i++) {
+			const batch_op &op = req->ops[i];
+			if (op.op == "set" || op.op == "kill" || op.op == "increment") {
+				mcache_invalidate(op.glb, op.m_subs, op.op == "kill");
+				cache_update_indexes(op.glb);
+			}
+		}
+		break;
+	case M::M_REBUILD_INDEX:
+		for (size_t i = 0; i < indexes.size(); i++) {
+			if (indexes[i].name == req->index)
+				mcache_invalidate(indexes[i].into_glb, indexes[i].m_into_subs, TRUE);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+/* the records of exportStream and importStream, see lib/stream.js:
+ * a subscript count byte, then a uint32 length and the bytes of each
+ * subscript and of the data, little endian
+ */
+static inline char *put_u32(char *p, size_t n)
+{
+	p[0] = n & 0xff;
+	p[1] = (n >> 8) & 0xff;
+	p[2] = (n >> 16) & 0xff;
+	p[3] = (n >> 24) & 0xff;
+	return p + 4;
+}
+
+static inline size_t get_u32(const unsigned char *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (size_t)p[3] << 24;
+}
+
+/* the nodes of a retrieve chunk as records in req->buf */
+static int fields2records(gtm_req *req)
+{
+	size_t len = 0;
+	char *p;
+
+	for (size_t i = 0; i < req->fields.size(); i++) {
+		const mfield &f = req->fields[i];
+		if (f.tag == MF_LIST && f.type == MF_MESSAGE)
+			len += 1 + 4;
+		else if (f.tag == MF_SUBSCRIPT)
+			len += 4 + f.length;
+		else if (f.tag == MF_DATA)
+			len += f.length;
+	}
+	if ((req->buf = (char *)malloc(len ? len : 1)) == NULL) {
+		req->state = REQ_ERROR;
+		req->err_msg = strerror(ENOMEM);
+		return FALSE;
+	}
+	p = req->buf;
+	for (size_t i = 0; i < req->fields.size(); i++) {
+		const mfield &f = req->fields[i];
+		size_t end = i + 1 + f.count;
+		char *count;
+
+		if (f.tag != MF_LIST || f.type != MF_MESSAGE)
+			continue;
+		count = p++;
+		*count = 0;
+		for (size_t j = i + 1; j < end; j++) {
+			const mfield &n = req->fields[j];
+			if (n.tag != MF_SUBSCRIPT)
+				continue;
+			p = put_u32(p, n.length);
+			memcpy(p, req->ret.data() + n.offset, n.length);
+			p += n.length;
+			(*count)++;
+		}
+		/* and then its data */
+		for (size_t j = i + 1; j < end; j++) {
+			const mfield &n = req->fields[j];
+			if (n.tag != MF_DATA)
+				continue;
+			p = put_u32(p, n.length);
+			memcpy(p, req->ret.data() + n.offset, n.length);
+			p += n.length;
+		}
+		i = end - 1;
+	}
+	req->buf_len = p - req->buf;
+	return TRUE;
+}
+
+/* the records of an import as the nodes of an update */
+static int records2nodes(gtm_req *req)
+{
+	const unsigned char *p = (const unsigned char *)req->buf;
+	const unsigned char *end = p + req->buf_len;
+	size_t len;
+
+	while (p < end) {
+		req->ops.push_back(batch_op());
+		batch_op &node = req->ops.back();
+		unsigned int count = *p++;
+
+		if (count > SUBSCRIPTS_MAX)
+			goto invalid;
+		for (unsigned int i = 0; i <= count; i++) {
+			if (end - p < 4 || (size_t)(end - p - 4) < (len = get_u32(p)))
+				goto invalid;
+			p += 4;
+			if (i < count)
+				node.subs.push_back(std::string((const char *)p, len));
+			else
+				node.data.assign((const char *)p, len);
+			p += len;
+		}
+		node.data_is_string = true;
+	}
+	return TRUE;
+invalid:
+	req->state = REQ_EXCEPTION;
+	req->err_msg = "Invalid import records";
+	return FALSE;
+}
+
+/* count the matches a chunk of a query or lookup added from field `from' on,
+ * and tell if there are more to fetch before the limit
+ */
+static int chunk_wants_more(gtm_req *req, size_t from, size_t *count)
+{
+	for (size_t i = from; i < req->fields.size(); i++) {
+		if (req->fields[i].tag == MF_LIST && req->fields[i].type == MF_MESSAGE)
+			(*count)++;
+	}
+	return !req->start.empty() && (req->max == 0 || *count < req->max);
+}
+
+/* make the call-in, runs on whichever thread owns the request
+ * and never touches v8, the result is left in req->ret
+ */
+static void gtm_exec(gtm_req *req)
+{
+	ci_name_descriptor *call;
+	gtm_status_t err = 0;
+	std::string m_data, start;
+	size_t next;
+	gtm_string_t value;
+	bool collected = false;
+	uint64_t began = 0, called = 0;
+
+	if (!gtm_is_open) {
+		req->state = REQ_CLOSED;
+		return;
+	}
+	if (stats_enabled)
+		began = uv_hrtime();
+	/* repeated reads are answered without going into gtm,
+	 * a transaction checks what it reads so it goes past the cache
+	 */
+	if (req->function == M::M_GET && !req->transaction && mcache_enabled() &&
+	    mcache_get(req->glb, req->m_subs, req->ret, req->fields)) {
+		if (stats_enabled)
+			req->t_call_in = uv_hrtime() - began;
+		return;
+	}
+
+	gtm_lock();
+
+	call = mumps_call(req->function);
+	req->bytes_in = req->glb.size() + req->m_subs.size() + req->from_glb.size() + req->m_from_subs.size();
+
+	switch (req->function) {
+	case M::M_DATA:
+	case M::M_GET:
+	case M::M_KILL:
+	case M::M_NEXT_NODE:
+	case M::M_ORDER:
+	case M::M_PREVIOUS:
+	case M::M_UNLOCK:
+		err = gtm_cip(call, retbuf, req->glb.c_str(), req->m_subs.c_str(), mode);
+		break;
+	/* a lock may wait here for as long as its timeout */
+	case M::M_LOCK:
+		err = gtm_cip(call, retbuf, req->glb.c_str(), req->m_subs.c_str(), req->number, mode);
+		break;
+	case M::M_LOCK_LIST:
+		if (!ops2mumps_string(req, m_data))
+			goto done;
+		err = gtm_cip(call, retbuf, m_data.c_str(), req->number, mode);
+		req->bytes_in += m_data.size();
+		break;
+	case M::M_RETRIEVE:
+		/* walk the subtree a chunk at a time, resuming after the last node returned */
+		do {
+			err = gtm_cip(call, retbuf, req->glb.c_str(), req->m_subs.c_str(),
+						    start.c_str(), (gtm_uint_t)CHUNK_LEN, mode);
+			if (err || !append_message(req, &start))
+				break;
+		} while (!start.empty());
+		if (req->state != REQ_OK)
+			goto done;
+		collected = true;
+		break;
+	case M::M_EXPORT:
+		/* a single chunk of a retrieve, without any conversion */
+		err = gtm_cip(mumps_call(M::M_RETRIEVE), retbuf, req->glb.c_str(), req->m_subs.c_str(),
+			      req->start.c_str(), (gtm_uint_t)CHUNK_LEN, mode);
+		if (err)
+			break;
+		if (!append_message(req, &req->start) || !fields2records(req))
+			goto done;
+		collected = true;
+		break;
+	case M::M_QUERY:
+		/* the tests and key bounds are strings to gtm, the value range is numbers */
+		for (size_t i = 0; i < req->match.size(); i++) {
+			if ((i < 4 || i > 5) && encoding_is_set()) {
+				start.clear();
+				encoding_append(utf8_to_mumps, req->match[i].data(), req->match[i].size(), start);
+				append_field(m_data, start);
+			} else {
+				append_field(m_data, req->match[i]);
+			}
+		}
+		req->bytes_in += m_data.size();
+		encoding_to_mumps(req->start, start);
+		/* walk the subtree a chunk at a time, until the limit or the end */
+		next = 0;
+		for (;;) {
+			size_t i = req->fields.size();
+			err = gtm_cip(call, retbuf, req->glb.c_str(), req->m_subs.c_str(), req->start.c_str(),
+				      (gtm_uint_t)CHUNK_LEN, m_data.c_str(),
+				      req->max ? req->max - (gtm_uint_t)next : 0, mode);
+			if (err)
+				break;
+			if (!append_message(req, &req->start))
+				goto done;
+			if (!chunk_wants_more(req, i, &next))
+				break;
+		}
+		collected = true;
+		break;
+	case M::M_LOOKUP:
+		/* the bounds are subscripts of the index */
+		encoding_to_mumps(req->lo, start);
+		encoding_to_mumps(req->hi, start);
+		encoding_to_mumps(req->start, start);
+		req->bytes_in += req->lo.size() + req->hi.size();
+		next = 0;
+		for (;;) {
+			size_t i = req->fields.size();
+			err = gtm_cip(call, retbuf, req->index.c_str(), req->lo.c_str(), req->hi.c_str(),
+				      req->start.c_str(), (gtm_uint_t)CHUNK_LEN,
+				      req->max ? req->max - (gtm_uint_t)next : 0, mode);
+			if (err)
+				break;
+			if (!append_message(req, &req->start))
+				goto done;
+			if (!chunk_wants_more(req, i, &next))
+				break;
+		}
+		collected = true;
+		break;
+	case M::M_INDEX:
+		/* a field per subscript, so a subscript of any bytes gets through */
+		for (size_t i = 0; i < req->match.size(); i++) {
+			std::string sub = req->match[i];
+			encoding_to_mumps(sub, start);
+			append_field(m_data, sub);
+		}
+		err = gtm_cip(call, retbuf, req->index.c_str(), req->glb.c_str(), m_data.c_str(),
+			      req->from_glb.c_str(), req->m_from_subs.c_str(), mode);
+		req->bytes_in += m_data.size();
+		break;
+	case M::M_REBUILD_INDEX:
+		/* a call-in per chunk of nodes, so a big global does not make one long one,
+		 * the first clears the index and number adds up the entries made
+		 */
+		req->number = 0;
+		do {
+			size_t i = req->fields.size();
+			err = gtm_cip(call, retbuf, req->index.c_str(), req->start.c_str(),
+				      (gtm_uint_t)REBUILD_NODES, mode);
+			if (err)
+				break;
+			if (!append_message(req, &req->start))
+				goto done;
+			for (; i < req->fields.size(); i++) {
+				if (req->fields[i].tag == MF_RESULT)
+					req->number += req->fields[i].number;
+			}
+		} while (!req->start.empty());
+		collected = true;
+		break;
+	case M::M_IMPORT:
+		/* written a chunk at a time, as by update */
+		req->bytes_in += req->buf_len;
+		if (!records2nodes(req))
+			goto done;
+		next = 0;
+		while (!err && next < req->ops.size()) {
+			if (!nodes2mumps_string(req, &next, m_data))
+				goto done;
+			value.address = &m_data[0];
+			value.length = m_data.size();
+			err = gtm_cip(mumps_call(M::M_UPDATE), retbuf, req->glb.c_str(), req->m_subs.c_str(),
+				      &value, mode);
+		}
+		break;
+	case M::M_GET_BUFFER:
+		/* gtm copies the value into our buffer and truncates it to the room
+		 * given, the size returned tells if it needs another go with more
+		 */
+		for (;;) {
+			char *buf = (char *)realloc(req->buf, req->buf_size);
+			if (buf == NULL) {
+				req->state = REQ_ERROR;
+				req->err_msg = strerror(ENOMEM);
+				goto done;
+			}
+			req->buf = buf;
+			value.address = req->buf;
+			value.length = req->buf_size;
+			err = gtm_cip(call, retbuf, req->glb.c_str(), req->m_subs.c_str(), &value, mode);
+			if (err)
+				break;
+			if (!append_message(req, NULL))
+				goto done;
+			collected = true;
+			req->buf_len = value.length;
+			size_t size = req->buf_len;
+			for (size_t i = 0; i < req->fields.size(); i++) {
+				if (req->fields[i].tag == MF_SIZE)
+					size = (size_t)req->fields[i].number;
+			}
+			if (size <= req->buf_size)
+				break;
+			req->buf_size = size;
+			req->ret.clear();
+			req->fields.clear();
+		}
+		break;
+	case M::M_SET_BUFFER:
+		value.address = req->buf;
+		value.length = req->buf_len;
+		err = gtm_cip(call, retbuf, req->glb.c_str(), req->m_subs.c_str(), &value, mode);
+		req->bytes_in += req->buf_len;
+		break;
+	case M::M_UPDATE:
+		/* write the nodes a chunk at a time */
+		next = 0;
+		do {
+			if (!nodes2mumps_string(req, &next, m_data))
+				goto done;
+			value.address = &m_data[0];
+			value.length = m_data.size();
+			err = gtm_cip(call, retbuf, req->glb.c_str(), req->m_subs.c_str(), &value, mode);
+			req->bytes_in += m_data.size();
+		} while (!err && next < req->ops.size());
+		break;
+	case M::M_FUNCTION:
+		if (!args2mumps_string(req, m_data))
+			goto done;
+		/* pass data to mumps function */
+		err = gtm_cip(call, retbuf, req->func.c_str(), m_data.c_str(), auto_relink, mode);
+		req->bytes_in += req->func.size() + m_data.size();
+		break;
+	case M::M_CALL:
+		/* strings are converted here, buffers go as they are */
+		for (size_t i = 0; i < req->arg_types.size(); i++) {
+			std::string &arg = req->func_args[i];
+			if (req->arg_types[i] == 'b')
+				continue;
+			if (req->arg_types[i] == 's' && encoding_is_set() &&
+			    !(encoding_ascii && iconvm_is_ascii(arg.data(), arg.size()))) {
+				m_data.clear();
+				encoding_append(utf8_to_mumps, arg.data(), arg.size(), m_data);
+				arg.swap(m_data);
+			}
+			req->call_args[i].address = (gtm_char_t *)arg.data();
+			req->call_args[i].length = arg.size();
+			req->bytes_in += arg.size();
+		}
+		for (size_t i = req->arg_types.size(); i < CALL_ARGS_MAX; i++) {
+			req->call_args[i].address = NULL;
+			req->call_args[i].length = 0;
+		}
+		err = gtm_cip(call, retbuf, req->func.c_str(), req->arg_types.c_str(),
+			      &req->call_args[0], &req->call_args[1], &req->call_args[2], &req->call_args[3],
+			      &req->call_args[4], &req->call_args[5], &req->call_args[6], &req->call_args[7], mode);
+		break;
+	case M::M_GLOBAL_DIRECTORY:
+		err = gtm_cip(call, retbuf, req->max, req->lo.c_str(), req->hi.c_str());
+		break;
+	case M::M_INCREMENT:
+		err = gtm_cip(call, retbuf, req->glb.c_str(), req->m_subs.c_str(), req->number, mode);
+		break;
+	/* the numbers go and come back as doubles, there is no message to read */
+	case M::M_GET_NUMBER:
+		err = gtm_cip(call, req->glb.c_str(), req->m_subs.c_str(), &req->number, &req->defined, mode);
+		collected = true;
+		break;
+	case M::M_INCREMENT_NUMBER:
+		err = gtm_cip(call, req->glb.c_str(), req->m_subs.c_str(), req->number, &req->number, mode);
+		collected = true;
+		break;
+	case M::M_SET_NUMBER:
+		err = gtm_cip(call, req->glb.c_str(), req->m_subs.c_str(), req->number, mode);
+		collected = true;
+		break;
+	case M::M_ORDER_PAGE:
+		err = gtm_cip(call, retbuf, req->glb.c_str(), req->m_subs.c_str(), req->max,
+					     (gtm_uint_t)CHUNK_LEN, req->direction, (gtm_uint_t)req->values, mode);
+		break;
+	case M::M_PARTITION:
+		err = gtm_cip(call, retbuf, req->glb.c_str(), req->m_subs.c_str(), req->max, mode);
+		break;
+	case M::M_MERGE:
+		/* merge^v4wNode takes the source first */
+		err = gtm_cip(call, retbuf, req->from_glb.c_str(), req->m_from_subs.c_str(),
+					     req->glb.c_str(), req->m_subs.c_str(), mode);
+		break;
+	case M::M_SET:
+		if (!data2mumps_string(req, req->data, req->data_is_string, m_data))
+			goto done;
+		/* passed with its length, so a NUL in the data is kept */
+		value.address = &m_data[0];
+		value.length = m_data.size();
+		err = gtm_cip(call, retbuf, req->glb.c_str(), req->m_subs.c_str(), &value, mode);
+		req->bytes_in += m_data.size();
+		break;
+	case M::M_BATCH:
+		if (!ops2mumps_string(req, m_data))
+			goto done;
+		value.address = &m_data[0];
+		value.length = m_data.size();
+		err = gtm_cip(call, retbuf, &value, (gtm_uint_t)req->transaction, mode);
+		req->bytes_in += m_data.size();
+		break;
+	case M::M_TCOMMIT:
+		if (!ops2mumps_string(req, m_data))
+			goto done;
+		value.address = &m_data[0];
+		value.length = m_data.size();
+		err = gtm_cip(call, retbuf, &value, mode);
+		req->bytes_in += m_data.size();
+		break;
+	case M::M_VERSION:
+		err = gtm_cip(call, retbuf, NULL);
+		break;
+	/* previous_node, not implemented yet */
+	default:
+		goto done;
+	}
+	if (stats_enabled)
+		called = uv_hrtime();
+
+	if (err) {
+		gtm_failed(req);
+		goto done;
+	}
+	if (req->function == M::M_VERSION) {
+		req->ret = retbuf;
+		goto done;
+	}
+	/* retrieve and getBuffer have collected their results already */
+	if (!collected && !append_message(req, NULL))
+		goto done;
+	/* tcommit rolled back as a node read by the transaction had changed */
+	if (req->function == M::M_TCOMMIT && req->fields.size() > 1 &&
+	    req->fields[0].tag == MF_OK && req->fields[0].number == 0) {
+		req->state = REQ_RESTART;
+		req->err_msg.assign(req->ret, req->fields[1].offset, req->fields[1].length);
+		goto done;
+	}
+	if (req->function == M::M_INDEX)
+		index_declared(req);
+	/* convert returned data back to utf8 */
+	if ((req->function == M::M_GET || req->function == M::M_FUNCTION || req->function == M::M_CALL ||
+	     req->function == M::M_BATCH || req->function == M::M_RETRIEVE || req->function == M::M_QUERY ||
+	     req->function == M::M_LOOKUP || req->function == M::M_ORDER_PAGE ||
+	     req->function == M::M_PARTITION) && encoding_is_set())
+		mumps2utf8(req);
+done:
+	/* still under the lock, so the cache follows the order of the call-ins */
+	if (mcache_enabled())
+		cache_update(req);
+	gtm_unlock();
+	if (stats_enabled) {
+		uint64_t end = uv_hrtime();
+		if (called == 0)
+			called = end;
+		req->t_call_in = called - began;
+		req->t_decode = end - called;
+	}
+}
+
+/* property names of the result fields, indexed by tag */
+static Persistent<String> field_names[128];
+
+static void init_field_names(void)
+{
+#define SET_FIELD_NAME(tag, name) \
+	field_names[(unsigned char)(tag)] = Persistent<String>::New(String::NewSymbol(name));
+	SET_FIELD_NAME(MF_OK, "ok");
+	SET_FIELD_NAME(MF_GLOBAL, "global");
+	SET_FIELD_NAME(MF_DATA, "data");
+	SET_FIELD_NAME(MF_DEFINED, "defined");
+	SET_FIELD_NAME(MF_RESULT, "result");
+	SET_FIELD_NAME(MF_FUNCTION, "function");
+	SET_FIELD_NAME(MF_ERROR_MESSAGE, "errorMessage");
+	SET_FIELD_NAME(MF_SUBSCRIPT, "subscripts");
+#undef SET_FIELD_NAME
+}
+
+static inline Local<Value> field2js(const std::string &msg, const mfield &f)
+{
+	if (f.type == MF_NUMBER)
+		return Number::New(f.number);
+	return String::New(msg.data() + f.offset, f.length);
+}
+
+/* collect the repeated fields with `tag' into an array */
+static Local<Array> fields2js_array(gtm_req *req, char tag)
+{
+	HandleScope scope;
+	Local<Array> arr = Array::New();
+	uint32_t n = 0;
+
+	for (size_t i = 0; i < req->fields.size(); i++) {
+		if (req->fields[i].tag == tag)
+			arr->Set(n++, field2js(req->ret, req->fields[i]));
+	}
+	return scope.Close(arr);
+}
+
+/* make an object of the decoded result fields in [begin, end),
+ * subscripts are gathered into an array
+ */
+static Local<Object> fields2js_object(gtm_req *req, size_t begin, size_t end)
+{
+	HandleScope scope;
+	Local<Object> obj = Object::New();
+	Local<Array> subs;
+	uint32_t n = 0;
+
+	for (size_t i = begin; i < end; i++) {
+		const mfield &f = req->fields[i];
+		unsigned char tag = (unsigned char)f.tag;
+
+		/* nested messages are built by their own callers */
+		if (f.type == MF_MESSAGE) {
+			i += f.count;
+			continue;
+		}
+		if (f.tag == MF_SUBSCRIPT) {
+			if (subs.IsEmpty())
+				subs = Array::New();
+			subs->Set(n++, field2js(req->ret, f));
+		} else if (tag < 128 && !field_names[tag].IsEmpty()) {
+			obj->Set(field_names[tag], field2js(req->ret, f));
+		}
+	}
+	if (!subs.IsEmpty())
+		obj->Set(field_names[MF_SUBSCRIPT], subs);
+	return scope.Close(obj);
+}
+
+/* a batch returns one nested message per operation */
+static Local<Array> batch2js_array(gtm_req *req)
+{
+	HandleScope scope;
+	Local<Array> arr = Array::New();
+	Handle<Array> js_ops = Handle<Array>::Cast(req->js_ops);
+	uint32_t n = 0;
+
+	for (size_t i = 0; i < req->fields.size(); i++) {
+		const mfield &f = req->fields[i];
+
+		if (f.tag != MF_LIST || f.type != MF_MESSAGE)
+			continue;
+		Local<Object> obj = fields2js_object(req, i + 1, i + 1 + f.count);
+		if (n < js_ops->Length()) {
+			Local<Value> subs = js_ops->Get(n)->ToObject()->Get(field_names[MF_SUBSCRIPT]);
+			if (!subs->IsUndefined())
+				obj->Set(field_names[MF_SUBSCRIPT], subs);
+		}
+		arr->Set(n++, obj);
+		i += f.count;
+	}
+	return scope.Close(arr);
+}
+
+/* release the bytes of a Buffer made by buf2js_buffer */
+static void free_buffer(char *data, void *hint)
+{
+	free(data);
+}
+
+/* hand the bytes gtm wrote over to a Buffer, without copying them */
+static Local<Object> buf2js_buffer(gtm_req *req)
+{
+	HandleScope scope;
+	Buffer *buf;
+
+	if (req->buf_len == 0) {
+		buf = Buffer::New(0);
+	} else {
+		buf = Buffer::New(req->buf, req->buf_len, free_buffer, NULL);
+		req->buf = NULL;
+	}
+	return scope.Close(Local<Object>::New(buf->handle_));
+}
+
+/* rebuild the tree returned by retrieve, one nested message per node
+ * with its subscripts below the root and its data
+ */
+static Local<Object> retrieve2js_object(gtm_req *req)
+{
+	HandleScope scope;
+	Local<Object> root = Object::New();
+	Local<String> empty = String::Empty();
+
+	for (size_t i = 0; i < req->fields.size(); i++) {
+		const mfield &f = req->fields[i];
+		size_t end = i + 1 + f.count;
+		Local<Object> obj = root;
+		Local<Value> key = empty;
+		Local<Value> data;
+		bool first = true;
+
+		if (f.tag != MF_LIST || f.type != MF_MESSAGE)
+			continue;
+		for (size_t j = i + 1; j < end; j++) {
+			const mfield &n = req->fields[j];
+
+			if (n.tag == MF_DATA) {
+				data = field2js(req->ret, n);
+				continue;
+			}
+			if (n.tag != MF_SUBSCRIPT)
+				continue;
+			/* step down to the parent of this subscript */
+			if (!first) {
+				Local<Value> child = obj->Get(key);
+				if (!child->IsObject()) {
+					Local<Object> tmp = Object::New();
+					/* the parent had data of its own */
+					if (!child->IsUndefined())
+						tmp->Set(empty, child);
+					obj->Set(key, tmp);
+					child = tmp;
+				}
+				obj = Local<Object>::Cast(child);
+			}
+			key = field2js(req->ret, n);
+			first = false;
+		}
+		if (data.IsEmpty())
+			data = empty;
+		Local<Value> prev = obj->Get(key);
+		if (prev->IsObject())
+			Local<Object>::Cast(prev)->Set(empty, data);
+		else
+			obj->Set(key, data);
+		i = end - 1;
+	}
+	return scope.Close(root);
+}
+
+/* the matches of a query as {subscripts, data}, the subscripts from the
+ * global down, those of the queried node first
+ */
+static Local<Array> query2js_array(gtm_req *req)
+{
+	HandleScope scope;
+	Local<Array> results = Array::New();
+	Local<Array> root;
+	uint32_t n = 0;
+
+	if (req->has_subs && req->js_subs->IsArray())
+		root = Local<Array>::Cast(Local<Value>::New(req->js_subs));
+	for (size_t i = 0; i < req->fields.size(); i++) {
+		const mfield &f = req->fields[i];
+		size_t end = i + 1 + f.count;
+		Local<Object> match;
+		Local<Array> subs;
+		uint32_t k = 0;
+
+		if (f.tag != MF_LIST || f.type != MF_MESSAGE)
+			continue;
+		match = Object::New();
+		subs = Array::New();
+		if (!root.IsEmpty()) {
+			for (; k < root->Length(); k++)
+				subs->Set(k, root->Get(k));
+		}
+		for (size_t j = i + 1; j < end; j++) {
+			const mfield &m = req->fields[j];
+			if (m.tag == MF_SUBSCRIPT)
+				subs->Set(k++, field2js(req->ret, m));
+			else if (m.tag == MF_DATA)
+				match->Set(field_names[MF_DATA], field2js(req->ret, m));
+		}
+		match->Set(field_names[MF_SUBSCRIPT], subs);
+		results->Set(n++, match);
+		i = end - 1;
+	}
+	return scope.Close(results);
+}
+
+/* make the javascript result of a finished request, runs on the main thread,
+ * req->state is REQ_EXCEPTION when the returned value is an Error to throw
+ */
+static Handle<Value> gtm_build(gtm_req *req)
+{
+	HandleScope scope;
+	Local<Object> err_obj = Object::New();
+
+	switch (req->state) {
+	case REQ_OK:
+		break;
+	case REQ_CLOSED:
+		if (req->function == M::M_VERSION)
+			return scope.Close(String::New("Node.js Adaptor for GT.M"));
+		setOk(err_obj, 0);
+		setErrorMessage(err_obj, "Gtm is closed");
+		return scope.Close(err_obj);
+	case REQ_GTM_ERROR:
+		setOk(err_obj, 0);
+		setErrorCode(err_obj, req->err_code);
+		setErrorMessage(err_obj, req->err_msg.c_str());
+		return scope.Close(err_obj);
+	case REQ_ERROR:
+	case REQ_RESTART:
+		setOk(err_obj, 0);
+		setErrorMessage(err_obj, req->err_msg.c_str());
+		return scope.Close(err_obj);
+	case REQ_EXCEPTION:
+		return scope.Close(Exception::Error(String::New(req->err_msg.c_str())));
+	}
+
+	switch (req->function) {
+	case M::M_VERSION:
+		return scope.Close(String::New(req->ret.c_str()));
+	case M::M_PREVIOUS_NODE:
+		return scope.Close(Undefined());
+	case M::M_NEXT_NODE:
+		/* the subscripts are those of the node found */
+		return scope.Close(fields2js_object(req, 0, req->fields.size()));
+	case M::M_GLOBAL_DIRECTORY:
+		return scope.Close(fields2js_array(req, MF_LIST));
+	case M::M_BATCH:
+		return scope.Close(batch2js_array(req));
+	case M::M_EXPORT:
+		{
+			Local<Object> ret_obj = Object::New();
+			setOk(ret_obj, 1);
+			ret_obj->Set(field_names[MF_DATA], buf2js_buffer(req));
+			/* the last chunk has no next */
+			if (!req->start.empty())
+				ret_obj->Set(String::NewSymbol("next"), Local<Object>::New(
+					     Buffer::New(req->start.data(), req->start.size())->handle_));
+			return scope.Close(ret_obj);
+		}
+	case M::M_LOOKUP:
+	case M::M_QUERY:
+		{
+			Local<Object> ret_obj = fields2js_object(req, 0, req->fields.size());
+			ret_obj->Set(String::NewSymbol("results"), query2js_array(req));
+			/* stopped at the limit, the same call from next gives the rest */
+			if (!req->start.empty()) {
+				for (size_t i = req->fields.size(); i-- > 0;) {
+					if (req->fields[i].tag == MF_CONTINUE) {
+						ret_obj->Set(String::NewSymbol("next"), field2js(req->ret, req->fields[i]));
+						break;
+					}
+				}
+			}
+			return scope.Close(ret_obj);
+		}
+	case M::M_REBUILD_INDEX:
+		{
+			Local<Object> ret_obj = fields2js_object(req, 0, req->fields.size());
+			/* the entries made by every chunk */
+			if (ret_obj->Get(field_names[MF_OK])->NumberValue() == 1)
+				setResult(ret_obj, Number::New(req->number));
+			return scope.Close(ret_obj);
+		}
+	case M::M_GET_NUMBER:
+		if (!req->defined)
+			return scope.Close(Undefined());
+		return scope.Close(Number::New(req->number));
+	case M::M_INCREMENT_NUMBER:
+		return scope.Close(Number::New(req->number));
+	case M::M_SET_NUMBER:
+		return scope.Close(Undefined());
+	default:
+		break;
+	}
+
+	Local<Object> ret_obj = fields2js_object(req, 0, req->fields.size());
+
+	/* a held increment has no value yet */
+	if (req->held)
+		ret_obj->Set(String::NewSymbol("held"), True());
+
+	if (req->function == M::M_RETRIEVE)
+		ret_obj->Set(String::NewSymbol("object"), retrieve2js_object(req));
+
+	if (req->function == M::M_GET_BUFFER)
+		ret_obj->Set(field_names[MF_DATA], buf2js_buffer(req));
+
+	/* the first keys of every partition but the first, and how many keys there are */
+	if (req->function == M::M_PARTITION) {
+		ret_obj->Set(String::NewSymbol("keys"), ret_obj->Get(field_names[MF_RESULT]));
+		setResult(ret_obj, fields2js_array(req, MF_LIST));
+	}
+
+	if (req->function == M::M_FUNCTION) {
+		ret_obj->Set(String::New("arguments"), req->js_func_args);
+		return scope.Close(ret_obj);
+	}
+	/* if no subs specified just return object */
+	if (!req->has_subs)
+		return scope.Close(ret_obj);
+	/* add subs to object */
+	Handle<Array> js_subs = Handle<Array>::Cast(req->js_subs);
+	/* order and previous step the last subscript in place */
+	if (req->function == M::M_ORDER || req->function == M::M_PREVIOUS)
+		js_subs->Set(Number::New(js_subs->Length() - 1), ret_obj->Get(field_names[MF_RESULT]));
+	ret_obj->Set(field_names[MF_SUBSCRIPT], js_subs);
+	return scope.Close(ret_obj);
+}
+
+/* account for a finished request, main thread only */
+static void stats_record(gtm_req *req, uint64_t decode)
+{
+	struct mstats_op *op = &op_stats[(int)req->function];
+
+	op->calls++;
+	if (req->state != REQ_OK)
+		op->errors++;
+	op->bytes_in += req->bytes_in;
+	op->bytes_out += req->ret.size() + (req->function == M::M_GET_BUFFER ? req->buf_len : 0);
+	mstats_hist_add(&op->marshal, req->t_marshal);
+	mstats_hist_add(&op->call_in, req->t_call_in);
+	mstats_hist_add(&op->decode, req->t_decode + decode);
+
+	/* how long locks were waited for, and if they were had */
+	if ((req->function == M::M_LOCK || req->function == M::M_LOCK_LIST) && req->state == REQ_OK) {
+		for (size_t i = 0; i < req->fields.size(); i++) {
+			const mfield &f = req->fields[i];
+			if (f.tag != MF_RESULT)
+				continue;
+			if (req->ret.compare(f.offset, f.length, "1") == 0)
+				lock_stats.acquired++;
+			else
+				lock_stats.timed_out++;
+		}
+		mstats_hist_add(&lock_stats.wait, req->t_call_in);
+	}
+}
+
+/* make the javascript result and account for the request */
+static Handle<Value> gtm_result(gtm_req *req)
+{
+	uint64_t start = stats_enabled ? uv_hrtime() : 0;
+	Handle<Value> ret = gtm_build(req);
+
+	if (stats_enabled)
+		stats_record(req, uv_hrtime() - start);
+	return ret;
+}
+
+/* finished requests are kept for reuse, so that their strings and
+ * vectors keep the room they grew to, only touched on the main thread
+ */
+#define REQ_POOL_MAX	16
+
+static gtm_req *req_pool[REQ_POOL_MAX];
+static int req_pool_len;
+
+static void gtm_req_free(gtm_req *req)
+{
+	req->js_subs.Dispose();
+	req->js_func_args.Dispose();
+	req->js_ops.Dispose();
+	req->js_buf.Dispose();
+	req->callback.Dispose();
+	/* the read buffer is still ours unless it went into a Buffer */
+	if (req->function == M::M_GET_BUFFER || req->function == M::M_EXPORT)
+		free(req->buf);
+	/* do not hold on to the room of a big result */
+	if (req_pool_len == REQ_POOL_MAX || req->ret.capacity() > BUF_LEN_MAX ||
+	    req->ops.capacity() > BUF_LEN) {
+		delete req;
+		return;
+	}
+	req->js_subs.Clear();
+	req->js_func_args.Clear();
+	req->js_ops.Clear();
+	req->js_buf.Clear();
+	req->callback.Clear();
+	req_pool[req_pool_len++] = req;
+}
+
+static gtm_req *gtm_req_new(M function)
+{
+	gtm_req *req;
+
+	if (req_pool_len > 0) {
+		req = req_pool[--req_pool_len];
+		req->glb.clear();
+		req->subs.clear();
+		req->m_subs.clear();
+		req->from_glb.clear();
+		req->m_from_subs.clear();
+		req->data.clear();
+		req->func.clear();
+		req->func_args.clear();
+		req->arg_types.clear();
+		req->lo.clear();
+		req->hi.clear();
+		req->ops.clear();
+		req->start.clear();
+		req->match.clear();
+		req->index.clear();
+		req->err_msg.clear();
+		req->ret.clear();
+		req->fields.clear();
+	} else {
+		req = new gtm_req();
+	}
+	req->work.next = NULL;
+	req->function = function;
+	req->t_marshal = 0;
+	req->t_call_in = 0;
+	req->t_decode = 0;
+	req->bytes_in = 0;
+	req->has_subs = false;
+	req->data_is_string = false;
+	req->number = 0;
+	req->defined = 0;
+	req->direction = 1;
+	req->values = false;
+	req->max = 0;
+	req->transaction = false;
+	req->held = false;
+	req->buf = NULL;
+	req->buf_len = 0;
+	req->buf_size = 0;
+	req->state = REQ_OK;
+	req->err_code = 0;
+	return req;
+}
+
+static void gtm_async_exec(struct gtm_work *work)
+{
+	gtm_exec((gtm_req *)work);
+}
+
+static void gtm_async_done(struct gtm_work *work)
+{
+	HandleScope scope;
+	gtm_req *req = (gtm_req *)work;
+	Handle<Value> argv[2];
+
+	Handle<Value> ret = gtm_result(req);
+	/* node style callback(error, result) */
+	if (req->state == REQ_OK) {
+		argv[0] = Null();
+		argv[1] = ret;
+	} else {
+		argv[0] = ret;
+		argv[1] = Undefined();
+	}
+	TryCatch try_catch;
+	req->callback->Call(Context::GetCurrent()->Global(), 2, argv);
+	gtm_req_free(req);
+	if (try_catch.HasCaught())
+		FatalException(try_catch);
+}
+
+/* the calls a transaction holds or checks, the others go to gtm as usual */
+static inline bool tp_handles(M function)
+{
+	return function == M::M_GET || function == M::M_INCREMENT ||
+	       function == M::M_KILL || function == M::M_SET ||
+	       function == M::M_GET_NUMBER || function == M::M_INCREMENT_NUMBER ||
+	       function == M::M_SET_NUMBER;
+}
+
+static inline bool same_global(const std::string &a, const std::string &b)
+{
+	size_t i = !a.empty() && a[0] == '^', j = !b.empty() && b[0] == '^';
+
+	return a.compare(i, std::string::npos, b, j, std::string::npos) == 0;
+}
+
+/* the calls that write the database some other way, a transaction
+ * could not roll them back and would make them again on a retry
+ */
+static inline bool tp_refuses(M function)
+{
+	return function == M::M_BATCH || function == M::M_FUNCTION ||
+	       function == M::M_IMPORT || function == M::M_INDEX ||
+	       function == M::M_MERGE || function == M::M_REBUILD_INDEX ||
+	       function == M::M_SET_BUFFER || function == M::M_UPDATE;
+}
+
+/* the subscripts of a request as a key, a quoted canonic number
+ * is unquoted since "1" and 1 are the same node to M
+ */
+static void subs_key(const std::string &m_subs, std::string &key)
+{
+	char num[32];
+	size_t pos = 0;
+
+	key.clear();
+	while (pos < m_subs.size()) {
+		size_t len = strtoul(m_subs.c_str() + pos, NULL, 10);
+		const char *sub = m_subs.data() + m_subs.find(':', pos) + 1;
+
+		if (len > 2 && sub[0] == '"' && mproto_canonic(sub + 1, len - 2)) {
+			snprintf(num, sizeof(num), "%zu:", len - 2);
+			key += num;
+			key.append(sub + 1, len - 2);
+		} else {
+			key.append(m_subs, pos, sub + len - m_subs.data() - pos);
+		}
+		pos = sub + len - m_subs.data();
+		if (pos < m_subs.size()) {
+			key += ',';
+			pos++;
+		}
+	}
+}
+
+/* the last write of the transaction to the node of req, or NULL */
+static const batch_op *tp_lookup(gtm_req *req)
+{
+	std::string key, op_key;
+
+	subs_key(req->m_subs, key);
+	for (size_t i = txn.ops.size(); i-- > 0;) {
+		const batch_op &op = txn.ops[i];
+
+		if (!same_global(op.glb, req->glb) || (op.op != "set" && op.op != "kill"))
+			continue;
+		subs_key(op.m_subs, op_key);
+		if (op.op == "set" && op_key == key)
+			return &op;
+		/* a kill takes the whole subtree */
+		if (op.op == "kill" && (op_key.empty() ||
+		    (key.compare(0, op_key.size(), op_key) == 0 &&
+		     (key.size() == op_key.size() || key[op_key.size()] == ','))))
+			return &op;
+	}
+	return NULL;
+}
+
+static void tp_queue(gtm_req *req, const char *name, const std::string &data, bool is_string)
+{
+	txn.ops.push_back(batch_op());
+	batch_op &op = txn.ops.back();
+
+	op.op = name;
+	op.glb = req->glb;
+	op.m_subs = req->m_subs;
+	op.data = data;
+	op.data_is_string = is_string;
+}
+
+/* answer a request from the transaction with what its call-in would return */
+static void tp_reply(gtm_req *req, char type, const std::string &data, bool defined)
+{
+	std::string glb(req->glb, !req->glb.empty() && req->glb[0] == '^', std::string::npos);
+	char num[32];
+
+	req->ret.clear();
+	req->ret += "on1:1";
+	snprintf(num, sizeof(num), "gs%zu:", glb.size());
+	req->ret += num;
+	req->ret += glb;
+	if (type) {
+		snprintf(num, sizeof(num), "d%c%zu:", type, data.size());
+		req->ret += num;
+		req->ret += data;
+	}
+	/* increment^v4wNode gives its data and no result */
+	if (req->function == M::M_GET)
+		req->ret += defined ? "Dn1:1" : "Dn1:0";
+	else if (req->function != M::M_INCREMENT)
+		req->ret += "rs1:0";
+	if (!mproto_decode(req->ret.data(), req->ret.size(), req->fields)) {
+		req->state = REQ_EXCEPTION;
+		req->err_msg = "Invalid result from GT.M";
+	}
+}
+
+/* read a node inside a transaction, the value it had is checked at commit */
+static void tp_read(gtm_req *req, std::string &data, bool &defined)
+{
+	const batch_op *op = tp_lookup(req);
+	M function = req->function;
+
+	if (op != NULL) {
+		defined = op->op == "set";
+		data = defined ? op->data : std::string();
+		return;
+	}
+	req->function = M::M_GET;
+	req->transaction = true;
+	gtm_exec(req);
+	req->function = function;
+	data.clear();
+	defined = false;
+	if (req->state != REQ_OK)
+		return;
+	for (size_t i = 0; i < req->fields.size(); i++) {
+		const mfield &f = req->fields[i];
+		if (f.tag == MF_DATA)
+			data.assign(req->ret, f.offset, f.length);
+		else if (f.tag == MF_DEFINED)
+			defined = f.number != 0;
+	}
+	tp_queue(req, defined ? "check" : "absent", data, true);
+}
+
+/* run a get, set, kill or increment, or one of their number calls,
+ * inside the open transaction
+ */
+static void tp_exec(gtm_req *req)
+{
+	std::string data;
+	bool defined;
+
+	switch (req->function) {
+	case M::M_GET:
+		tp_read(req, data, defined);
+		if (req->state != REQ_OK)
+			return;
+		tp_reply(req, mode != MODE_STRICT && mproto_canonic(data.data(), data.size()) ?
+			 MF_NUMBER : MF_STRING, data, defined);
+		break;
+	case M::M_GET_NUMBER:
+		tp_read(req, data, defined);
+		if (req->state != REQ_OK)
+			return;
+		req->number = strtod(data.c_str(), NULL);
+		req->defined = defined;
+		break;
+	case M::M_INCREMENT:
+	case M::M_INCREMENT_NUMBER:
+		tp_read(req, data, defined);
+		if (req->state != REQ_OK)
+			return;
+		req->number += strtod(data.c_str(), NULL);
+		double2mumps(req->number, data);
+		tp_queue(req, "set", data, false);
+		if (req->function == M::M_INCREMENT)
+			tp_reply(req, MF_STRING, data, true);
+		break;
+	case M::M_SET_NUMBER:
+		double2mumps(req->number, data);
+		tp_queue(req, "set", data, false);
+		break;
+	case M::M_KILL:
+		tp_queue(req, "kill", std::string(), false);
+		tp_reply(req, 0, std::string(), false);
+		break;
+	case M::M_SET:
+		data = req->data;
+		if (!req->data_is_string)
+			num2mumps(data);
+		tp_queue(req, "set", data, req->data_is_string);
+		tp_reply(req, MF_STRING, data, true);
+		break;
+	default:
+		break;
+	}
+}
+
+/* make the writes of the outermost transaction, it is closed either way */
+static gtm_req *tp_commit(void)
+{
+	gtm_req *req = gtm_req_new(M::M_TCOMMIT);
+
+	req->ops.swap(txn.ops);
+	txn.level = 0;
+	txn.ops.clear();
+	gtm_exec(req);
+	return req;
+}
+
+/* the result of a finished request, which is freed, an error is thrown */
+static Handle<Value> gtm_reply(gtm_req *req)
+{
+	HandleScope scope;
+	Handle<Value> ret = gtm_result(req);
+
+	if (req->state == REQ_EXCEPTION) {
+		gtm_req_free(req);
+		ThrowException(ret);
+		return scope.Close(Undefined());
+	}
+	gtm_req_free(req);
+	return scope.Close(ret);
+}
+
+/* make the call-in of a marshalled request, on the worker thread
+ * when there is a callback
+ */
+static Handle<Value> gtm_run(gtm_req *req, Local<Function> callback)
+{
+	HandleScope scope;
+
+	if (!callback.IsEmpty()) {
+		req->callback = Persistent<Function>::New(callback);
+		req->work.exec = gtm_async_exec;
+		req->work.done = gtm_async_done;
+		gtm_worker_submit(&req->work);
+		return scope.Close(Undefined());
+	}
+	gtm_exec(req);
+	return scope.Close(gtm_reply(req));
+}
+
+/* the calls write-behind holds, the others make the held writes first */
+static inline bool wb_handles(M function)
+{
+	return function == M::M_SET || function == M::M_KILL || function == M::M_INCREMENT;
+}
+
+/* the name and subscripts of a node, a canonic number quoted or not
+ * is the same subscript to M and so the same key here
+ */
+static void wb_key(const std::string &glb, const std::string &m_subs, std::string &key)
+{
+	std::string subs;
+
+	subs_key(m_subs, subs);
+	key = glb_name(glb);
+	key += '(';
+	key += subs;
+}
+
+/* drop the node of `key' and the nodes below it, tell how many there were */
+static size_t wb_drop(std::map<std::string, wb_write> &held, const std::string &key)
+{
+	std::string below = key[key.size() - 1] == '(' ? key : key + ",";
+	std::map<std::string, wb_write>::iterator it = held.lower_bound(key), end;
+	size_t n = 0;
+
+	for (end = it; end != held.end(); ++end, n++) {
+		if (end->first != key && end->first.compare(0, below.size(), below) != 0)
+			break;
+	}
+	held.erase(it, end);
+	return n;
+}
+
+/* the held writes as batch requests of about CHUNK_LEN bytes each,
+ * the kills go first as no write is held below a later kill
+ */
+static void wb_batches(std::vector<gtm_req *> &reqs)
+{
+	std::map<std::string, wb_write> *held[2] = {&wb.kills, &wb.writes};
+	size_t len = CHUNK_LEN;
+
+	for (int i = 0; i < 2; i++) {
+		std::map<std::string, wb_write>::iterator it;
+
+		for (it = held[i]->begin(); it != held[i]->end(); ++it) {
+			const wb_write &w = it->second;
+
+			if (len >= CHUNK_LEN) {
+				reqs.push_back(gtm_req_new(M::M_BATCH));
+				len = 0;
+			}
+			std::vector<batch_op> &ops = reqs.back()->ops;
+			if (i == 0 || w.set) {
+				ops.push_back(batch_op());
+				ops.back().op = i == 0 ? "kill" : "set";
+				ops.back().glb = w.glb;
+				ops.back().m_subs = w.m_subs;
+				ops.back().data = w.data;
+				ops.back().data_is_string = w.data_is_string;
+				len += w.glb.size() + w.m_subs.size() + w.data.size() + 16;
+			}
+			if (i == 1 && (w.increment != 0 || !w.set)) {
+				ops.push_back(batch_op());
+				ops.back().op = "increment";
+				ops.back().glb = w.glb;
+				ops.back().m_subs = w.m_subs;
+				double2mumps(w.increment, ops.back().data);
+				ops.back().data_is_string = false;
+				len += w.glb.size() + w.m_subs.size() + 48;
+			}
+		}
+		held[i]->clear();
+	}
+	if (wb.timing) {
+		uv_timer_stop(&wb.timer);
+		wb.timing = false;
+	}
+}
+
+/* count the operations of a flush, and the ones that failed */
+static void wb_account(gtm_req *req)
+{
+	wb.flushes++;
+	wb.ops += req->ops.size();
+	if (req->state != REQ_OK) {
+		wb.errors += req->ops.size();
+		wb.error = req->err_msg;
+	} else {
+		for (size_t i = 0; i < req->fields.size(); i++) {
+			const mfield &f = req->fields[i];
+			if (f.tag == MF_OK && f.type == MF_NUMBER && f.number == 0)
+				wb.errors++;
+			else if (f.tag == MF_ERROR_MESSAGE)
+				wb.error.assign(req->ret, f.offset, f.length);
+		}
+	}
+	if (stats_enabled)
+		stats_record(req, 0);
+}
+
+/* {ok: 1, result: operations} of a flush, or the failure of any flush since the last one told */
+static Local<Object> wb_flushed(double ops)
+{
+	HandleScope scope;
+	Local<Object> res = Object::New();
+
+	if (!wb.error.empty()) {
+		setOk(res, 0);
+		setErrorMessage(res, wb.error.c_str());
+		wb.error.clear();
+	} else {
+		setOk(res, 1);
+		setResult(res, Number::New(ops));
+	}
+	return scope.Close(res);
+}
+
+static void wb_async_done(struct gtm_work *work)
+{
+	HandleScope scope;
+	gtm_req *req = (gtm_req *)work;
+	Handle<Value> argv[2];
+
+	wb.inflight--;
+	wb_account(req);
+	if (req->callback.IsEmpty()) {
+		gtm_req_free(req);
+		return;
+	}
+
+	Local<Object> res = wb_flushed(req->number);
+	if (res->Get(String::New("ok"))->BooleanValue()) {
+		argv[0] = Null();
+		argv[1] = res;
+	} else {
+		argv[0] = res;
+		argv[1] = Undefined();
+	}
+	TryCatch try_catch;
+	req->callback->Call(Context::GetCurrent()->Global(), 2, argv);
+	gtm_req_free(req);
+	if (try_catch.HasCaught())
+		FatalException(try_catch);
+}
+
+/* make the held writes on the worker thread, the callback, if any,
+ * is called when they and everything queued before them are made
+ */
+static void wb_flush_async(Local<Function> callback)
+{
+	std::vector<gtm_req *> reqs;
+	size_t ops = 0;
+
+	wb_batches(reqs);
+	if (reqs.empty() && !callback.IsEmpty())
+		reqs.push_back(gtm_req_new(M::M_BATCH));
+	for (size_t i = 0; i < reqs.size(); i++) {
+		gtm_req *req = reqs[i];
+
+		ops += req->ops.size();
+		if (i == reqs.size() - 1 && !callback.IsEmpty()) {
+			req->callback = Persistent<Function>::New(callback);
+			req->number = ops;
+		}
+		req->work.exec = gtm_async_exec;
+		req->work.done = wb_async_done;
+		wb.inflight++;
+		gtm_worker_submit(&req->work);
+	}
+}
+
+/* make the held writes here and now, after those on the way,
+ * tell how many operations it took
+ */
+static size_t wb_flush_sync(void)
+{
+	std::vector<gtm_req *> reqs;
+	size_t ops = 0;
+
+	if (wb.inflight > 0)
+		gtm_worker_stop();
+	wb_batches(reqs);
+	for (size_t i = 0; i < reqs.size(); i++) {
+		gtm_exec(reqs[i]);
+		wb_account(reqs[i]);
+		ops += reqs[i]->ops.size();
+		gtm_req_free(reqs[i]);
+	}
+	return ops;
+}
+
+static void wb_timer_cb(uv_timer_t *handle, int status)
+{
+	HandleScope scope;
+
+	wb.timing = false;
+	wb_flush_async(Local<Function>());
+}
+
+/* a write that was held is called back on a later turn of the loop */
+static void wb_defer_cb(uv_timer_t *handle, int status)
+{
+	std::vector<gtm_req *> replies;
+
+	wb.deferring = false;
+	replies.swap(wb.replies);
+	for (size_t i = 0; i < replies.size(); i++)
+		gtm_async_done(&replies[i]->work);
+}
+
+/* make the held writes before a call that is not held, on the worker
+ * thread ahead of an asynchronous one or right away for the others
+ */
+static void wb_settle(bool async)
+{
+	if (wb.writes.empty() && wb.kills.empty() && (async || wb.inflight == 0))
+		return;
+	if (async)
+		wb_flush_async(Local<Function>());
+	else
+		wb_flush_sync();
+}
+
+/* hold a set, kill or increment and answer it as the call-in would,
+ * a held increment does not know the new value, it gives no data and
+ * no result but held: true
+ */
+static Handle<Value> wb_hold(gtm_req *req, Local<Function> callback)
+{
+	HandleScope scope;
+	std::string key, data;
+	size_t n;
+
+	wb_key(req->glb, req->m_subs, key);
+	wb.held++;
+	switch (req->function) {
+	case M::M_KILL:
+		n = wb_drop(wb.writes, key) + wb_drop(wb.kills, key);
+		wb.coalesced += n;
+		{
+			wb_write &w = wb.kills[key];
+			w.glb = req->glb;
+			w.m_subs = req->m_subs;
+			w.set = false;
+			w.data_is_string = false;
+			w.increment = 0;
+		}
+		tp_reply(req, 0, std::string(), false);
+		break;
+	case M::M_SET:
+		data = req->data;
+		if (!req->data_is_string)
+			num2mumps(data);
+		{
+			std::map<std::string, wb_write>::iterator it = wb.writes.find(key);
+			if (it != wb.writes.end())
+				wb.coalesced++;
+			wb_write &w = it != wb.writes.end() ? it->second : wb.writes[key];
+			w.glb = req->glb;
+			w.m_subs = req->m_subs;
+			w.set = true;
+			w.data = data;
+			w.data_is_string = req->data_is_string;
+			w.increment = 0;
+		}
+		tp_reply(req, MF_STRING, data, true);
+		break;
+	case M::M_INCREMENT:
+		{
+			std::map<std::string, wb_write>::iterator it = wb.writes.find(key);
+
+			if (it == wb.writes.end()) {
+				wb_write &w = wb.writes[key];
+				w.glb = req->glb;
+				w.m_subs = req->m_subs;
+				w.set = false;
+				w.data_is_string = false;
+				w.increment = req->number;
+				req->held = true;
+				tp_reply(req, 0, std::string(), false);
+				break;
+			}
+			wb_write &w = it->second;
+			wb.coalesced++;
+			/* a number that was set takes the increment right away */
+			if (w.set && w.increment == 0 && mproto_canonic(w.data.data(), w.data.size())) {
+				double2mumps(strtod(w.data.c_str(), NULL) + req->number, w.data);
+				w.data_is_string = false;
+			} else {
+				w.increment += req->number;
+			}
+		}
+		req->held = true;
+		tp_reply(req, 0, std::string(), false);
+		break;
+	default:
+		break;
+	}
+
+	if (wb.writes.size() + wb.kills.size() >= wb.entries) {
+		wb_flush_async(Local<Function>());
+	} else if (!wb.timing) {
+		uv_timer_start(&wb.timer, wb_timer_cb, wb.interval, 0);
+		wb.timing = true;
+	}
+
+	if (callback.IsEmpty())
+		return scope.Close(gtm_reply(req));
+	req->callback = Persistent<Function>::New(callback);
+	wb.replies.push_back(req);
+	if (!wb.deferring) {
+		uv_timer_start(&wb.defer, wb_defer_cb, 0, 0);
+		wb.deferring = true;
+	}
+	return scope.Close(Undefined());
+}
+
+/* every api call goes through here, if the last argument is a function
+ * the call-in is made on the gtm worker thread and the function
+ * is called back with (error, result) when it is finished
+ */
+Handle<Value> gtm_call(M function, const Arguments &_args)
+{
+	HandleScope scope;
+	Local<Function> callback;
+	Local<Object> args;
+	const char *err;
+	int argc = _args.Length();
+
+	if (argc > 0 && _args[argc - 1]->IsFunction()) {
+		callback = Local<Function>::Cast(_args[argc - 1]);
+		argc--;
+	}
+
+	if (txn.level > 0 && tp_refuses(function)) {
+		std::string msg = std::string(to_string(function)) + " is not allowed inside a transaction";
+
+		ThrowException(Exception::Error(String::New(msg.c_str())));
+		return scope.Close(Undefined());
+	}
+
+	if (argc > 0 && !_args[0]->IsUndefined()) {
+		args = Local<Object>::Cast(_args[0]);
+	} else if (function == M::M_VERSION || function == M::M_GLOBAL_DIRECTORY) {
+		args = Object::New();
+	} else if (callback.IsEmpty()) {
+		return scope.Close(Undefined());
+	} else {
+		ThrowException(Exception::Error(String::New("Need to supply an argument object")));
+		return scope.Close(Undefined());
+	}
+
+	gtm_req *req = gtm_req_new(function);
+	uint64_t start = stats_enabled ? uv_hrtime() : 0;
+
+	if ((err = gtm_marshal(function, args, _args, req)) != NULL) {
+		gtm_req_free(req);
+		ThrowException(Exception::Error(String::New(err)));
+		return scope.Close(Undefined());
+	}
+	if (stats_enabled)
+		req->t_marshal = uv_hrtime() - start;
+
+	/* the reads and writes of a transaction are answered right here */
+	if (txn.level > 0 && tp_handles(function)) {
+		if (!callback.IsEmpty()) {
+			gtm_req_free(req);
+			ThrowException(Exception::Error(String::New("No asynchronous calls inside a transaction")));
+			return scope.Close(Undefined());
+		}
+		tp_exec(req);
+		return scope.Close(gtm_reply(req));
+	}
+	if (wb.entries > 0 && gtm_is_open && wb_handles(function))
+		return scope.Close(wb_hold(req, callback));
+	wb_settle(!callback.IsEmpty());
+	return scope.Close(gtm_run(req, callback));
+}
+
+Handle<Value> Gtm::batch(const Arguments &args)
+{
+	return gtm_call(M::M_BATCH, args);
+}
+
+Handle<Value> Gtm::set(const Arguments &args)
+{
+	return gtm_call(M::M_SET, args);
+}
+
+/* tstart() opens a transaction, or one more level of the open one */
+Handle<Value> Gtm::tstart(const Arguments &args)
+{
+	HandleScope scope;
+	Local<Object> res = Object::New();
+
+	if (!gtm_is_open) {
+		setOk(res, 0);
+		setErrorMessage(res, "Gtm is closed");
+		return scope.Close(res);
+	}
+	/* the transaction sees the held writes */
+	if (txn.level == 0)
+		wb_settle(false);
+	txn.level++;
+	setOk(res, 1);
+	setResult(res, Number::New(txn.level));
+	return scope.Close(res);
+}
+
+/* tcommit() closes a level, the last one makes the writes in one go */
+Handle<Value> Gtm::tcommit(const Arguments &args)
+{
+	HandleScope scope;
+	Local<Object> res = Object::New();
+
+	if (txn.level == 0) {
+		setOk(res, 0);
+		setErrorMessage(res, "Not in a transaction");
+		return scope.Close(res);
+	}
+	if (txn.level > 1) {
+		txn.level--;
+		setOk(res, 1);
+		setResult(res, Number::New(txn.level));
+		return scope.Close(res);
+	}
+	return scope.Close(gtm_reply(tp_commit()));
+}
+
+/* trollback() drops every level of the open transaction */
+Handle<Value> Gtm::trollback(const Arguments &args)
+{
+	HandleScope scope;
+	Local<Object> res = Object::New();
+
+	if (txn.level == 0) {
+		setOk(res, 0);
+		setErrorMessage(res, "Not in a transaction");
+		return scope.Close(res);
+	}
+	txn.level = 0;
+	txn.ops.clear();
+	setOk(res, 1);
+	setResult(res, Number::New(0));
+	return scope.Close(res);
+}
 
-			if (subs->IsUndefined()) {
-				m_subs = String::Empty();
-			} else {
-				js_subs = Local<Array>::Cast(subs);
-				m_subs  = Array::New();
-				Local<Array> tmp = Local<Array>::Cast(m_subs);
-				js2mumps_array(js_subs, tmp);
-			}
-			
-			set_mumps_call(call, "get");
-	
-			err = gtm_cip(&call, retbuf, *String::AsciiValue(glb),
-						     *String::AsciiValue(m_subs), mode);
-			if (err)
-				goto gtm_err;
-		
-			Local<String> str;
-
-			if ((encoding = getenv("XNODEM_ENCODING")) != NULL) {
-				iconv_t cd = iconvm_open("utf8", encoding);
-				if (cd == (iconv_t)(-1)) {
-					setOk(err_obj, 0);
-					setErrorMessage(err_obj, strerror(errno));
-					return scope.Close(err_obj);
-				}
-				iconvm(cd, retbuf, strlen(retbuf), retconv, sizeof(retconv));
-				if (iconvm_close(cd) < 0) {
-					setOk(err_obj, 0);
-					setErrorMessage(err_obj, strerror(errno));
-					return scope.Close(err_obj);
-				}
-				str = String::New(retconv);
-			} else {
-				str = String::New(retbuf);
+/* transaction(fn[, {retries}]) calls fn in a transaction and commits it,
+ * fn is called again when a node it read has changed before the commit.
+ * a throw from fn rolls back its writes and goes on to the caller.
+ * fn may get, set, kill and increment, merge, update, batch, function and
+ * the other writes throw, data, order, query and the other reads see the
+ * database without the writes of fn and are not checked at commit
+ */
+Handle<Value> Gtm::transaction(const Arguments &args)
+{
+	HandleScope scope;
+	int retries = TP_RETRIES;
+
+	if (args.Length() < 1 || !args[0]->IsFunction()) {
+		ThrowException(Exception::Error(String::New("Need to supply a function")));
+		return scope.Close(Undefined());
+	}
+	if (args.Length() > 1 && args[1]->IsObject()) {
+		Local<Value> n = args[1]->ToObject()->Get(String::New("retries"));
+		if (n->IsNumber())
+			retries = n->Int32Value();
+	}
+	if (!gtm_is_open) {
+		Local<Object> res = Object::New();
+		setOk(res, 0);
+		setErrorMessage(res, "Gtm is closed");
+		return scope.Close(res);
+	}
+
+	Local<Function> fn = Local<Function>::Cast(args[0]);
+	int level = txn.level;
+	size_t mark = txn.ops.size();
+
+	if (level == 0)
+		wb_settle(false);
+
+	for (int restarts = 0;; restarts++) {
+		TryCatch try_catch;
+
+		txn.level = level + 1;
+		fn->Call(args.This(), 0, NULL);
+		if (try_catch.HasCaught()) {
+			if (txn.level > level) {
+				txn.level = level;
+				txn.ops.resize(mark);
 			}
-	
-			if (str->Length() == 0)
-				throw_exception("No JSON string present");
-
-			Handle<Value> ret = JSON_parse(str);
-			if (ret.IsEmpty())
-				return scope.Close(Undefined());
-			
-			Handle<Object> ret_obj = Handle<Object>::Cast(ret);
-			Handle<Value> data_obj = ret_obj->Get(String::New("data"));
-			/* stringify data property */
-			ret_obj->Set(String::New("data"), String::New((char *)*String::Utf8Value(data_obj)));
-			/* if no subs specified just return object */
-			if (subs->IsUndefined())
-				return scope.Close(ret_obj);
-			/* set subs in response */
-			if (ret_obj->Get(String::New("errorCode"))->IsUndefined())
-				ret_obj->Set(String::New("subscripts"), js_subs);
-			return scope.Close(ret_obj);	
+			return scope.Close(try_catch.ReThrow());
 		}
-		break;
-	case M::M_GLOBAL_DIRECTORY:
-		{
-			Local<Value> max = args->Get(String::New("max"));
-			Local<Value> lo  = args->Get(String::New("lo"));
-			Local<Value> hi  = args->Get(String::New("hi"));
-	
-			if (max->IsUndefined())
-				max = Number::New(0);
-			if (lo->IsUndefined())
-				lo = String::Empty();
-			if (hi->IsUndefined())
-				hi = String::Empty();
-			
-			set_mumps_call(call, "global_directory");
-			
-			err = gtm_cip(&call, retbuf, max->Uint32Value(),
-						     *String::AsciiValue(lo),
-						     *String::AsciiValue(hi));
-			if (err)
-				goto gtm_err;
-	
-			Local<String> str = String::New(retbuf);
-			if (str->Length() == 0)
-				throw_exception("No JSON string present");
-
-			Handle<Value> ret = JSON_parse(str);
-			if (ret.IsEmpty())
-				return scope.Close(Undefined());
-			
-			Handle<Object> ret_obj = Handle<Object>::Cast(ret);
-			Handle<Value> data_obj = ret_obj->Get(String::New("data"));
-			/* stringify data property */
-			ret_obj->Set(String::New("data"), String::New((char *)*String::AsciiValue(data_obj)));
-			return scope.Close(ret_obj);
+		if (txn.level <= level) {
+			Local<Object> res = Object::New();
+			setOk(res, 0);
+			setErrorMessage(res, "Transaction was rolled back");
+			return scope.Close(res);
+		}
+		/* nested in an open transaction, which makes the writes */
+		if (level > 0) {
+			Local<Object> res = Object::New();
+			txn.level = level;
+			setOk(res, 1);
+			setResult(res, Number::New(txn.level));
+			return scope.Close(res);
 		}
-		break;
-	case M::M_INCREMENT:
-		{
-			glb  = args->Get(String::New("global"));
-			subs = args->Get(String::New("subscripts"));
-			
-			Local<Value> number = Local<Number>::Cast(_args[1]);
-			if (number->IsUndefined())
-				number = Number::New(1);
-				
-			Local<Value> m_subs;
-			Local<Array> js_subs;
-	
-			if (subs->IsUndefined()) {
-				m_subs = String::Empty();
-			} else {
-				js_subs = Local<Array>::Cast(subs);
-				m_subs  = Array::New();
-				Local<Array> tmp = Local<Array>::Cast(m_subs);	
-				js2mumps_array(js_subs, tmp);
-			}
 
-			set_mumps_call(call, "increment");
-	
-			err = gtm_cip(&call, retbuf, *String::AsciiValue(glb),
-						     *String::AsciiValue(m_subs),
-						      number->NumberValue(), mode);
-	
-			if (err)
-				goto gtm_err;
-			
-			Local<String> str = String::New(retbuf);
-			if (str->Length() == 0)
-				throw_exception("No JSON string present");
-
-			Handle<Value> ret = JSON_parse(str);
-			if (ret.IsEmpty())
-				return scope.Close(Undefined());
-			
-			Handle<Object> ret_obj = Handle<Object>::Cast(ret);
-			Handle<Value> data_obj = ret_obj->Get(String::New("data"));
-			/* stringify data property */
-			ret_obj->Set(String::New("data"), String::New((char *)*String::AsciiValue(data_obj)));
-			/* if no subs specified just return object */
-			if (subs->IsUndefined())
-				return scope.Close(ret_obj);
-			/* set subs in response */
-			if (ret_obj->Get(String::New("errorCode"))->IsUndefined())
-				ret_obj->Set(String::New("subscripts"), js_subs);
-			return scope.Close(ret_obj);
+		gtm_req *req = tp_commit();
+		if (req->state == REQ_RESTART && restarts < retries) {
+			gtm_req_free(req);
+			continue;
 		}
-		break;
-	case M::M_UNLOCK:	
-		{
-			glb  = args->Get(String::New("global"));
-			subs = args->Get(String::New("subscripts"));
-	
-			if (glb->IsUndefined())
-				glb = String::Empty();
+		Handle<Value> ret = gtm_result(req);
+		gtm_req_free(req);
+		return scope.Close(ret);
+	}
+}
 
-			Local<Value> m_subs;
-			Local<Array> js_subs;
+Handle<Value> Gtm::set_buffer(const Arguments &args)
+{
+	return gtm_call(M::M_SET_BUFFER, args);
+}
 
-			if (subs->IsUndefined()) {
-				m_subs = String::Empty();
-			} else {
-				js_subs = Local<Array>::Cast(subs);
-				m_subs  = Array::New();
-				Local<Array> tmp = Local<Array>::Cast(m_subs);	
-				js2mumps_array(js_subs, tmp);
-		 	}
-	
-			set_mumps_call(call, "unlock");
-
-			err = gtm_cip(&call, retbuf, *String::AsciiValue(glb),
-						     *String::AsciiValue(m_subs), mode);
-			if (err)
-				goto gtm_err;
-
-			Local<String> str = String::New(retbuf);
-			if (str->Length() == 0)
-				throw_exception("No JSON string present");
-
-			Handle<Value> ret = JSON_parse(str);
-			if (ret.IsEmpty())
-				return scope.Close(Undefined());
-			
-			Handle<Object> ret_obj = Handle<Object>::Cast(ret);
-			Handle<Value> data_obj = ret_obj->Get(String::New("data"));
-			ret_obj->Set(String::New("data"), String::New((char *)*String::AsciiValue(data_obj)));
-			if (subs->IsUndefined())
-				return scope.Close(ret_obj);
-			if (ret_obj->Get(String::New("errorCode"))->IsUndefined())
-				ret_obj->Set(String::New("subscripts"), js_subs);
-			return scope.Close(ret_obj);	
-		}
-		break;
-	case M::M_MERGE:
-		{
-			Local<Object> to_obj = Local<Object>::Cast(args->Get(String::New("to")));
-			Local<Object> from_obj = Local<Object>::Cast(args->Get(String::New("from")));
-			/* to */
-			Local<Value> to_glb  = to_obj->Get(String::New("global"));
-			Local<Value> to_subs = to_obj->Get(String::New("subscripts"));
-			/* from */
-			Local<Value> from_glb  = from_obj->Get(String::New("global"));
-			Local<Value> from_subs = from_obj->Get(String::New("subscripts"));
-	
-			Local<Array> to_js_subs = Local<Array>::Cast(to_subs);
-			Local<Array> to_m_subs  = Array::New();
-			js2mumps_array(to_js_subs, to_m_subs);
-
-			Local<Array> from_js_subs = Local<Array>::Cast(from_subs);
-			Local<Array> from_m_subs  = Array::New();
-			js2mumps_array(from_js_subs, from_m_subs);
-
-			set_mumps_call(call, "merge");
-	
-			err = gtm_cip(&call, retbuf, *String::AsciiValue(to_glb),
-						     *String::AsciiValue(to_m_subs),
-						     *String::AsciiValue(from_glb),
-						     *String::AsciiValue(from_m_subs), mode);
-			if (err)
-				goto gtm_err;
-			
-			Local<String> str = String::New(retbuf);
-			if (str->Length() == 0)
-				throw_exception("No JSON string present");
-		
-			Handle<Value> ret = JSON_parse(str);
-			if (ret.IsEmpty())
-				return scope.Close(Undefined());
-			
-			Handle<Object> ret_obj = Handle<Object>::Cast(ret);
-			Handle<Value> data_obj = ret_obj->Get(String::New("data"));
-		
-			ret_obj->Set(String::New("data"), String::New((char *)*String::AsciiValue(data_obj)));	
-			return scope.Close(ret_obj);	
-		}
-		break;
-	case M::M_ORDER:
-	case M::M_PREVIOUS:
-		{
-			glb  = args->Get(String::New("global"));
-			subs = args->Get(String::New("subscripts"));
+Handle<Value> Gtm::get(const Arguments &args)
+{
+	return gtm_call(M::M_GET, args);
+}
 
-			Local<Value> m_subs;
-			Local<Array> js_subs;
+Handle<Value> Gtm::get_buffer(const Arguments &args)
+{
+	return gtm_call(M::M_GET_BUFFER, args);
+}
 
-			if (subs->IsUndefined()) {
-				m_subs = String::Empty();
-			} else {
-				js_subs = Local<Array>::Cast(subs);
-				m_subs = Array::New();
-				Local<Array> tmp = Local<Array>::Cast(m_subs);
-				js2mumps_array(js_subs, tmp);
-			}	
-				
-			set_mumps_call(call, to_string(function));
-			
-			err = gtm_cip(&call, retbuf, *String::AsciiValue(glb),
-						     *String::AsciiValue(m_subs), mode);
-			if (err)
-				goto gtm_err;
-			
-			Local<String> str = String::New(retbuf);
-			if (str->Length() == 0)
-				throw_exception("No JSON string present");
-		
-			Handle<Value> ret = JSON_parse(str);
-			if (ret.IsEmpty())
-				return scope.Close(Undefined());
-			
-			Handle<Object> ret_obj = Handle<Object>::Cast(ret);
-			Handle<Value> data_obj = ret_obj->Get(String::New("data"));
-		
-			ret_obj->Set(String::New("data"), String::New((char *)*String::AsciiValue(data_obj)));
-			if (subs->IsUndefined())
-				return scope.Close(ret_obj);
-			if (ret_obj->Get(String::New("errorCode"))->IsUndefined()) {
-				js_subs->Set(Number::New(js_subs->Length() - 1), ret_obj->Get(String::New("result"))); 
-				ret_obj->Set(String::New("subscripts"), js_subs);
-			}
-			return scope.Close(ret_obj);		
-		}
-		break;
-	case M::M_SET:
-		{
-			glb  = args->Get(String::New("global"));
-			subs = args->Get(String::New("subscripts"));
-			data = args->Get(String::New("data"));
-			
-			if (data->IsUndefined()) 
-				throw_exception("Need to supply a data property");
-			
-			if (args->Get(String::New("data"))->IsString()) {
-				/* convert data from utf8 to `encoding' */
-				if ((encoding = getenv("XNODEM_ENCODING")) != NULL) {	
-					iconv_t cd = iconvm_open(encoding, "utf8");
-					if (cd == (iconv_t)(-1)) {
-						setOk(err_obj, 0);
-						setErrorMessage(err_obj, strerror(errno));
-						return scope.Close(err_obj);
-					}
-					
-					Local<String> _data = Local<String>::Cast(data);
-					/* left space for quotes and null byte */
-					iconvm(cd, *String::Utf8Value(_data), _data->Utf8Length(), retbuf, sizeof(retbuf) - 3);
-		
-					if (iconvm_close(cd) < 0) {
-						setOk(err_obj, 0);
-						setErrorMessage(err_obj, strerror(errno));
-						return scope.Close(err_obj);
-					}
-					/* wrap in quoutes */
-					snprintf(databuf, sizeof(databuf), "\"%s\"", retbuf);
-				} else {
-					snprintf(databuf, sizeof(databuf), "\"%s\"", *String::Utf8Value(data));
-				}
-			}
-		
-			Local<Value> m_subs;
-			Local<Array> js_subs;
+Handle<Value> Gtm::get_number(const Arguments &args)
+{
+	return gtm_call(M::M_GET_NUMBER, args);
+}
 
-			if (subs->IsUndefined()) {
-				m_subs = String::Empty();
-			} else {
-				js_subs = Local<Array>::Cast(subs);
-				m_subs = Array::New();
-				Local<Array> tmp = Local<Array>::Cast(m_subs);
-				js2mumps_array(js_subs, tmp);
-			}
+Handle<Value> Gtm::set_number(const Arguments &args)
+{
+	return gtm_call(M::M_SET_NUMBER, args);
+}
 
-			set_mumps_call(call, "set");
-			err = gtm_cip(&call, retbuf, *String::AsciiValue(glb),
-						     *String::AsciiValue(m_subs),
-						     databuf, mode);
-			if (err)
-				goto gtm_err;
-		
-			Local<String> str = String::New(retbuf);
-			if (str->Length() == 0)
-				throw_exception("No JSON string present");
-
-			Handle<Value> ret = JSON_parse(str);
-			if (ret.IsEmpty())
-				return scope.Close(Undefined());
-			
-			Handle<Object> ret_obj = Handle<Object>::Cast(ret);
-			Handle<Value> data_obj = ret_obj->Get(String::New("data"));
-		
-			ret_obj->Set(String::New("data"), String::New((char *)*String::AsciiValue(data_obj)));
-			/* if no subs specified just return object */
-			if (subs->IsUndefined())
-				return scope.Close(ret_obj);
-			/* if everything is ok then add subs to object */
-			if (ret_obj->Get(String::New("errorCode"))->IsUndefined())
-				ret_obj->Set(String::New("subscripts"), js_subs);
-			return scope.Close(ret_obj);
+/* cache([{entries, ttl, reset}]) sets up the read cache, returns its counters */
+Handle<Value> Gtm::cache(const Arguments &args)
+{
+	HandleScope scope;
+	Local<Object> res = Object::New();
+	struct mcache_stats stats;
+	bool reset = false;
+
+	if (args.Length() > 0 && args[0]->IsObject()) {
+		Local<Object> opts = args[0]->ToObject();
+		if (opts->Has(String::New("entries")) || opts->Has(String::New("ttl")))
+			cache_configure(opts);
+		reset = opts->Get(String::New("reset"))->BooleanValue();
+	}
+	mcache_get_stats(&stats, reset);
+	res->Set(String::New("entries"), Number::New(stats.entries));
+	res->Set(String::New("hits"), Number::New(stats.hits));
+	res->Set(String::New("misses"), Number::New(stats.misses));
+	res->Set(String::New("invalidations"), Number::New(stats.invalidations));
+	res->Set(String::New("evictions"), Number::New(stats.evictions));
+	return scope.Close(res);
+}
+
+/* writeBehind({entries, interval, reset}) turns write-behind on, or off
+ * with entries: 0 after making the held writes, and gives its stats.
+ * while it is on, increment() answers {ok, global, held: true} with no
+ * data, the new value is not known until the increment is made
+ */
+Handle<Value> Gtm::write_behind(const Arguments &args)
+{
+	HandleScope scope;
+	Local<Object> res = Object::New();
+	bool reset = false;
+
+	if (args.Length() > 0 && args[0]->IsObject()) {
+		Local<Object> opts = args[0]->ToObject();
+		if (opts->Has(String::New("entries")) || opts->Has(String::New("interval"))) {
+			wb_configure(opts);
+			if (wb.entries == 0 && gtm_is_open)
+				wb_settle(false);
 		}
-		break;
-	/* not implemented yet */
-	case M::M_NEXT_NODE:
-	case M::M_PREVIOUS_NODE:
-	case M::M_RETRIEVE:
-	case M::M_UPDATE:
-	default:
+		reset = opts->Get(String::New("reset"))->BooleanValue();
+	}
+	res->Set(String::New("entries"), Number::New(wb.entries));
+	res->Set(String::New("interval"), Number::New(wb.interval));
+	res->Set(String::New("pending"), Number::New(wb.writes.size() + wb.kills.size()));
+	res->Set(String::New("writes"), Number::New(wb.held));
+	res->Set(String::New("coalesced"), Number::New(wb.coalesced));
+	res->Set(String::New("ratio"), Number::New(wb.held ? (double)wb.coalesced / wb.held : 0));
+	res->Set(String::New("flushes"), Number::New(wb.flushes));
+	res->Set(String::New("operations"), Number::New(wb.ops));
+	res->Set(String::New("errors"), Number::New(wb.errors));
+	if (!wb.error.empty())
+		res->Set(String::New("lastError"), String::New(wb.error.c_str()));
+	if (reset)
+		wb.held = wb.coalesced = wb.flushes = wb.ops = wb.errors = 0;
+	return scope.Close(res);
+}
+
+/* flush([callback]) makes the held writes, the result tells how many
+ * operations it took or the failure of any flush since the last call
+ */
+Handle<Value> Gtm::flush(const Arguments &args)
+{
+	HandleScope scope;
+	int argc = args.Length();
+
+	if (!gtm_is_open) {
+		Local<Object> res = Object::New();
+		setOk(res, 0);
+		setErrorMessage(res, "Gtm is closed");
+		return scope.Close(res);
+	}
+	if (argc > 0 && args[argc - 1]->IsFunction()) {
+		wb_flush_async(Local<Function>::Cast(args[argc - 1]));
 		return scope.Close(Undefined());
 	}
-gtm_err:
-	gtm_zstatus(errbuf, sizeof(errbuf));
-	gtm_error_parse(errbuf, &err_code, &err_msg);
-	setOk(err_obj, 0);
-	setErrorCode(err_obj, err_code);
-	setErrorMessage(err_obj, err_msg);
-	return scope.Close(err_obj);	
+	return scope.Close(wb_flushed(wb_flush_sync()));
 }
- 
-Handle<Value> Gtm::set(const Arguments &args)
+
+/* latency histogram of one phase, times are in microseconds */
+static Local<Object> hist2js_object(const struct mstats_hist *hist)
 {
-	return gtm_call(M::M_SET, args);
+	HandleScope scope;
+	Local<Object> obj = Object::New();
+	Local<Array> buckets = Array::New();
+	int last = STATS_BUCKETS - 1;
+
+	obj->Set(String::New("count"), Number::New(hist->count));
+	obj->Set(String::New("mean"), Number::New(hist->count ? hist->total / hist->count / 1000 : 0));
+	obj->Set(String::New("p50"), Number::New(mstats_hist_quantile(hist, 0.5) / 1000));
+	obj->Set(String::New("p99"), Number::New(mstats_hist_quantile(hist, 0.99) / 1000));
+	obj->Set(String::New("max"), Number::New(hist->max / 1000));
+	/* bucket i counts the calls that took 2^i to 2^(i+1) ns */
+	while (last > 0 && hist->buckets[last] == 0)
+		last--;
+	for (int i = 0; i <= last; i++)
+		buckets->Set(i, Number::New(hist->buckets[i]));
+	obj->Set(String::New("buckets"), buckets);
+	return scope.Close(obj);
 }
 
-Handle<Value> Gtm::get(const Arguments &args)
+/* stats([{enable, reset}]) turns the stats on or off, returns them per method and for locks */
+Handle<Value> Gtm::stats(const Arguments &args)
 {
-	return gtm_call(M::M_GET, args);
+	HandleScope scope;
+	Local<Object> res = Object::New();
+	Local<Object> methods = Object::New();
+
+	if (args.Length() > 0 && args[0]->IsObject()) {
+		Local<Object> opts = args[0]->ToObject();
+		if (opts->Has(String::New("enable")))
+			stats_enabled = opts->Get(String::New("enable"))->BooleanValue();
+		if (opts->Get(String::New("reset"))->BooleanValue()) {
+			memset(op_stats, 0, sizeof(op_stats));
+			memset(&lock_stats, 0, sizeof(lock_stats));
+		}
+	}
+	for (int i = 0; i < (int)M::M_COUNT; i++) {
+		const struct mstats_op *op = &op_stats[i];
+		Local<Object> obj;
+
+		if (op->calls == 0)
+			continue;
+		obj = Object::New();
+		obj->Set(String::New("calls"), Number::New(op->calls));
+		obj->Set(String::New("errors"), Number::New(op->errors));
+		obj->Set(String::New("bytesIn"), Number::New(op->bytes_in));
+		obj->Set(String::New("bytesOut"), Number::New(op->bytes_out));
+		obj->Set(String::New("marshal"), hist2js_object(&op->marshal));
+		obj->Set(String::New("callIn"), hist2js_object(&op->call_in));
+		obj->Set(String::New("decode"), hist2js_object(&op->decode));
+		methods->Set(String::New(to_string((M)i)), obj);
+	}
+	Local<Object> locks = Object::New();
+	locks->Set(String::New("acquired"), Number::New(lock_stats.acquired));
+	locks->Set(String::New("timedOut"), Number::New(lock_stats.timed_out));
+	locks->Set(String::New("wait"), hist2js_object(&lock_stats.wait));
+
+	res->Set(String::New("enabled"), Boolean::New(stats_enabled));
+	res->Set(String::New("methods"), methods);
+	res->Set(String::New("locks"), locks);
+	return scope.Close(res);
+}
+
+Handle<Value> Gtm::cursor(const Arguments &args)
+{
+	HandleScope scope;
+	Handle<Value> argv[1] = { args[0] };
+
+	return scope.Close(Cursor::constructor->NewInstance(1, argv));
+}
+
+/* prepare('label^routine') makes a Routine to call the function with */
+Handle<Value> Gtm::prepare(const Arguments &args)
+{
+	HandleScope scope;
+	Handle<Value> argv[1] = { args[0] };
+
+	return scope.Close(Routine::constructor->NewInstance(1, argv));
 }
 
 Handle<Value> Gtm::data(const Arguments &args)
@@ -842,6 +3473,16 @@ Handle<Value> Gtm::data(const Arguments &args)
 	return gtm_call(M::M_DATA, args);
 }
 
+Handle<Value> Gtm::export_chunk(const Arguments &args)
+{
+	return gtm_call(M::M_EXPORT, args);
+}
+
+Handle<Value> Gtm::import_chunk(const Arguments &args)
+{
+	return gtm_call(M::M_IMPORT, args);
+}
+
 Handle<Value> Gtm::function(const Arguments &args)
 {
 	return gtm_call(M::M_FUNCTION, args);
@@ -857,6 +3498,16 @@ Handle<Value> Gtm::increment(const Arguments &args)
 	return gtm_call(M::M_INCREMENT, args);
 }
 
+Handle<Value> Gtm::increment_number(const Arguments &args)
+{
+	return gtm_call(M::M_INCREMENT_NUMBER, args);
+}
+
+Handle<Value> Gtm::index(const Arguments &args)
+{
+	return gtm_call(M::M_INDEX, args);
+}
+
 Handle<Value> Gtm::kill(const Arguments &args)
 {
 	return gtm_call(M::M_KILL, args);
@@ -867,6 +3518,11 @@ Handle<Value> Gtm::lock(const Arguments &args)
 	return gtm_call(M::M_LOCK, args);
 }
 
+Handle<Value> Gtm::lookup(const Arguments &args)
+{
+	return gtm_call(M::M_LOOKUP, args);
+}
+
 Handle<Value> Gtm::merge(const Arguments &args)
 {
 	return gtm_call(M::M_MERGE, args);
@@ -882,6 +3538,11 @@ Handle<Value> Gtm::order(const Arguments &args)
 	return gtm_call(M::M_ORDER, args);
 }
 
+Handle<Value> Gtm::partition(const Arguments &args)
+{
+	return gtm_call(M::M_PARTITION, args);
+}
+
 Handle<Value> Gtm::previous(const Arguments &args)
 {
 	return gtm_call(M::M_PREVIOUS, args);
@@ -892,6 +3553,16 @@ Handle<Value> Gtm::previous_node(const Arguments &args)
 	return gtm_call(M::M_PREVIOUS_NODE, args);
 }
 
+Handle<Value> Gtm::query(const Arguments &args)
+{
+	return gtm_call(M::M_QUERY, args);
+}
+
+Handle<Value> Gtm::rebuild_index(const Arguments &args)
+{
+	return gtm_call(M::M_REBUILD_INDEX, args);
+}
+
 Handle<Value> Gtm::retrieve(const Arguments &args)
 {
 	return gtm_call(M::M_RETRIEVE, args);
@@ -907,6 +3578,11 @@ Handle<Value> Gtm::update(const Arguments &args)
 	return gtm_call(M::M_UPDATE, args);
 }
 
+Handle<Value> Gtm::version(const Arguments &args)
+{
+	return gtm_call(M::M_VERSION, args);
+}
+
 Gtm::Gtm() {}
 Gtm::~Gtm() {}
 
@@ -921,6 +3597,12 @@ Handle<Value> Gtm::New(const Arguments& args)
 
 void Gtm::Init(Handle<Object> target)
 {
+	gtm_worker_init();
+	mcache_init();
+	init_field_names();
+	uv_timer_init(uv_default_loop(), &wb.timer);
+	uv_timer_init(uv_default_loop(), &wb.defer);
+
 	Local<FunctionTemplate> tpl = FunctionTemplate::New(New);
 	tpl->SetClassName(String::NewSymbol("Gtm"));
 	tpl->InstanceTemplate()->SetInternalFieldCount(1);
@@ -930,33 +3612,306 @@ void Gtm::Init(Handle<Object> target)
         FunctionTemplate::New(func)->GetFunction());
 	SET_GTM_METHOD(tpl, "close", close);
 	SET_GTM_METHOD(tpl, "open", open);
+	SET_GTM_METHOD(tpl, "cache", cache);
+	SET_GTM_METHOD(tpl, "cursor", cursor);
+	SET_GTM_METHOD(tpl, "batch", batch);
 	SET_GTM_METHOD(tpl, "data", data);
+	SET_GTM_METHOD(tpl, "exportChunk", export_chunk);
+	SET_GTM_METHOD(tpl, "flush", flush);
 	SET_GTM_METHOD(tpl, "function", function);
 	SET_GTM_METHOD(tpl, "get", get);
+	SET_GTM_METHOD(tpl, "getBuffer", get_buffer);
+	SET_GTM_METHOD(tpl, "getNumber", get_number);
 	SET_GTM_METHOD(tpl, "global_directory", global_directory);
+	SET_GTM_METHOD(tpl, "importChunk", import_chunk);
 	SET_GTM_METHOD(tpl, "increment", increment);
+	SET_GTM_METHOD(tpl, "incrementNumber", increment_number);
+	SET_GTM_METHOD(tpl, "index", index);
 	SET_GTM_METHOD(tpl, "kill", kill);
 	SET_GTM_METHOD(tpl, "lock", lock);
+	SET_GTM_METHOD(tpl, "lookup", lookup);
 	SET_GTM_METHOD(tpl, "merge", merge);
 	SET_GTM_METHOD(tpl, "next", order);
 	SET_GTM_METHOD(tpl, "next_node", next_node);
 	SET_GTM_METHOD(tpl, "order", order);
+	SET_GTM_METHOD(tpl, "partition", partition);
 	SET_GTM_METHOD(tpl, "previous", previous);
+	SET_GTM_METHOD(tpl, "prepare", prepare);
 	SET_GTM_METHOD(tpl, "previous_node", previous_node);
+	SET_GTM_METHOD(tpl, "query", query);
+	SET_GTM_METHOD(tpl, "rebuildIndex", rebuild_index);
 	SET_GTM_METHOD(tpl, "retrieve", retrieve);
 	SET_GTM_METHOD(tpl, "set", set);
+	SET_GTM_METHOD(tpl, "stats", stats);
+	SET_GTM_METHOD(tpl, "setBuffer", set_buffer);
+	SET_GTM_METHOD(tpl, "setNumber", set_number);
+	SET_GTM_METHOD(tpl, "tcommit", tcommit);
+	SET_GTM_METHOD(tpl, "transaction", transaction);
+	SET_GTM_METHOD(tpl, "trollback", trollback);
+	SET_GTM_METHOD(tpl, "tstart", tstart);
 	SET_GTM_METHOD(tpl, "unlock", unlock);
 	SET_GTM_METHOD(tpl, "update", update);
-	SET_GTM_METHOD(tpl, "version", version);	
+	SET_GTM_METHOD(tpl, "version", version);
+	SET_GTM_METHOD(tpl, "writeBehind", write_behind);
 #undef SET_GTM_METHOD
 	Persistent<Function> constructor = Persistent<Function>::New(tpl->GetFunction());
 	target->Set(String::NewSymbol("Gtm"), constructor);
-} 
+}
+
+#define CURSOR_PREFETCH	100
+
+Persistent<Function> Cursor::constructor;
+
+static Persistent<String> done_symbol;
+static Persistent<String> value_symbol;
+static Persistent<String> key_symbol;
+
+Cursor::Cursor(): req(NULL), pos(0), more(true) {}
+
+Cursor::~Cursor()
+{
+	if (req != NULL)
+		gtm_req_free(req);
+}
+
+/* new Cursor({global, subscripts, start, direction, prefetch, values}),
+ * the keys below `subscripts' are walked from the one after `start'
+ */
+Handle<Value> Cursor::New(const Arguments &args)
+{
+	HandleScope scope;
+	Local<Object> opts;
+	Local<Value> glb, subs, start, direction, prefetch;
+
+	if (!args[0]->IsObject()) {
+		ThrowException(Exception::Error(String::New("Need to supply an argument object")));
+		return scope.Close(Undefined());
+	}
+	opts = args[0]->ToObject();
+	glb = opts->Get(String::New("global"));
+	if (glb->IsUndefined()) {
+		ThrowException(Exception::Error(String::New("Need to supply a global property")));
+		return scope.Close(Undefined());
+	}
+	subs = opts->Get(String::New("subscripts"));
+	if (!subs->IsUndefined() && !subs->IsArray()) {
+		ThrowException(Exception::Error(String::New("subscripts must be an array")));
+		return scope.Close(Undefined());
+	}
+
+	gtm_req *req = gtm_req_new(M::M_ORDER_PAGE);
+	req->glb = *String::AsciiValue(glb);
+	if (!subs->IsUndefined())
+		js2native_array(subs, req->subs);
+	start = opts->Get(String::New("start"));
+	req->subs.push_back(start->IsUndefined() ? std::string() : std::string(*String::Utf8Value(start)));
+
+	direction = opts->Get(String::New("direction"));
+	if (direction->IsNumber()) {
+		req->direction = direction->NumberValue() < 0 ? -1 : 1;
+	} else if (direction->IsString()) {
+		std::string dir = *String::AsciiValue(direction);
+		req->direction = (dir == "reverse" || dir == "backward") ? -1 : 1;
+	}
+	prefetch = opts->Get(String::New("prefetch"));
+	req->max = prefetch->IsUndefined() ? CURSOR_PREFETCH : prefetch->Uint32Value();
+	if (req->max == 0)
+		req->max = 1;
+	req->values = opts->Get(String::New("values"))->BooleanValue();
+
+	Cursor *cursor = new Cursor();
+	cursor->req = req;
+	cursor->Wrap(args.This());
+	return args.This();
+}
+
+/* replace the page with the keys after the current position */
+int Cursor::fetch(void)
+{
+	if (!subs2mumps_string(req->subs, req->m_subs)) {
+		ThrowException(Exception::Error(String::New("subscript is too big")));
+		return FALSE;
+	}
+	req->ret.clear();
+	req->fields.clear();
+	req->state = REQ_OK;
+	wb_settle(false);
+	gtm_exec(req);
+	if (stats_enabled)
+		stats_record(req, 0);
+	switch (req->state) {
+	case REQ_OK:
+		break;
+	case REQ_CLOSED:
+		ThrowException(Exception::Error(String::New("Gtm is closed")));
+		return FALSE;
+	default:
+		ThrowException(Exception::Error(String::New(req->err_msg.c_str())));
+		return FALSE;
+	}
+	pos = 0;
+	more = false;
+	for (size_t i = 0; i < req->fields.size(); i++) {
+		if (req->fields[i].tag == MF_CONTINUE)
+			more = true;
+	}
+	return TRUE;
+}
+
+/* iterator protocol: returns {value, done}, the value is the key,
+ * or {key, data} when the cursor was made with values
+ */
+Handle<Value> Cursor::next(const Arguments &args)
+{
+	HandleScope scope;
+	Cursor *cursor = ObjectWrap::Unwrap<Cursor>(args.This());
+	gtm_req *req = cursor->req;
+	Local<Object> res = Object::New();
+
+	for (;;) {
+		while (cursor->pos < req->fields.size() && req->fields[cursor->pos].tag != MF_LIST)
+			cursor->pos++;
+		if (cursor->pos < req->fields.size() || !cursor->more)
+			break;
+		if (!cursor->fetch())
+			return scope.Close(Undefined());
+	}
+	if (cursor->pos >= req->fields.size()) {
+		res->Set(done_symbol, True());
+		res->Set(value_symbol, Undefined());
+		return scope.Close(res);
+	}
+
+	const mfield &f = req->fields[cursor->pos++];
+	Local<Value> key = field2js(req->ret, f);
+	/* the next page starts after this key */
+	req->subs.back().assign(req->ret, f.offset, f.length);
+
+	res->Set(done_symbol, False());
+	if (req->values) {
+		Local<Object> value = Object::New();
+		value->Set(key_symbol, key);
+		if (cursor->pos < req->fields.size() && req->fields[cursor->pos].tag == MF_DATA)
+			value->Set(field_names[MF_DATA], field2js(req->ret, req->fields[cursor->pos++]));
+		res->Set(value_symbol, value);
+	} else {
+		res->Set(value_symbol, key);
+	}
+	return scope.Close(res);
+}
+
+void Cursor::Init(Handle<Object> target)
+{
+	done_symbol = Persistent<String>::New(String::NewSymbol("done"));
+	value_symbol = Persistent<String>::New(String::NewSymbol("value"));
+	key_symbol = Persistent<String>::New(String::NewSymbol("key"));
+
+	Local<FunctionTemplate> tpl = FunctionTemplate::New(New);
+	tpl->SetClassName(String::NewSymbol("Cursor"));
+	tpl->InstanceTemplate()->SetInternalFieldCount(1);
+	tpl->PrototypeTemplate()->Set(String::NewSymbol("next"),
+		FunctionTemplate::New(next)->GetFunction());
+	constructor = Persistent<Function>::New(tpl->GetFunction());
+	target->Set(String::NewSymbol("Cursor"), constructor);
+}
+
+Persistent<Function> Routine::constructor;
+
+Routine::Routine() {}
+
+Routine::~Routine() {}
+
+/* new Routine('label^routine'), the call-in and the text gtm compiles
+ * for the call are the same every time, only the arguments change
+ */
+Handle<Value> Routine::New(const Arguments &args)
+{
+	HandleScope scope;
+
+	if (!args[0]->IsString() || args[0]->ToString()->Length() == 0) {
+		ThrowException(Exception::Error(String::New("Need to supply a function name")));
+		return scope.Close(Undefined());
+	}
+
+	Routine *routine = new Routine();
+	routine->func = *String::Utf8Value(args[0]);
+	routine->Wrap(args.This());
+	args.This()->Set(String::NewSymbol("function"), args[0]);
+	return args.This();
+}
+
+/* routine(arg, ...[, callback]) calls the function, numbers go as numbers,
+ * Buffers as their bytes and anything else as a string
+ */
+Handle<Value> Routine::invoke(const Arguments &args)
+{
+	HandleScope scope;
+	Routine *routine = ObjectWrap::Unwrap<Routine>(args.Holder());
+	Local<Function> callback;
+	int argc = args.Length();
+
+	if (argc > 0 && args[argc - 1]->IsFunction()) {
+		callback = Local<Function>::Cast(args[argc - 1]);
+		argc--;
+	}
+	if (argc > CALL_ARGS_MAX) {
+		ThrowException(Exception::Error(String::New("Too many arguments")));
+		return scope.Close(Undefined());
+	}
+	if (txn.level > 0) {
+		ThrowException(Exception::Error(String::New("A prepared routine is not allowed inside a transaction")));
+		return scope.Close(Undefined());
+	}
+
+	gtm_req *req = gtm_req_new(M::M_CALL);
+	uint64_t start = stats_enabled ? uv_hrtime() : 0;
+	Local<Array> js_args = Array::New(argc);
+
+	req->func = routine->func;
+	req->func_args.resize(argc);
+	for (int i = 0; i < argc; i++) {
+		Local<Value> arg = args[i];
+
+		js_args->Set(i, arg);
+		if (arg->IsNumber()) {
+			req->func_args[i] = *String::Utf8Value(arg);
+			num2mumps(req->func_args[i]);
+			req->arg_types += 'n';
+		} else if (Buffer::HasInstance(arg)) {
+			/* read in place, js_func_args keeps the Buffer alive */
+			req->call_args[i].address = Buffer::Data(arg);
+			req->call_args[i].length = Buffer::Length(arg);
+			req->arg_types += 'b';
+		} else if (!arg->IsUndefined()) {
+			req->func_args[i] = *String::Utf8Value(arg);
+			req->arg_types += 's';
+		} else {
+			req->arg_types += 's';
+		}
+	}
+	req->js_func_args = Persistent<Value>::New(js_args);
+	if (stats_enabled)
+		req->t_marshal = uv_hrtime() - start;
+	wb_settle(!callback.IsEmpty());
+	return scope.Close(gtm_run(req, callback));
+}
+
+void Routine::Init(Handle<Object> target)
+{
+	Local<FunctionTemplate> tpl = FunctionTemplate::New(New);
+	tpl->SetClassName(String::NewSymbol("Routine"));
+	tpl->InstanceTemplate()->SetInternalFieldCount(1);
+	tpl->InstanceTemplate()->SetCallAsFunctionHandler(invoke);
+	constructor = Persistent<Function>::New(tpl->GetFunction());
+	target->Set(String::NewSymbol("Routine"), constructor);
+}
 
 /* Entry point */
 void initialize(Handle<Object> target)
 {
     Gtm::Init(target);
-} 
+    Cursor::Init(target);
+    Routine::Init(target);
+}
 
 NODE_MODULE(mumps, initialize)
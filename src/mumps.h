@@ -1,6 +1,8 @@
 #ifndef MUMPS_H_
 #define MUMPS_H_
 
+#include <string>
+
 #include <node.h>
 #include <node_object_wrap.h>
 
@@ -15,25 +17,81 @@ public:
 	static void Init(Handle<Object>);
 private:
 	static Handle<Value> New(const Arguments&);
+	static Handle<Value> batch(const Arguments&);
+	static Handle<Value> cache(const Arguments&);
 	static Handle<Value> close(const Arguments&);
+	static Handle<Value> cursor(const Arguments&);
 	static Handle<Value> data(const Arguments&);
+	static Handle<Value> export_chunk(const Arguments&);
+	static Handle<Value> flush(const Arguments&);
 	static Handle<Value> function(const Arguments&);
 	static Handle<Value> get(const Arguments&);
+	static Handle<Value> get_buffer(const Arguments&);
+	static Handle<Value> get_number(const Arguments&);
 	static Handle<Value> global_directory(const Arguments&);
+	static Handle<Value> import_chunk(const Arguments&);
 	static Handle<Value> increment(const Arguments&);
+	static Handle<Value> increment_number(const Arguments&);
+	static Handle<Value> index(const Arguments&);
 	static Handle<Value> kill(const Arguments&);
 	static Handle<Value> lock(const Arguments&);
+	static Handle<Value> lookup(const Arguments&);
 	static Handle<Value> merge(const Arguments&);
 	static Handle<Value> open(const Arguments&);
 	static Handle<Value> order(const Arguments&);
+	static Handle<Value> partition(const Arguments&);
+	static Handle<Value> prepare(const Arguments&);
 	static Handle<Value> previous(const Arguments&);
+	static Handle<Value> query(const Arguments&);
+	static Handle<Value> rebuild_index(const Arguments&);
 	static Handle<Value> set(const Arguments&);
+	static Handle<Value> set_buffer(const Arguments&);
+	static Handle<Value> set_number(const Arguments&);
+	static Handle<Value> stats(const Arguments&);
+	static Handle<Value> tcommit(const Arguments&);
+	static Handle<Value> transaction(const Arguments&);
+	static Handle<Value> trollback(const Arguments&);
+	static Handle<Value> tstart(const Arguments&);
 	static Handle<Value> unlock(const Arguments&);
 	static Handle<Value> version(const Arguments&);
-	/* not implemented yet */
+	static Handle<Value> write_behind(const Arguments&);
 	static Handle<Value> update(const v8::Arguments&);
-	static Handle<Value> previous_node(const v8::Arguments&);
 	static Handle<Value> retrieve(const v8::Arguments&);
 	static Handle<Value> next_node(const v8::Arguments&);
+	/* not implemented yet */
+	static Handle<Value> previous_node(const v8::Arguments&);
+};
+
+struct gtm_req;
+
+/* walks the keys at one level of a global, a page of them per call-in */
+class Cursor: public ObjectWrap
+{
+public:
+	Cursor();
+	~Cursor();
+	static void Init(Handle<Object>);
+	static Persistent<Function> constructor;
+private:
+	static Handle<Value> New(const Arguments&);
+	static Handle<Value> next(const Arguments&);
+	int fetch(void);
+	struct gtm_req *req;	/* the last subscript is the position */
+	size_t pos;		/* of the next field in the page */
+	bool more;		/* the page did not reach the end of the level */
+};
+
+/* a prepared extrinsic function, called as a javascript function */
+class Routine: public ObjectWrap
+{
+public:
+	Routine();
+	~Routine();
+	static void Init(Handle<Object>);
+	static Persistent<Function> constructor;
+private:
+	static Handle<Value> New(const Arguments&);
+	static Handle<Value> invoke(const Arguments&);
+	std::string func;	/* label^routine */
 };
 #endif /* MUMPS_H_ */
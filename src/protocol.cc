@@ -0,0 +1,196 @@
+extern "C" {
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+}
+
+#include "common.h"
+#include "protocol.h"
+
+/* read a decimal length terminated with `:' starting at *pos */
+static int read_length(const char *buf, size_t buflen, size_t *pos, size_t *length)
+{
+	size_t i = *pos, n = 0;
+
+	if (i >= buflen || buf[i] < '0' || buf[i] > '9')
+		return FALSE;
+	while (i < buflen && buf[i] >= '0' && buf[i] <= '9') {
+		n = n * 10 + (buf[i] - '0');
+		/* nothing can be longer than the buffer */
+		if (n > buflen)
+			return FALSE;
+		i++;
+	}
+	if (i >= buflen || buf[i] != ':')
+		return FALSE;
+	*pos = i + 1;
+	*length = n;
+	return TRUE;
+}
+
+/* locate the fields of a message in a buffer of `buflen' bytes */
+int mproto_unwrap(const char *buf, size_t buflen, size_t *offset, size_t *length)
+{
+	size_t pos = 0, len;
+
+	if (!read_length(buf, buflen, &pos, &len))
+		return FALSE;
+	if (len > buflen - pos)
+		return FALSE;
+	*offset = pos;
+	*length = len;
+	return TRUE;
+}
+
+/* split the fields in msg[pos..end), nested messages are flattened
+ * right after the field that holds them
+ */
+static int decode_fields(const char *msg, size_t pos, size_t end, std::vector<mfield> &fields)
+{
+	char num[64];
+
+	while (pos < end) {
+		mfield f;
+
+		if (end - pos < 2)
+			return FALSE;
+		f.tag  = msg[pos++];
+		f.type = msg[pos++];
+		if (f.type != MF_STRING && f.type != MF_NUMBER && f.type != MF_MESSAGE)
+			return FALSE;
+		if (!read_length(msg, end, &pos, &f.length) || f.length > end - pos)
+			return FALSE;
+		f.offset = pos;
+		f.number = 0;
+		f.count  = 0;
+		if (f.type == MF_NUMBER) {
+			if (f.length >= sizeof(num))
+				return FALSE;
+			memcpy(num, msg + pos, f.length);
+			num[f.length] = '\0';
+			f.number = strtod(num, NULL);
+		}
+		fields.push_back(f);
+		if (f.type == MF_MESSAGE) {
+			size_t index = fields.size() - 1;
+
+			if (!decode_fields(msg, pos, pos + f.length, fields))
+				return FALSE;
+			fields[index].count = fields.size() - index - 1;
+		}
+		pos += f.length;
+	}
+	return TRUE;
+}
+
+/* split the fields of a message, numbers are parsed here
+ * so that only object construction is left to the caller
+ */
+int mproto_decode(const char *msg, size_t length, std::vector<mfield> &fields)
+{
+	fields.clear();
+	return decode_fields(msg, 0, length, fields);
+}
+
+/* tell if `s' is a number in the canonic form of M, GT.M keeps 18
+ * digits of a number so one with more stays a string
+ */
+int mproto_canonic(const char *s, size_t n)
+{
+	size_t i = 0, start;
+	int dot = FALSE;
+
+	if (n == 0 || n > 18 + (s[0] == '-') + (memchr(s, '.', n) != NULL))
+		return FALSE;
+	if (s[0] == '-')
+		i++;
+	start = i;
+	if (start == n)
+		return FALSE;
+	for (; i < n; i++) {
+		if (s[i] == '.') {
+			if (dot)
+				return FALSE;
+			dot = TRUE;
+		} else if (s[i] < '0' || s[i] > '9') {
+			return FALSE;
+		}
+	}
+	if (n == 1 && s[0] == '0')
+		return TRUE;
+	/* no leading zeros, no -0 and no 0.5 */
+	if (s[start] == '0')
+		return FALSE;
+	if (dot && (s[n - 1] == '0' || s[n - 1] == '.'))
+		return FALSE;
+	return TRUE;
+}
+
+/* tell if a byte can not go as it is into an M string literal */
+static inline int needs_escape(unsigned char c)
+{
+	return c == '"' || c < 0x20 || c == 0x7f;
+}
+
+/* length of the run at the start of `s' that goes into an M string
+ * literal as it is, 16 bytes at a time where there is SSE2
+ */
+size_t mproto_plain(const char *s, size_t n)
+{
+	size_t i = 0;
+
+#ifdef __SSE2__
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i ctrl = _mm_set1_epi8(0x1f);
+	const __m128i del = _mm_set1_epi8(0x7f);
+
+	for (; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+		__m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, quote),
+		    _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(v, ctrl), v), _mm_cmpeq_epi8(v, del)));
+		int mask = _mm_movemask_epi8(m);
+
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+#endif
+	for (; i < n; i++) {
+		if (needs_escape(s[i]))
+			break;
+	}
+	return i;
+}
+
+/* append `s' to `out' as an M string literal, quotes are doubled and
+ * control characters, which gtm takes as no graphic in a literal,
+ * go as $c(), so "a"_$c(0,10)_"b" for a NUL and a newline
+ */
+void mproto_quote(const char *s, size_t n, std::string &out)
+{
+	char num[8];
+	size_t i = 0, run;
+
+	out += '"';
+	for (;;) {
+		run = mproto_plain(s + i, n - i);
+		out.append(s + i, run);
+		i += run;
+		if (i == n)
+			break;
+		if (s[i] == '"') {
+			out += "\"\"";
+			i++;
+			continue;
+		}
+		out += "\"_$c(";
+		for (run = 0; i < n && s[i] != '"' && needs_escape(s[i]); i++, run++) {
+			snprintf(num, sizeof(num), run ? ",%d" : "%d", (unsigned char)s[i]);
+			out += num;
+		}
+		out += ")_\"";
+	}
+	out += '"';
+}
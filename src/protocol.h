@@ -0,0 +1,55 @@
+#ifndef PROTOCOL_H_
+#define PROTOCOL_H_
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+/* results come back from v4wNode.m as a length-prefixed message
+ *
+ *	message := length ":" field*
+ *	field   := tag type length ":" bytes
+ *
+ * where `length' is the decimal byte count of what follows,
+ * `tag' names the field and `type' tells how to read the bytes,
+ * the bytes of an MF_MESSAGE field are the fields of a nested message,
+ * the field length doing for its own length prefix
+ */
+
+/* field types */
+#define MF_STRING	's'
+#define MF_NUMBER	'n'
+#define MF_MESSAGE	'm'
+
+/* field tags */
+#define MF_OK		'o'
+#define MF_GLOBAL	'g'
+#define MF_DATA		'd'
+#define MF_DEFINED	'D'
+#define MF_RESULT	'r'
+#define MF_FUNCTION	'f'
+#define MF_ERROR_MESSAGE 'e'
+#define MF_CONTINUE	'c'	/* where to resume a chunked result */
+#define MF_SIZE		'z'	/* full size of a value passed out separately */
+#define MF_SUBSCRIPT	's'	/* repeated, one per subscript */
+#define MF_LIST		'l'	/* repeated, one per list item */
+
+struct mfield {
+	char tag;
+	char type;
+	size_t offset;	/* of the bytes in the message */
+	size_t length;
+	double number;	/* the bytes read as a number for MF_NUMBER */
+	size_t count;	/* the fields nested in an MF_MESSAGE, they follow it */
+};
+
+int mproto_unwrap(const char *buf, size_t buflen, size_t *offset, size_t *length);
+int mproto_decode(const char *msg, size_t length, std::vector<mfield> &fields);
+/* tell if `s' is a number in the canonic form of M, of 18 digits at most */
+int mproto_canonic(const char *s, size_t n);
+/* the bytes at the start of `s' that need no escape in an M string literal */
+size_t mproto_plain(const char *s, size_t n);
+/* append `s' as an M string literal, with quotes and control characters escaped */
+void mproto_quote(const char *s, size_t n, std::string &out);
+
+#endif /* PROTOCOL_H_ */
@@ -0,0 +1,30 @@
+#include "stats.h"
+
+void mstats_hist_add(struct mstats_hist *hist, uint64_t ns)
+{
+	int i = 0;
+
+	while (i < STATS_BUCKETS - 1 && ns >> (i + 1))
+		i++;
+	hist->buckets[i]++;
+	hist->count++;
+	hist->total += ns;
+	if (ns > hist->max)
+		hist->max = ns;
+}
+
+double mstats_hist_quantile(const struct mstats_hist *hist, double p)
+{
+	double seen = 0, bound;
+
+	if (hist->count == 0)
+		return 0;
+	for (int i = 0; i < STATS_BUCKETS; i++) {
+		seen += hist->buckets[i];
+		if (seen >= p * hist->count) {
+			bound = (double)((uint64_t)1 << (i + 1));
+			return bound < hist->max ? bound : hist->max;
+		}
+	}
+	return hist->max;
+}
@@ -0,0 +1,42 @@
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <stdint.h>
+
+/* latency histogram, bucket i counts times from 2^i to 2^(i+1) ns */
+#define STATS_BUCKETS	40
+
+struct mstats_hist {
+	double count;
+	double total;	/* ns */
+	double max;	/* ns */
+	double buckets[STATS_BUCKETS];
+};
+
+/* what is kept for each kind of call, phases are
+ * marshal: reading the javascript arguments
+ * call_in: encoding, the call-in itself and waiting for gtm
+ * decode: splitting the result and making javascript values of it
+ */
+struct mstats_op {
+	double calls;
+	double errors;
+	double bytes_in;
+	double bytes_out;
+	struct mstats_hist marshal;
+	struct mstats_hist call_in;
+	struct mstats_hist decode;
+};
+
+/* lock and lock_list, wait is the time of the call-in */
+struct mstats_lock {
+	double acquired;
+	double timed_out;
+	struct mstats_hist wait;
+};
+
+void mstats_hist_add(struct mstats_hist *hist, uint64_t ns);
+/* upper bound of the bucket holding the `p' quantile, 0 < p <= 1 */
+double mstats_hist_quantile(const struct mstats_hist *hist, double p);
+
+#endif /* STATS_H_ */
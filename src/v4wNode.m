@@ -33,26 +33,6 @@ iconvert:(data) ;convert decimals for input
  q data
  ;
  ;
-iescape:(data) ;convert quotes for input
- n ndata
- ;
- i data["""" d
- . n i
- . ;
- . s ndata=""
- . ;
- . f i=1:1:$l(data) d
- . . i $e(data,i)="""" d
- . . . i i=1!(i=$l(data)) d
- . . . . s ndata=ndata_$e(data,i)
- . . . e  d
- . . . . s ndata=ndata_""""_$e(data,i)
- . . e  s ndata=ndata_$e(data,i)
- e  s ndata=data
- ;
- quit ndata
- ;
- ;
 oconvert:(data,mode) ;convert decimals and strings for output
  i '$g(mode),$l(data)<19,data=+$p(data,"E") d
  . i $e(data)="." s data=0_data
@@ -78,6 +58,97 @@ oescape:(data) ;convert quotes or control characters for output
  quit ndata
  ;
  ;
+encode:(fields) ;prefix a message of result fields with its length, return what fits in one call-in
+ n msg,size
+ ;
+ s msg=$$wrap(fields)
+ ;
+ ;a result nested in a batch is cut, if need be, along with the batch
+ i $g(v4wNested) quit msg
+ ;
+ s size=$g(v4wSize,65535)
+ ;
+ ;the rest is handed out by more, a piece per call-in
+ i $zl(msg)>size s v4wRest=$ze(msg,size+1,$zl(msg)),msg=$ze(msg,1,size)
+ e  s v4wRest=""
+ ;
+ quit msg
+ ;
+ ;
+wrap:(fields) ;prefix a message of result fields with its length, for a message nested in another
+ quit $zl(fields)_":"_fields
+ ;
+ ;
+fs:(tag,value) ;encode a string result field
+ quit tag_"s"_$zl(value)_":"_value
+ ;
+ ;
+fn:(tag,value) ;encode a number result field
+ quit tag_"n"_$zl(value)_":"_value
+ ;
+ ;
+fv:(tag,value,mode) ;encode a result field as a number if it is canonical
+ i '$g(mode),$l(value)<19,value=+$p(value,"E") quit $$fn(tag,value)
+ ;
+ quit $$fs(tag,value)
+ ;
+ ;
+fsubs:(subs,mode) ;encode each subscript of a list of subscripts as a result field
+ n fields,num,sub
+ ;
+ s fields=""
+ ;
+ f  q:subs=""  d
+ . s num=+subs
+ . s $e(subs,1,$l(num)+1)=""
+ . s sub=$e(subs,1,num)
+ . ;
+ . ;the value of the literal, with its escapes undone
+ . s sub=@sub
+ . ;
+ . s fields=fields_$$fv("s",sub,mode)
+ . s $e(subs,1,num+1)=""
+ ;
+ quit fields
+ ;
+ ;
+field:(buf,pos) ;read the len:bytes field of buf at pos and move pos past it
+ n len
+ ;
+ s len=+$ze(buf,pos,pos+20)
+ s pos=pos+$l(len)+1
+ s pos=pos+len
+ ;
+ quit $ze(buf,pos-len,pos-1)
+ ;
+ ;
+cont:(node,level) ;the subscripts of node below level, in hex split by commas, for a next chunk to carry on after
+ n byte,cont,hex,i,j,sub
+ ;
+ s cont="",hex="0123456789ABCDEF"
+ f i=level+1:1:$ql(node) s sub=$qs(node,i) s:i>(level+1) cont=cont_"," f j=1:1:$zl(sub) s byte=$zascii(sub,j),cont=cont_$e(hex,byte\16+1)_$e(hex,byte#16+1)
+ ;
+ quit cont
+ ;
+ ;
+contNode:(root,cont) ;the node under root that a continuation made by cont names, "" if cont is not one
+ n byte,hex,i,j,node,sub
+ ;
+ s hex="0123456789ABCDEF"
+ ;
+ ;it comes back from the caller, so nothing in it is ever taken as M code
+ i cont=""!($tr(cont,hex_",")'="") quit ""
+ ;
+ s node=root
+ f i=1:1:$l(cont,",") d  q:node=""
+ . s byte=$p(cont,",",i),sub=""
+ . i byte=""!($l(byte)#2) s node="" q
+ . f j=1:2:$l(byte) s sub=sub_$zchar($f(hex,$e(byte,j))-2*16+$f(hex,$e(byte,j+1))-2)
+ . s node=$na(@node@(sub))
+ ;
+ quit node
+ ;
+ ;
 parse:(subs,type,mode) ;parse an argument list or list of subscripts
  s subs=$g(subs)
  ;
@@ -91,8 +162,8 @@ parse:(subs,type,mode) ;parse an argument list or list of subscripts
  . . s $e(subs,1,$l(num)+1)=""
  . . s sub=$e(subs,1,num)
  . . ;
+ . . ;an input subscript comes as an M literal, with its quotes doubled already
  . . i type="input" d
- . . . s sub=$$iescape(sub)
  . . . s sub=$$iconvert(sub)_","
  . . e  i type="output" d
  . . . s sub=$$oescape(sub)
@@ -111,6 +182,89 @@ parse:(subs,type,mode) ;parse an argument list or list of subscripts
  quit subs
  ;
  ;
+ixOf:(glvn) ;return the name of a global if it has indexes, or nothing, see index
+ i $e(glvn)="^" s $e(glvn)=""
+ ;
+ quit $s($d(v4wIndexOf(glvn)):glvn,1:"")
+ ;
+ ;
+ixMatch:(name,node) ;tell if an index covers a global node
+ n i,ok
+ ;
+ s ok=$ql(node)=v4wIndex(name,"level")
+ f i=1:1:$ql(node) q:'ok  i $d(v4wIndex(name,"at",i)) s ok=$qs(node,i)=v4wIndex(name,"at",i)
+ ;
+ quit ok
+ ;
+ ;
+ixEntry:(name,node,data) ;return the entry of an index for a global node holding data
+ n entry,i
+ ;
+ ;the value, then the subscripts the index takes any of
+ s entry=v4wIndex(name,"into"),entry=$na(@entry@(data))
+ f i=1:1:$ql(node) i '$d(v4wIndex(name,"at",i)) s entry=$na(@entry@($qs(node,i)))
+ ;
+ quit entry
+ ;
+ ;
+ixNode:(name,node,kill) ;make or drop the entry of an index for a global node, an empty value has none
+ q:'$$ixMatch(name,node)  q:'($d(@node)#10)  q:@node=""
+ ;
+ i kill k @$$ixEntry(name,node,@node) q
+ s @$$ixEntry(name,node,@node)=""
+ ;
+ quit
+ ;
+ ;
+ixUpdate:(gname,node,kill,tree) ;make or drop the index entries for a global node, and for the nodes below it if tree
+ n level,name,next
+ ;
+ s node=$na(@node),name=""
+ ;
+ f  s name=$o(v4wIndexOf(gname,name)) q:name=""  d
+ . ;a whole global gone takes its indexes with it
+ . i kill,tree,$ql(node)=0 k @v4wIndex(name,"into") q
+ . ;
+ . d ixNode(name,node,kill)
+ . ;
+ . s level=v4wIndex(name,"level")
+ . q:'tree  q:$ql(node)'<level
+ . ;
+ . s next=node
+ . f  s next=$q(@next) q:next=""  q:$na(@next,$ql(node))'=node  d:$ql(next)=level ixNode(name,next,kill)
+ ;
+ quit
+ ;
+ ;
+batch(ops,tp,mode) ;run a list of operations in one call, in a transaction if tp
+ u $p:ctrap="$c(3)" ;handle a Ctrl-C/SIGINT, while in GT.M, in a clean manner
+ ;
+ n $et,data,glvn,op,pos,return,subs,v4wNested
+ ;
+ s $et="tro:$tl"
+ ;
+ ;each operation is four fields: name, global, subscripts and data
+ i tp ts ():serial
+ ;
+ s pos=1,return=$$fn("o",1),v4wNested=1
+ ;
+ f  q:pos>$zl(ops)  d
+ . s op=$$field(ops,.pos),glvn=$$field(ops,.pos)
+ . s subs=$$field(ops,.pos),data=$$field(ops,.pos)
+ . ;
+ . i op="data" s return=return_"lm"_$$data(glvn,subs,mode) q
+ . i op="get" s return=return_"lm"_$$get(glvn,subs,mode) q
+ . i op="increment" s return=return_"lm"_$$increment(glvn,subs,data,mode) q
+ . i op="kill" s return=return_"lm"_$$kill(glvn,subs,mode) q
+ . i op="set" s return=return_"lm"_$$set(glvn,subs,data,mode) q
+ . s return=return_"lm"_$$wrap($$fn("o",0)_$$fs("e","Unknown operation: "_op))
+ ;
+ i tp tc
+ ;
+ k v4wNested
+ quit $$encode(return)
+ ;
+ ;
 data(glvn,subs,mode) ;check if global node has data or children
  u $p:ctrap="$c(3)" ;handle a Ctrl-C/SIGINT, while in GT.M, in a clean manner
  ;
@@ -120,10 +274,9 @@ data(glvn,subs,mode) ;check if global node has data or children
  s globalname=$$construct(glvn,subs)
  s defined=$d(@globalname)
  ;
- s glvn=$$oescape(glvn) ;for extended references
  i $e(glvn)="^" s $e(glvn)=""
  ;
- quit "{""ok"": 1, ""global"": """_glvn_""", ""defined"": "_defined_"}"
+ quit $$encode($$fn("o",1)_$$fs("g",glvn)_$$fn("D",defined))
  ;
  ;
 function(func,args,relink,mode) ;call an arbitrary extrinsic function
@@ -143,33 +296,75 @@ function(func,args,relink,mode) ;call an arbitrary extrinsic function
  d
  . n func,mode s @("result=$$"_function)
  ;
- s result=$$oescape(result)
- s result=$$oconvert(result,mode)
+ quit $$encode($$fn("o",1)_$$fs("f",func)_$$fv("r",result,mode))
+ ;
  ;
- quit "{""ok"": 1, ""function"": """_func_""", ""result"": "_result_"}"
+call(func,types,a1,a2,a3,a4,a5,a6,a7,a8,mode) ;call a prepared extrinsic function with typed arguments
+ u $p:ctrap="$c(3)" ;handle a Ctrl-C/SIGINT, while in GT.M, in a clean manner
+ ;
+ n call,i,result
+ ;
+ ;the arguments come as they are, numbers are made numbers, the text
+ ;of the call is the same for each number of them, so it is compiled once
+ s call="result=$$"_$s(func'["^":"^",1:"")_func
+ i types'="" d
+ . s call=call_"("
+ . f i=1:1:$l(types) d
+ . . i $e(types,i)="n" s @("a"_i)=+@("a"_i)
+ . . s call=call_$s(i>1:",",1:"")_"a"_i
+ . s call=call_")"
+ ;
+ d
+ . n func,i,mode,types s @call
+ ;
+ quit $$encode($$fn("o",1)_$$fs("f",func)_$$fv("r",result,mode))
  ;
  ;
 get(glvn,subs,mode) ;get data from global node
  u $p:ctrap="$c(3)" ;handle a Ctrl-C/SIGINT, while in GT.M, in a clean manner
  ;
- n data,defined,globalname,return
+ n data,defined,globalname
  ;
  s subs=$$parse($g(subs),"input",mode)
  s globalname=$$construct(glvn,subs)
  s data=$g(@globalname)
  ;
- s data=$$oescape(data)
- s data=$$oconvert(data,mode)
+ i $e(glvn)="^" s $e(glvn)=""
+ ;
+ s defined=$d(@globalname)#10
+ ;
+ quit $$encode($$fn("o",1)_$$fs("g",glvn)_$$fs("d",data)_$$fn("D",defined))
+ ;
+ ;
+getBuffer(glvn,subs,data,mode) ;get data from global node as it is, into a buffer of the caller
+ u $p:ctrap="$c(3)" ;handle a Ctrl-C/SIGINT, while in GT.M, in a clean manner
+ ;
+ n defined,globalname
+ ;
+ s subs=$$parse($g(subs),"input",mode)
+ s globalname=$$construct(glvn,subs)
+ s data=$g(@globalname)
  ;
- s glvn=$$oescape(glvn) ;for extended references
  i $e(glvn)="^" s $e(glvn)=""
  ;
  s defined=$d(@globalname)#10
  ;
- s return="{""ok"": 1, ""global"": """_glvn_""","
- s return=return_" ""data"": "_data_", ""defined"": "_defined_"}"
+ ;the size lets the caller retry with a bigger buffer
+ quit $$encode($$fn("o",1)_$$fs("g",glvn)_$$fn("D",defined)_$$fn("z",$zl(data)))
  ;
- quit return
+ ;
+getNumber(glvn,subs,number,defined,mode) ;get the number in a global node, into number and defined of the caller
+ u $p:ctrap="$c(3)" ;handle a Ctrl-C/SIGINT, while in GT.M, in a clean manner
+ ;
+ n globalname
+ ;
+ s subs=$$parse($g(subs),"input",mode)
+ s globalname=$$construct(glvn,subs)
+ ;
+ s number=+$g(@globalname)
+ s defined=$d(@globalname)#10
+ ;
+ quit
  ;
  ;
 globalDirectory(max,lo,hi) ;list the globals in a database, filtered or not
@@ -186,58 +381,95 @@ globalDirectory(max,lo,hi) ;list the globals in a database, filtered or not
  i $g(hi)="" s hi=""
  e  s hi="^"_hi
  ;
- s return="["
+ s return=$$fn("o",1)
  ;
  i $d(@global) d
- . s return=return_""""_$e(global,2,$l(global))_""", "
+ . s return=return_$$fs("l",$e(global,2,$l(global)))
  . ;
  . i max=1 s flag=1 q
  . i max>1 s max=max-1
  ;
  f  s global=$o(@global) q:flag!(global="")!(global]]hi&(hi]""))  d
- . s return=return_""""_$e(global,2,$l(global))_""", "
+ . s return=return_$$fs("l",$e(global,2,$l(global)))
  . ;
  . i max>0 s cnt=cnt+1 s:cnt>max flag=1
  ;
- s:$l(return)>2 return=$e(return,1,$l(return)-2)
- s return=return_"]"
- ;
- quit return
+ quit $$encode(return)
  ;
  ;
 increment(glvn,subs,incr,mode) ;increment the number in a global node
  u $p:ctrap="$c(3)" ;handle a Ctrl-C/SIGINT, while in GT.M, in a clean manner
  ;
- n globalname,increment
+ n globalname,increment,ix
  ;
  s subs=$$parse($g(subs),"input",mode)
  s globalname=$$construct(glvn,subs)
  ;
+ s ix=$$ixOf(glvn)
+ i ix'="" n $et s $et="tro:$tl" ts ():serial d ixUpdate(ix,globalname,1,0)
  s increment=$i(@globalname,$g(incr,1))
+ i ix'="" d ixUpdate(ix,globalname,0,0) tc
  ;
- s increment=$$oescape(increment)
- s increment=$$oconvert(increment,mode)
- ;
- s glvn=$$oescape(glvn) ;for extended references
  i $e(glvn)="^" s $e(glvn)=""
  ;
- quit "{""ok"": 1, ""global"": """_glvn_""", ""data"": "_increment_"}"
+ quit $$encode($$fn("o",1)_$$fs("g",glvn)_$$fs("d",increment))
  ;
  ;
-kill(glvn,subs,mode) ;kill a global or global node
+incrementNumber(glvn,subs,incr,number,mode) ;increment the number in a global node, into number of the caller
  u $p:ctrap="$c(3)" ;handle a Ctrl-C/SIGINT, while in GT.M, in a clean manner
  ;
- n globalname
+ n globalname,ix
  ;
  s subs=$$parse($g(subs),"input",mode)
  s globalname=$$construct(glvn,subs)
  ;
- s glvn=$$oescape(glvn) ;for extended references
+ s ix=$$ixOf(glvn)
+ i ix'="" n $et s $et="tro:$tl" ts ():serial d ixUpdate(ix,globalname,1,0)
+ s number=$i(@globalname,incr)
+ i ix'="" d ixUpdate(ix,globalname,0,0) tc
+ ;
+ quit
+ ;
+ ;
+index(name,glvn,pattern,iglvn,isubs,mode) ;declare an index of the nodes of a global that fit pattern, by their value
+ u $p:ctrap="$c(3)" ;handle a Ctrl-C/SIGINT, while in GT.M, in a clean manner
+ ;
+ n at,i,pos
+ ;
  i $e(glvn)="^" s $e(glvn)=""
  ;
+ ;the definitions last as long as the process, set, kill, merge and the like
+ ;keep the entries up to date from then on and rebuildIndex makes those of older nodes
+ i $d(v4wIndex(name)) k v4wIndexOf(v4wIndex(name),name),v4wIndex(name)
+ ;
+ s isubs=$$parse($g(isubs),"input",mode)
+ s v4wIndex(name)=glvn,v4wIndex(name,"into")=$na(@$$construct(iglvn,isubs))
+ ;
+ ;a field per subscript, = and the subscript, or empty for any subscript
+ s pos=1,i=0
+ f  q:pos>$zl(pattern)  s at=$$field(pattern,.pos),i=i+1 i at'="" s v4wIndex(name,"at",i)=$e(at,2,$l(at))
+ ;
+ s v4wIndex(name,"level")=i,v4wIndexOf(glvn,name)=""
+ ;
+ quit $$encode($$fn("o",1)_$$fs("g",glvn)_$$fs("r",name))
+ ;
+ ;
+kill(glvn,subs,mode) ;kill a global or global node
+ u $p:ctrap="$c(3)" ;handle a Ctrl-C/SIGINT, while in GT.M, in a clean manner
+ ;
+ n globalname,ix
+ ;
+ s subs=$$parse($g(subs),"input",mode)
+ s globalname=$$construct(glvn,subs)
+ ;
+ s ix=$$ixOf(glvn)
+ i ix'="" n $et s $et="tro:$tl" ts ():serial d ixUpdate(ix,globalname,1,1)
  k @globalname
+ i ix'="" tc
  ;
- quit "{""ok"": 1, ""global"": """_glvn_""", ""result"": ""0""}"
+ i $e(glvn)="^" s $e(glvn)=""
+ ;
+ quit $$encode($$fn("o",1)_$$fs("g",glvn)_$$fs("r",0))
  ;
  ;
 lock(glvn,subs,timeout,mode) ;lock a global node, incrementally
@@ -252,25 +484,85 @@ lock(glvn,subs,timeout,mode) ;lock a global node, incrementally
  ;
  i timeout=-1 d  ;if no timeout is passed by user, a -1 is passed
  . l +@globalname
- . i $t s result="1"
+ . s result="1"
  e  d
  . l +@globalname:timeout
  . i $t s result="1"
  ;
- s glvn=$$oescape(glvn) ;for extended references
  i $e(glvn)="^" s $e(glvn)=""
  ;
- quit "{""ok"": 1, ""global"": """_glvn_""", ""result"": """_result_"""}"
+ quit $$encode($$fn("o",1)_$$fs("g",glvn)_$$fs("r",result))
+ ;
+ ;
+lockList(nodes,timeout,mode) ;lock a list of global nodes in one go, incrementally, all of them or none
+ u $p:ctrap="$c(3)" ;handle a Ctrl-C/SIGINT, while in GT.M, in a clean manner
+ ;
+ n bad,data,end,glvn,left,list,node,op,pos,result,subs,taken
+ ;
+ s pos=1,bad=""
+ ;
+ ;each node is four fields: name, global, subscripts and data
+ f  q:pos>$zl(nodes)!(bad'="")  d
+ . s op=$$field(nodes,.pos),glvn=$$field(nodes,.pos)
+ . s subs=$$field(nodes,.pos),data=$$field(nodes,.pos)
+ . ;
+ . i glvn'?.1"^".1"%"1A.AN s bad=glvn q
+ . s subs=$$parse(subs,"input",mode)
+ . s list($$construct(glvn,subs))=""
+ ;
+ i bad'="" quit $$encode($$fn("o",0)_$$fs("e","Invalid global name: "_bad))
+ ;
+ ;a node at a time in collation order, so two lists can not wait on each other,
+ ;all within the one timeout
+ s result="1",node=""
+ i timeout'=-1 s end=$zut+(timeout*1E6)
+ f  s node=$o(list(node)) q:node=""  d  q:'result
+ . i timeout=-1 l +@node s taken(node)="" q
+ . s left=end-$zut/1E6 s:left<0 left=0
+ . l +@node:left
+ . i $t s taken(node)=""
+ . e  s result="0"
+ ;
+ ;all of them or none, those taken so far are released
+ i 'result s node="" f  s node=$o(taken(node)) q:node=""  l -@node
+ ;
+ quit $$encode($$fn("o",1)_$$fs("r",result))
+ ;
+ ;
+lookup(name,lo,hi,start,max,limit,mode) ;return the global nodes an index has for values from lo to hi, about max bytes at a time
+ u $p:ctrap="$c(3)" ;handle a Ctrl-C/SIGINT, while in GT.M, in a clean manner
+ ;
+ n count,entry,i,into,key,level,more,return,subs,value
+ ;
+ i '$d(v4wIndex(name)) quit $$encode($$fn("o",0)_$$fs("e","No such index: "_name))
+ ;
+ s into=v4wIndex(name,"into"),level=$ql(into)
+ s return=$$fn("o",1),count=0,more=0
+ ;
+ ;the first chunk starts just before lo, the next ones after the last entry returned
+ s entry=$s($g(start)'="":$$contNode(into,start),lo'="":$na(@into@(lo)),1:into)
+ i entry="" quit $$encode($$fn("o",0)_$$fs("e","Invalid start of a chunk"))
+ f  s entry=$q(@entry) q:entry=""  q:$na(@entry,level)'=into  s value=$qs(entry,level+1) q:hi'=""&(value]]hi)  d  i $zl(return)>max!(limit&(count'<limit)) s more=1 q
+ . ;the subscripts of the node, those the index takes any of come after the value
+ . s subs="",key=level+1
+ . f i=1:1:v4wIndex(name,"level") s subs=subs_$$fv("s",$s($d(v4wIndex(name,"at",i)):v4wIndex(name,"at",i),1:$qs(entry,$i(key))),mode)
+ . ;
+ . s return=return_"lm"_$$wrap(subs_$$fv("d",value,mode))
+ . s count=count+1
+ ;
+ i more s return=return_$$fs("c",$$cont(entry,level))
+ ;
+ quit $$encode(return_$$fs("g",v4wIndex(name)))
  ;
  ;
 merge(fglvn,fsubs,tglvn,tsubs,mode) ;merge an array node to another array node
  u $p:ctrap="$c(3)" ;handle a Ctrl-C/SIGINT, while in GT.M, in a clean manner
  ;
- n fglobalname,fosubs,return,tglobalname,tosubs
+ n fglobalname,fosubs,ix,return,tglobalname,tosubs
  ;
  ;process for output without going through M
- s fosubs=$$parse(fsubs,"pass",mode)
- s tosubs=$$parse(tsubs,"pass",mode)
+ s fosubs=$$fsubs(fsubs,mode)
+ s tosubs=$$fsubs(tsubs,mode)
  ;
  s fsubs=$$parse(fsubs,"input",mode)
  s fglobalname=$$construct(fglvn,fsubs)
@@ -278,31 +570,36 @@ merge(fglvn,fsubs,tglvn,tsubs,mode) ;merge an array node to another array node
  s tsubs=$$parse(tsubs,"input",mode)
  s tglobalname=$$construct(tglvn,tsubs)
  ;
+ ;the nodes merged over may have had other values
+ s ix=$$ixOf(tglvn)
+ i ix'="" n $et s $et="tro:$tl" ts ():serial d ixUpdate(ix,tglobalname,1,1)
  m @tglobalname=@fglobalname
+ i ix'="" d ixUpdate(ix,tglobalname,0,1) tc
  ;
- s fglvn=$$oescape(fglvn) ;for extended references
- s tglvn=$$oescape(tglvn) ;for extended references
  i $e(fglvn)="^" s $e(fglvn)=""
  i $e(tglvn)="^" s $e(tglvn)=""
  ;
- s return="{""ok"": 1, ""global"": """_fglvn_""","
+ s return=$$fn("o",1)_$$fs("g",fglvn)
  ;
- i fosubs'=""!(tosubs'="") d
- . s return=return_" ""subscripts"": ["
- . i fosubs'="" s return=return_fosubs_", "
- . s return=return_""""_tglvn_""""
- . i tosubs'="" s return=return_", "_tosubs
- . s return=return_"],"
+ i fosubs'=""!(tosubs'="") s return=return_fosubs_$$fs("s",tglvn)_tosubs
  ;
- s return=return_" ""result"": ""1""}"
+ quit $$encode(return_$$fs("r",1))
  ;
- quit return
+ ;
+more() ;return the next piece of a result that did not fit in one call-in
+ n msg,size
+ ;
+ s size=$g(v4wSize,65535)
+ s msg=$ze($g(v4wRest),1,size)
+ s v4wRest=$ze($g(v4wRest),size+1,$zl($g(v4wRest)))
+ ;
+ quit msg
  ;
  ;
 nextNode(glvn,subs,mode) ;return the next global node, depth first
  u $p:ctrap="$c(3)" ;handle a Ctrl-C/SIGINT, while in GT.M, in a clean manner
  ;
- n data,defined,globalname,nsubs,result,return
+ n data,defined,globalname,i,nsubs,result
  ;
  s subs=$$parse($g(subs),"input",mode)
  s globalname=$$construct(glvn,subs)
@@ -312,40 +609,16 @@ nextNode(glvn,subs,mode) ;return the next global node, depth first
  i result="" s defined=0
  e  s defined=1
  ;
+ s nsubs=""
+ ;
  i defined d
- . n sub
- . ;
  . s data=@result
  . ;
- . s data=$$oescape(data)
- . s data=$$oconvert(data,mode)
- . ;
- . i $e(result)="^" s $e(result)=""
- . ;
- . s nsubs=""
- . ;
- . f i=1:1:$ql(result) d
- . . s sub=$$oescape($qs(result,i))
- . . s sub=$$oconvert(sub,mode)
- . . ;
- . . s nsubs=nsubs_", "_sub
- . ;
- . s $e(nsubs,1,2)=""
+ . f i=1:1:$ql(result) s nsubs=nsubs_$$fv("s",$qs(result,i),mode)
  ;
- s glvn=$$oescape(glvn) ;for extended references
  i $e(glvn)="^" s $e(glvn)=""
  ;
- s return="{""ok"": 1, ""global"": """_glvn_""","
- ;
- i defined,nsubs'="" s return=return_" ""subscripts"": ["_nsubs_"],"
- ;
- s return=return_" ""defined"": "_defined
- ;
- i defined s return=return_", ""data"": "_data_"}"
- e  s return=return_"}"
- ;
- ;
- quit return
+ quit $$encode($$fn("o",1)_$$fs("g",glvn)_nsubs_$$fn("D",defined)_$s(defined:$$fs("d",data),1:""))
  ;
  ;
 order(glvn,subs,mode,order) ;return the next global node at the same level
@@ -361,13 +634,56 @@ order(glvn,subs,mode,order) ;return the next global node at the same level
  ;
  i subs="",$e(result)="^" s $e(result)=""
  ;
- s result=$$oescape(result)
- s result=$$oconvert(result,mode)
+ i $e(glvn)="^" s $e(glvn)=""
+ ;
+ quit $$encode($$fn("o",1)_$$fs("g",glvn)_$$fv("r",result,mode))
+ ;
+ ;
+orderPage(glvn,subs,max,size,dir,values,mode) ;return up to max keys after the last subscript, in about size bytes
+ u $p:ctrap="$c(3)" ;handle a Ctrl-C/SIGINT, while in GT.M, in a clean manner
+ ;
+ n globalname,i,key,parent,result
+ ;
+ s subs=$$parse($g(subs),"input",mode)
+ s globalname=$$construct(glvn,subs)
+ s parent=$na(@globalname,$ql(globalname)-1)
+ s key=$qs(globalname,$ql(globalname))
+ s result=""
+ ;
+ f i=1:1:max s key=$o(@parent@(key),dir) q:key=""  d  q:$zl(result)>size
+ . s result=result_$$fv("l",key,mode)
+ . i values s result=result_$$fs("d",$g(@parent@(key)))
+ ;
+ ;more keys may follow unless the level ran out
+ i key'="" s result=result_$$fn("c",1)
+ ;
+ quit $$encode($$fn("o",1)_result)
+ ;
+ ;
+partition(glvn,subs,parts,mode) ;return the keys below a node that split it into parts of as many keys
+ u $p:ctrap="$c(3)" ;handle a Ctrl-C/SIGINT, while in GT.M, in a clean manner
+ ;
+ n count,globalname,i,key,n,return
+ ;
+ s subs=$$parse($g(subs),"input",mode)
+ s globalname=$na(@$$construct(glvn,subs))
+ ;
+ ;a walk of the keys with $order reads no data, the second one stops at the last part
+ s count=0,key=""
+ f  s key=$o(@globalname@(key)) q:key=""  s count=count+1
+ ;
+ s return=$$fn("o",1)_$$fn("r",count)
+ s:parts>count parts=count
+ ;
+ ;the part i starts at the key i*count\parts, counted from 0
+ s i=1,n=0,key=""
+ i parts>1 f  s key=$o(@globalname@(key)) q:key=""  d  q:i'<parts
+ . i n=(i*count\parts) s return=return_$$fv("l",key,mode),i=i+1
+ . s n=n+1
  ;
- s glvn=$$oescape(glvn) ;for extended references
  i $e(glvn)="^" s $e(glvn)=""
  ;
- quit "{""ok"": 1, ""global"": """_glvn_""", ""result"": "_result_"}"
+ quit $$encode(return_$$fs("g",glvn))
  ;
  ;
 previous(glvn,subs,mode) ;same as order, only in reverse
@@ -404,16 +720,117 @@ procedure(proc,args,relink,mode) ;call an arbitrary procedure/subroutine
  quit return
  ;
  ;
-retrieve() ;not yet implemented
+resultSize(size) ;set how many bytes of a result the caller takes from one call-in
+ s v4wSize=size,v4wRest=""
+ ;
+ quit
+ ;
+ ;
+query(glvn,subs,start,max,match,limit,mode) ;return the nodes of a subtree that pass the tests of match, depth first, about max bytes at a time
+ u $p:ctrap="$c(3)" ;handle a Ctrl-C/SIGINT, while in GT.M, in a clean manner
+ ;
+ n count,data,first,globalname,kfrom,kto,level,node,pos,return,spat,spre,sub,vmax,vmin,vpat,vpre
+ ;
+ s subs=$$parse($g(subs),"input",mode)
+ s globalname=$na(@$$construct(glvn,subs))
+ s level=$ql(globalname)
+ s return=$$fn("o",1),count=0
+ ;
+ ;the tests are eight fields: subscript prefix and pattern, value prefix and pattern,
+ ;lowest and highest value, first and last but one key below the node, an empty one is no test
+ s pos=1
+ s spre=$$field(match,.pos),spat=$$field(match,.pos)
+ s vpre=$$field(match,.pos),vpat=$$field(match,.pos)
+ s vmin=$$field(match,.pos),vmax=$$field(match,.pos)
+ s kfrom=$$field(match,.pos),kto=$$field(match,.pos)
+ ;
+ ;a key bound is n(umber) or s(tring) and its text
+ s kfrom=$s($e(kfrom)="n":+$e(kfrom,2,$zl(kfrom)),1:$e(kfrom,2,$zl(kfrom)))
+ s kto=$s($e(kto)="n":+$e(kto,2,$zl(kto)),1:$e(kto,2,$zl(kto)))
+ ;
+ ;the first chunk starts at the root of the subtree, or at its first key, which is looked at
+ ;itself, the next ones after the last node looked at
+ s first=$g(start)=""&(kfrom'="")
+ s node=$s($g(start)'="":$$contNode(globalname,start),first:$na(@globalname@(kfrom)),1:globalname)
+ i node="" quit $$encode($$fn("o",0)_$$fs("e","Invalid start of a chunk"))
+ f  s:'first node=$q(@node) q:node=""  q:$na(@node,level)'=globalname  q:kto'=""&'(kto]]$qs(node,level+1))  d  q:$zl(return)>max  q:limit&(count'<limit)
+ . i first s first=0 q:'($d(@node)#2)
+ . s sub=$qs(node,$ql(node)),data=@node
+ . ;
+ . i spre'="",$e(sub,1,$l(spre))'=spre q
+ . i spat'="",sub'?@spat q
+ . i vpre'="",$e(data,1,$l(vpre))'=vpre q
+ . i vpat'="",data'?@vpat q
+ . i vmin'="",data'=+data!(data<vmin) q
+ . i vmax'="",data'=+data!(data>vmax) q
+ . ;
+ . n fields,i
+ . ;
+ . s fields=""
+ . f i=level+1:1:$ql(node) s fields=fields_$$fv("s",$qs(node,i),mode)
+ . ;
+ . s return=return_"lm"_$$wrap(fields_$$fs("d",data))
+ . s count=count+1
+ ;
+ i node'="",$na(@node,level)=globalname,kto=""!(kto]]$qs(node,level+1)) s return=return_$$fs("c",$$cont(node,level))
+ ;
+ i $e(glvn)="^" s $e(glvn)=""
+ ;
+ quit $$encode(return_$$fs("g",glvn))
+ ;
+ ;
+rebuildIndex(name,start,max,mode) ;make the entries of an index for up to max nodes of its global at a time, afresh from the first
  u $p:ctrap="$c(3)" ;handle a Ctrl-C/SIGINT, while in GT.M, in a clean manner
  ;
- quit "{""status"": ""retrieve not yet implemented""}"
+ n count,made,node
+ ;
+ i '$d(v4wIndex(name)) quit $$encode($$fn("o",0)_$$fs("e","No such index: "_name))
+ ;
+ i $g(start)="" k @v4wIndex(name,"into") s node="^"_v4wIndex(name)
+ e  s node=$$contNode("^"_v4wIndex(name),start) i node="" quit $$encode($$fn("o",0)_$$fs("e","Invalid start of a chunk"))
+ ;
+ s count=0,made=0
+ f  s node=$q(@node) q:node=""  d  s count=count+1 q:count'<max
+ . q:'$$ixMatch(name,node)  q:@node=""
+ . s @$$ixEntry(name,node,@node)="",made=made+1
+ ;
+ quit $$encode($$fn("o",1)_$$fs("g",v4wIndex(name))_$$fn("r",made)_$s(node'="":$$fs("c",$$cont(node,0)),1:""))
+ ;
+ ;
+retrieve(glvn,subs,start,max,mode) ;return the nodes of a subtree depth first, about max bytes at a time
+ u $p:ctrap="$c(3)" ;handle a Ctrl-C/SIGINT, while in GT.M, in a clean manner
+ ;
+ n globalname,level,node,return
+ ;
+ s subs=$$parse($g(subs),"input",mode)
+ s globalname=$na(@$$construct(glvn,subs))
+ s level=$ql(globalname)
+ s return=$$fn("o",1)
+ ;
+ ;the first chunk starts at the root of the subtree, the next ones after the last node returned
+ s node=globalname
+ i $g(start)'="" s node=$$contNode(globalname,start) i node="" quit $$encode($$fn("o",0)_$$fs("e","Invalid start of a chunk"))
+ i $g(start)="",$d(@globalname)#10 s return=return_"lm"_$$wrap($$fs("d",@globalname))
+ ;
+ f  s node=$q(@node) q:node=""  q:$na(@node,level)'=globalname  d  q:$zl(return)>max
+ . n fields,i
+ . ;
+ . s fields=""
+ . f i=level+1:1:$ql(node) s fields=fields_$$fv("s",$qs(node,i),mode)
+ . ;
+ . s return=return_"lm"_$$wrap(fields_$$fs("d",@node))
+ ;
+ i node'="",$na(@node,level)=globalname s return=return_$$fs("c",$$cont(node,level))
+ ;
+ i $e(glvn)="^" s $e(glvn)=""
+ ;
+ quit $$encode(return_$$fs("g",glvn))
  ;
  ;
 set(glvn,subs,data,mode) ;set a global node
  u $p:ctrap="$c(3)" ;handle a Ctrl-C/SIGINT, while in GT.M, in a clean manner
  ;
- n globalname
+ n globalname,ix
  ;
  s subs=$$parse($g(subs),"input",mode)
  ; 
@@ -421,19 +838,95 @@ set(glvn,subs,data,mode) ;set a global node
  ;
  s data=$$iconvert(data)
  ;
- W subs
  s $e(data)=$tr($e(data),"""","")
  s $e(data,$l(data))=$tr($e(data,$l(data)),"""","")
  ;
+ ;an indexed global changes along with its indexes, all or nothing
+ s ix=$$ixOf(glvn)
+ i ix'="" n $et s $et="tro:$tl" ts ():serial d ixUpdate(ix,globalname,1,0)
  s @globalname=data
+ i ix'="" d ixUpdate(ix,globalname,0,0) tc
  ;
- s data=$$oescape(data)
- s data=$$oconvert(data,mode)
+ i $e(glvn)="^" s $e(glvn)=""
+ ;
+ quit $$encode($$fn("o",1)_$$fs("g",glvn)_$$fs("d",data)_$$fs("r",0))
+ ;
+ ;
+setBuffer(glvn,subs,data,mode) ;set a global node to data as it is, without conversion
+ u $p:ctrap="$c(3)" ;handle a Ctrl-C/SIGINT, while in GT.M, in a clean manner
+ ;
+ n globalname,ix
+ ;
+ s subs=$$parse($g(subs),"input",mode)
+ s globalname=$$construct(glvn,subs)
+ ;
+ s ix=$$ixOf(glvn)
+ i ix'="" n $et s $et="tro:$tl" ts ():serial d ixUpdate(ix,globalname,1,0)
+ s @globalname=data
+ i ix'="" d ixUpdate(ix,globalname,0,0) tc
  ;
- s glvn=$$oescape(glvn) ;for extended references
  i $e(glvn)="^" s $e(glvn)=""
  ;
- quit "{""ok"": 1, ""global"": """_glvn_""", ""data"": "_data_", ""result"": ""0""}"
+ quit $$encode($$fn("o",1)_$$fs("g",glvn)_$$fs("r",0))
+ ;
+ ;
+setNumber(glvn,subs,number,mode) ;set a global node to a number
+ u $p:ctrap="$c(3)" ;handle a Ctrl-C/SIGINT, while in GT.M, in a clean manner
+ ;
+ n globalname,ix
+ ;
+ s subs=$$parse($g(subs),"input",mode)
+ s globalname=$$construct(glvn,subs)
+ ;
+ s ix=$$ixOf(glvn)
+ i ix'="" n $et s $et="tro:$tl" ts ():serial d ixUpdate(ix,globalname,1,0)
+ s @globalname=number
+ i ix'="" d ixUpdate(ix,globalname,0,0) tc
+ ;
+ quit
+ ;
+ ;
+tcommit(ops,mode) ;make the writes of a transaction, if the nodes it read are unchanged
+ u $p:ctrap="$c(3)" ;handle a Ctrl-C/SIGINT, while in GT.M, in a clean manner
+ ;
+ n $et,changed,data,glvn,op,pos,subs
+ ;
+ s $et="tro:$tl"
+ ;
+ ;gtm restarts from here on a conflict of its own
+ ts ():serial
+ ;
+ s pos=1,changed=0
+ ;
+ ;each operation is four fields: name, global, subscripts and data
+ f  q:pos>$zl(ops)!changed  d
+ . s op=$$field(ops,.pos),glvn=$$field(ops,.pos)
+ . s subs=$$field(ops,.pos),data=$$field(ops,.pos)
+ . ;
+ . i op="absent" s changed='$$unchanged(glvn,subs,0,"",mode) q
+ . i op="check" s changed='$$unchanged(glvn,subs,1,data,mode) q
+ . i op="kill" s data=$$kill(glvn,subs,mode) q
+ . i op="set" s data=$$set(glvn,subs,data,mode) q
+ ;
+ i changed tro  quit $$encode($$fn("o",0)_$$fs("e","Transaction restart: a node it read has changed"))
+ ;
+ tc
+ ;
+ quit $$encode($$fn("o",1)_$$fn("r",$tl))
+ ;
+ ;
+unchanged:(glvn,subs,defined,data,mode) ;tell if a node still holds what a transaction read
+ n globalname
+ ;
+ s subs=$$parse($g(subs),"input",mode)
+ s globalname=$$construct(glvn,subs)
+ ;
+ s $e(data)=$tr($e(data),"""","")
+ s $e(data,$l(data))=$tr($e(data,$l(data)),"""","")
+ ;
+ i $d(@globalname)#10'=defined quit 0
+ ;
+ quit $g(@globalname)=data
  ;
  ;
 unlock(glvn,subs,mode) ;unlock a global node, incrementally, or release all locks
@@ -444,19 +937,43 @@ unlock(glvn,subs,mode) ;unlock a global node, incrementally, or release all lock
  s subs=$$parse($g(subs),"input",mode)
  s globalname=$$construct(glvn,subs)
  ;
- i glvn=""&(subs="") l  quit """0"""
+ i glvn=""&(subs="") l  quit $$encode($$fn("o",1)_$$fs("r",0))
  e  l -@globalname
  ;
- s glvn=$$oescape(glvn) ;for extended references
  i $e(glvn)="^" s $e(glvn)=""
  ;
- quit "{""ok"": 1, ""global"": """_glvn_""", ""result"": ""0""}"
+ quit $$encode($$fn("o",1)_$$fs("g",glvn)_$$fs("r",0))
  ;
  ;
-update() ;not yet implemented
+update(glvn,subs,nodes,mode) ;set the nodes of a subtree, given as pairs of subscripts and data
  u $p:ctrap="$c(3)" ;handle a Ctrl-C/SIGINT, while in GT.M, in a clean manner
  ;
- quit "{""status"": ""update not yet implemented""}"
+ n data,globalname,ix,nsubs,pos
+ ;
+ s subs=$$parse($g(subs),"input",mode)
+ ;
+ s ix=$$ixOf(glvn)
+ i ix'="" n $et s $et="tro:$tl" ts ():serial
+ ;
+ s pos=1
+ ;
+ f  q:pos>$zl(nodes)  d
+ . s nsubs=$$parse($$field(nodes,.pos),"input",mode)
+ . s data=$$iconvert($$field(nodes,.pos))
+ . ;
+ . s $e(data)=$tr($e(data),"""","")
+ . s $e(data,$l(data))=$tr($e(data,$l(data)),"""","")
+ . ;
+ . s globalname=$$construct(glvn,subs_$s(subs'=""&(nsubs'=""):",",1:"")_nsubs)
+ . i ix'="" d ixUpdate(ix,globalname,1,0)
+ . s @globalname=data
+ . i ix'="" d ixUpdate(ix,globalname,0,0)
+ ;
+ i ix'="" tc
+ ;
+ i $e(glvn)="^" s $e(glvn)=""
+ ;
+ quit $$encode($$fn("o",1)_$$fs("g",glvn)_$$fs("r",0))
  ;
  ;
 version() ;return the version string
@@ -0,0 +1,139 @@
+extern "C" {
+#include <stdlib.h>
+#include <assert.h>
+}
+
+#include <uv.h>
+
+#include "worker.h"
+
+/* serializes all calls into gtm */
+static uv_mutex_t gtm_mutex;
+/* protects the queues and the state flags below */
+static uv_mutex_t queue_mutex;
+static uv_cond_t queue_cond;
+/* wakes up the event loop when there is finished work */
+static uv_async_t done_async;
+static uv_thread_t worker_thread;
+
+/* work waiting for the worker thread */
+static struct gtm_work *pending_head, *pending_tail;
+/* work finished by the worker thread, waiting for the event loop */
+static struct gtm_work *done_head, *done_tail;
+
+static int running;
+static int stopping;
+/* submitted but not yet completed, touched on the event loop thread only */
+static unsigned int inflight;
+
+#define queue_push(head, tail, work) \
+do { \
+	(work)->next = NULL; \
+	if (tail) \
+		(tail)->next = (work); \
+	else \
+		(head) = (work); \
+	(tail) = (work); \
+} while (0)
+
+static void worker_loop(void *arg)
+{
+	struct gtm_work *work;
+
+	for (;;) {
+		uv_mutex_lock(&queue_mutex);
+		while (pending_head == NULL && !stopping)
+			uv_cond_wait(&queue_cond, &queue_mutex);
+		/* drain the queue before leaving */
+		if (pending_head == NULL) {
+			uv_mutex_unlock(&queue_mutex);
+			break;
+		}
+		work = pending_head;
+		pending_head = work->next;
+		if (pending_head == NULL)
+			pending_tail = NULL;
+		uv_mutex_unlock(&queue_mutex);
+
+		work->exec(work);
+
+		uv_mutex_lock(&queue_mutex);
+		queue_push(done_head, done_tail, work);
+		uv_mutex_unlock(&queue_mutex);
+		uv_async_send(&done_async);
+	}
+}
+
+static void worker_done(uv_async_t *handle, int status)
+{
+	struct gtm_work *work, *next;
+	/* uv_async_send() calls are coalesced, so take everything there is */
+	uv_mutex_lock(&queue_mutex);
+	work = done_head;
+	done_head = done_tail = NULL;
+	uv_mutex_unlock(&queue_mutex);
+
+	for (; work != NULL; work = next) {
+		next = work->next;
+		assert(inflight > 0);
+		/* let the process exit when nothing is in flight */
+		if (--inflight == 0)
+			uv_unref((uv_handle_t *)&done_async);
+		work->done(work);
+	}
+}
+
+void gtm_worker_init(void)
+{
+	uv_mutex_init(&gtm_mutex);
+	uv_mutex_init(&queue_mutex);
+	uv_cond_init(&queue_cond);
+	uv_async_init(uv_default_loop(), &done_async, worker_done);
+	uv_unref((uv_handle_t *)&done_async);
+}
+
+void gtm_worker_submit(struct gtm_work *work)
+{
+	/* the thread is started on first use */
+	if (!running) {
+		if (uv_thread_create(&worker_thread, worker_loop, NULL) != 0)
+			abort();
+		running = 1;
+	}
+	if (inflight++ == 0)
+		uv_ref((uv_handle_t *)&done_async);
+
+	uv_mutex_lock(&queue_mutex);
+	queue_push(pending_head, pending_tail, work);
+	uv_cond_signal(&queue_cond);
+	uv_mutex_unlock(&queue_mutex);
+}
+
+/* wait for the queued work to finish and terminate the thread,
+ * completions are still delivered to the event loop afterwards
+ */
+void gtm_worker_stop(void)
+{
+	if (!running)
+		return;
+
+	uv_mutex_lock(&queue_mutex);
+	stopping = 1;
+	uv_cond_signal(&queue_cond);
+	uv_mutex_unlock(&queue_mutex);
+
+	uv_thread_join(&worker_thread);
+
+	running = 0;
+	stopping = 0;
+}
+
+void gtm_lock(void)
+{
+	uv_mutex_lock(&gtm_mutex);
+}
+
+void gtm_unlock(void)
+{
+	uv_mutex_unlock(&gtm_mutex);
+}
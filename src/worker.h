@@ -0,0 +1,27 @@
+#ifndef WORKER_H_
+#define WORKER_H_
+
+#include <uv.h>
+
+/* a unit of work for the gtm worker thread,
+ * embed it as the first member of a request structure
+ */
+struct gtm_work {
+	/* runs on the worker thread, must not touch v8 */
+	void (*exec)(struct gtm_work *);
+	/* runs on the event loop thread once `exec' has finished */
+	void (*done)(struct gtm_work *);
+	struct gtm_work *next;
+};
+
+void gtm_worker_init(void);
+void gtm_worker_submit(struct gtm_work *work);
+void gtm_worker_stop(void);
+
+/* gtm is single-threaded: every call into gtm has to be made
+ * while holding this lock no matter which thread makes it
+ */
+void gtm_lock(void);
+void gtm_unlock(void);
+
+#endif /* WORKER_H_ */